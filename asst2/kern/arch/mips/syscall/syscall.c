@@ -137,6 +137,48 @@ void syscall(struct trapframe *tf)
 						&retval);
 		break;
 
+	case SYS_readv:
+		err = sys_readv((int)tf->tf_a0,
+						(userptr_t)tf->tf_a1,
+						(int)tf->tf_a2,
+						&retval);
+		break;
+
+	case SYS_writev:
+		err = sys_writev((int)tf->tf_a0,
+						 (userptr_t)tf->tf_a1,
+						 (int)tf->tf_a2,
+						 &retval);
+		break;
+
+	case SYS_pread:
+	case SYS_pwrite:
+	{
+		off_t pos; // 64-bit, so it skips a3 and goes on the user-level stack
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &pos, sizeof(pos));
+
+		if (!err)
+		{
+			if (callno == SYS_pread)
+			{
+				err = sys_pread((int)tf->tf_a0,
+								(userptr_t)tf->tf_a1,
+								(size_t)tf->tf_a2,
+								pos,
+								&retval);
+			}
+			else
+			{
+				err = sys_pwrite((int)tf->tf_a0,
+								 (userptr_t)tf->tf_a1,
+								 (size_t)tf->tf_a2,
+								 pos,
+								 &retval);
+			}
+		}
+	}
+	break;
+
 	case SYS_lseek:
 	{
 		int whence; // read from user-level stack
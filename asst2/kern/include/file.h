@@ -10,25 +10,57 @@
  */
 #include <limits.h>
 #include <proc.h>
+#include <spinlock.h>
 
+/*
+ * f_ref_count counts the file table slots holding the file plus the
+ * system calls using it right now, and is only changed atomically.
+ * f_lock only protects f_offset. When the count drops to zero the
+ * vnode is closed at once, but the struct itself only goes on a list
+ * of files to free (through f_reclaim_next). A workqueue item frees
+ * everything on the list after one RCU grace period, since a lookup
+ * that found one of them in the table just before may still be about
+ * to look at its count.
+ */
 struct file
 {
     int f_flag;
-    int f_ref_count;
+    volatile spinlock_data_t f_ref_count;
     off_t f_offset;
     struct vnode *f_vnode;
     struct lock *f_lock;
+    struct file *f_reclaim_next;
 };
 
+/*
+ * Looking a descriptor up takes no lock: read, write, lseek and the
+ * rest load opened_files[fd] inside an RCU read section and take a
+ * reference on the file (unless its count has already reached zero).
+ * ft_lock is only for open, close and dup2, which change the table.
+ *
+ * ft_inuse has a bit set for each open descriptor and ft_fullwords a
+ * bit set for each word of ft_inuse that is full, so open finds the
+ * lowest free descriptor with two first-zero searches on 32-bit words
+ * rather than a scan of opened_files.
+ */
+#define FT_WORDBITS 32
+#define FT_NWORDS (OPEN_MAX / FT_WORDBITS)
+
 struct file_table
 {
     struct file *opened_files[OPEN_MAX];
+    uint32_t ft_inuse[FT_NWORDS];
+    uint32_t ft_fullwords;
     struct lock *ft_lock;
 };
 
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *ret);
 int sys_read(int fd, userptr_t buf, size_t buflen, ssize_t *ret);
 int sys_write(int fd, const_userptr_t buf, size_t nbytes, ssize_t *ret);
+int sys_readv(int fd, const_userptr_t iov, int iovcnt, ssize_t *ret);
+int sys_writev(int fd, const_userptr_t iov, int iovcnt, ssize_t *ret);
+int sys_pread(int fd, userptr_t buf, size_t buflen, off_t pos, ssize_t *ret);
+int sys_pwrite(int fd, const_userptr_t buf, size_t nbytes, off_t pos, ssize_t *ret);
 int sys_lseek(int fd, off_t pos, int whence, off_t *ret);
 int sys_close(int fd, int *ret);
 int sys_dup2(int oldfd, int newfd, int *ret);
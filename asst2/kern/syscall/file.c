@@ -9,6 +9,8 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <rcu.h>
+#include <workqueue.h>
 #include <vfs.h>
 #include <vnode.h>
 #include <file.h>
@@ -16,16 +18,159 @@
 #include <copyinout.h>
 #include <proc.h>
 
-static int _update_offset_with_filesize(struct file *file)
+// index of the lowest clear bit in word, which must have one
+static unsigned _ffz(uint32_t word)
 {
-    struct stat *f_stat = kmalloc(sizeof(struct stat));
-    int err = VOP_STAT(file->f_vnode, f_stat);
-    if (!err)
+    KASSERT(word != 0xffffffff);
+
+    // binary search for the lowest set bit of the complement
+    unsigned bit = 0;
+    word = ~word;
+    if (!(word & 0xffff))
     {
-        file->f_offset = f_stat->st_size;
+        word >>= 16;
+        bit += 16;
     }
-    kfree(f_stat);
-    return err;
+    if (!(word & 0xff))
+    {
+        word >>= 8;
+        bit += 8;
+    }
+    if (!(word & 0xf))
+    {
+        word >>= 4;
+        bit += 4;
+    }
+    if (!(word & 0x3))
+    {
+        word >>= 2;
+        bit += 2;
+    }
+    if (!(word & 0x1))
+    {
+        bit += 1;
+    }
+    return bit;
+}
+
+// put file (or NULL) in slot fd and keep the bitmaps in step;
+// needs ft_lock held
+static void _set_fd(struct file_table *ft, int fd, struct file *file)
+{
+    unsigned ix = fd / FT_WORDBITS;
+    uint32_t mask = (uint32_t)1 << (fd % FT_WORDBITS);
+
+    if (file)
+    {
+        // lookups don't lock the table, so the file has to be all there first
+        rcu_assign(ft->opened_files[fd], file);
+        ft->ft_inuse[ix] |= mask;
+        if (ft->ft_inuse[ix] == 0xffffffff)
+        {
+            ft->ft_fullwords |= (uint32_t)1 << ix;
+        }
+    }
+    else
+    {
+        ft->opened_files[fd] = NULL;
+        ft->ft_inuse[ix] &= ~mask;
+        ft->ft_fullwords &= ~((uint32_t)1 << ix);
+    }
+}
+
+// lowest free fd, or -1 if the table is full; needs ft_lock held
+static int _lowest_free_fd(struct file_table *ft)
+{
+    const uint32_t all_words = FT_NWORDS == 32 ? 0xffffffff : ((uint32_t)1 << FT_NWORDS) - 1;
+    if ((ft->ft_fullwords & all_words) == all_words)
+    {
+        return -1;
+    }
+    unsigned ix = _ffz(ft->ft_fullwords);
+    return ix * FT_WORDBITS + _ffz(ft->ft_inuse[ix]);
+}
+
+// closed files waiting to be freed, and the work item that frees them
+static void _reclaim_files(void *arg);
+static struct spinlock _reclaim_lock = SPINLOCK_INITIALIZER;
+static struct file *_reclaim_list;
+static struct work _reclaim_work = WORK_INITIALIZER(_reclaim_files, NULL);
+
+// runs from the workqueue: free every file closed so far, all after one
+// grace period rather than one grace period each; files closed while
+// this runs requeue the item and go in the next batch
+static void _reclaim_files(void *arg)
+{
+    (void)arg;
+
+    spinlock_acquire(&_reclaim_lock);
+    struct file *file = _reclaim_list;
+    _reclaim_list = NULL;
+    spinlock_release(&_reclaim_lock);
+
+    if (!file)
+    {
+        return;
+    }
+
+    // wait out any lookup that loaded a pointer before it left the table
+    rcu_synchronize();
+    while (file)
+    {
+        struct file *next = file->f_reclaim_next;
+        kfree(file);
+        file = next;
+    }
+}
+
+// drop one reference to a file, closing it when the last one goes away
+static void _release_file(struct file *file)
+{
+    if (spinlock_data_fetchadd(&file->f_ref_count, (unsigned)-1) == 1)
+    {
+        vfs_close(file->f_vnode);
+        lock_destroy(file->f_lock);
+
+        spinlock_acquire(&_reclaim_lock);
+        file->f_reclaim_next = _reclaim_list;
+        _reclaim_list = file;
+        spinlock_release(&_reclaim_lock);
+        // does nothing if it's already queued
+        workqueue_enqueue(&_reclaim_work);
+    }
+}
+
+// look fd up and take a reference to its file, without locking the table;
+// drop it with _release_file
+static struct file *_get_file(int fd)
+{
+    if (fd < 0 || fd >= OPEN_MAX)
+    {
+        return NULL;
+    }
+
+    rcu_read_lock();
+    struct file *file = curproc->f_table->opened_files[fd];
+    if (file)
+    {
+        // only take a reference if the file isn't already on its way out
+        spinlock_data_t count = spinlock_data_get(&file->f_ref_count);
+        while (count > 0)
+        {
+            spinlock_data_t seen = spinlock_data_compareswap(&file->f_ref_count, count, count + 1);
+            if (seen == count)
+            {
+                break;
+            }
+            count = seen;
+        }
+        if (count == 0)
+        {
+            file = NULL;
+        }
+    }
+    rcu_read_unlock();
+    return file;
 }
 
 static int _sys_open(char *sys_filename, int flags, mode_t mode, int *ret)
@@ -48,23 +193,11 @@ static int _sys_open(char *sys_filename, int flags, mode_t mode, int *ret)
 
     file->f_flag = flags;
     file->f_vnode = vnode;
-    file->f_ref_count = 1;
-    if (flags & O_APPEND)
-    {
-        err = _update_offset_with_filesize(file);
-        if (err)
-        {
-            vfs_close(vnode);
-            kfree(file);
-            return err;
-        }
-    }
-    else
-    {
-        file->f_offset = 0;
-    }
+    spinlock_data_set(&file->f_ref_count, 1);
+    // with O_APPEND, writes find the end themselves (see _sys_readwrite)
+    file->f_offset = 0;
 
-    file->f_lock = lock_create("f_lock");
+    file->f_lock = lock_create_adaptive("f_lock");
     if (!file->f_lock)
     {
         vfs_close(vnode);
@@ -73,20 +206,17 @@ static int _sys_open(char *sys_filename, int flags, mode_t mode, int *ret)
     }
 
     lock_acquire(curproc->f_table->ft_lock);
-    for (unsigned i = 0; i < OPEN_MAX; ++i)
+    int fd = _lowest_free_fd(curproc->f_table);
+    if (fd >= 0)
     {
-        if (!curproc->f_table->opened_files[i])
-        {
-            curproc->f_table->opened_files[i] = file;
-            *ret = i;
-            break;
-        }
+        _set_fd(curproc->f_table, fd, file);
+        *ret = fd;
     }
     lock_release(curproc->f_table->ft_lock);
     if (*ret == -1)
     {
         vfs_close(vnode);
-        lock_release(file->f_lock);
+        lock_destroy(file->f_lock);
         kfree(file);
         return EMFILE;
     }
@@ -113,104 +243,198 @@ int sys_open(const_userptr_t filename, int flags, mode_t mode, int *ret)
     return _sys_open(sys_filename, flags, mode, ret);
 }
 
-int sys_read(int fd, userptr_t buf, size_t buflen, ssize_t *ret)
+// read or write all of iov[0..iovcnt) (len bytes in total) with one VOP call
+static int _sys_readwrite(int fd, struct iovec *iov, unsigned iovcnt, size_t len,
+                          enum uio_rw rw, ssize_t *ret)
 {
     *ret = -1;
 
     struct uio u_io;
-    struct iovec u_iovec;
-    struct file *file;
-
-    if (fd < 0 || fd >= OPEN_MAX)
-    {
-        return EBADF;
-    }
-
-    lock_acquire(curproc->f_table->ft_lock);
-    file = curproc->f_table->opened_files[fd];
-    lock_release(curproc->f_table->ft_lock);
+    struct file *file = _get_file(fd);
 
     if (file == NULL)
     {
         return EBADF;
     }
-    if ((file->f_flag & O_ACCMODE) == O_WRONLY)
+    if ((file->f_flag & O_ACCMODE) == (rw == UIO_READ ? O_WRONLY : O_RDONLY))
     {
+        _release_file(file);
         return EBADF;
     }
+
     lock_acquire(file->f_lock);
-    u_iovec.iov_ubase = (userptr_t)buf;
-    u_iovec.iov_len = buflen;
-    u_io.uio_iov = &u_iovec;
-    u_io.uio_iovcnt = 1;
+
+    u_io.uio_iov = iov;
+    u_io.uio_iovcnt = iovcnt;
     u_io.uio_offset = file->f_offset;
-    u_io.uio_resid = buflen;
+    u_io.uio_resid = len;
     u_io.uio_segflg = UIO_USERSPACE;
-    u_io.uio_rw = UIO_READ;
+    u_io.uio_rw = rw;
     u_io.uio_space = curproc->p_addrspace;
 
-    int err = VOP_READ(file->f_vnode, &u_io);
-    if (err)
+    // an append goes wherever the end of the file is once the vnode is
+    // locked, so concurrent appenders (even through separate opens)
+    // never overwrite each other; f_offset then ends up after the data
+    int err;
+    if (rw == UIO_READ)
     {
-        lock_release(file->f_lock);
-        return err;
+        err = VOP_READ(file->f_vnode, &u_io);
+    }
+    else if (file->f_flag & O_APPEND)
+    {
+        err = VOP_APPEND(file->f_vnode, &u_io);
+    }
+    else
+    {
+        err = VOP_WRITE(file->f_vnode, &u_io);
+    }
+    if (!err)
+    {
+        *ret = len - u_io.uio_resid;
+        file->f_offset = u_io.uio_offset;
     }
-    *ret = u_io.uio_offset - file->f_offset;
-    file->f_offset = u_io.uio_offset;
     lock_release(file->f_lock);
+    _release_file(file);
 
-    return 0;
+    return err;
+}
+
+int sys_read(int fd, userptr_t buf, size_t buflen, ssize_t *ret)
+{
+    struct iovec u_iovec;
+
+    u_iovec.iov_ubase = buf;
+    u_iovec.iov_len = buflen;
+    return _sys_readwrite(fd, &u_iovec, 1, buflen, UIO_READ, ret);
 }
 
 int sys_write(int fd, const_userptr_t buf, size_t nbytes, ssize_t *ret)
+{
+    struct iovec u_iovec;
+
+    u_iovec.iov_ubase = (userptr_t)buf;
+    u_iovec.iov_len = nbytes;
+    return _sys_readwrite(fd, &u_iovec, 1, nbytes, UIO_WRITE, ret);
+}
+
+// iovec arrays up to this long are kept on the stack instead of kmalloced
+#define FAST_IOVCNT 8
+
+static int _sys_readwritev(int fd, const_userptr_t iov, int iovcnt, enum uio_rw rw, ssize_t *ret)
 {
     *ret = -1;
 
-    struct uio u_io;
-    struct iovec u_iovec;
-    struct file *file;
+    if (iovcnt <= 0 || iovcnt > IOV_MAX)
+    {
+        return EINVAL;
+    }
 
-    if (fd < 0 || fd >= OPEN_MAX)
+    struct iovec fast_iov[FAST_IOVCNT];
+    struct iovec *sys_iov = fast_iov;
+    if (iovcnt > FAST_IOVCNT)
     {
-        return EBADF;
+        sys_iov = kmalloc(iovcnt * sizeof(struct iovec));
+        if (!sys_iov)
+        {
+            return ENOMEM;
+        }
     }
 
-    lock_acquire(curproc->f_table->ft_lock);
-    file = curproc->f_table->opened_files[fd];
-    lock_release(curproc->f_table->ft_lock);
+    // the user-level struct iovec has the same layout as the kernel one
+    int err = copyin(iov, sys_iov, iovcnt * sizeof(struct iovec));
+    size_t len = 0;
+    for (int i = 0; !err && i < iovcnt; ++i)
+    {
+        // the total can't wrap around and has to fit in the return value
+        if (len + sys_iov[i].iov_len < len || (ssize_t)(len + sys_iov[i].iov_len) < 0)
+        {
+            err = EINVAL;
+        }
+        len += sys_iov[i].iov_len;
+    }
+    if (!err)
+    {
+        err = _sys_readwrite(fd, sys_iov, iovcnt, len, rw, ret);
+    }
 
-    if (file == NULL)
+    if (sys_iov != fast_iov)
     {
-        return EBADF;
+        kfree(sys_iov);
     }
-    if ((file->f_flag & O_ACCMODE) == O_RDONLY)
+    return err;
+}
+
+int sys_readv(int fd, const_userptr_t iov, int iovcnt, ssize_t *ret)
+{
+    return _sys_readwritev(fd, iov, iovcnt, UIO_READ, ret);
+}
+
+int sys_writev(int fd, const_userptr_t iov, int iovcnt, ssize_t *ret)
+{
+    return _sys_readwritev(fd, iov, iovcnt, UIO_WRITE, ret);
+}
+
+// like _sys_readwrite, but at pos; f_offset isn't used or changed, so f_lock isn't needed
+static int _sys_preadwrite(int fd, userptr_t buf, size_t len, off_t pos, enum uio_rw rw, ssize_t *ret)
+{
+    *ret = -1;
+
+    struct uio u_io;
+    struct iovec u_iovec;
+    struct file *file = _get_file(fd);
+
+    if (file == NULL)
     {
         return EBADF;
     }
 
-    lock_acquire(file->f_lock);
+    int err = 0;
+    if ((file->f_flag & O_ACCMODE) == (rw == UIO_READ ? O_WRONLY : O_RDONLY))
+    {
+        err = EBADF;
+    }
+    else if (!VOP_ISSEEKABLE(file->f_vnode))
+    {
+        err = ESPIPE;
+    }
+    else if (pos < 0)
+    {
+        err = EINVAL;
+    }
+    if (err)
+    {
+        _release_file(file);
+        return err;
+    }
 
-    u_iovec.iov_ubase = (userptr_t)buf;
-    u_iovec.iov_len = nbytes;
+    u_iovec.iov_ubase = buf;
+    u_iovec.iov_len = len;
     u_io.uio_iov = &u_iovec;
     u_io.uio_iovcnt = 1;
-    u_io.uio_offset = file->f_offset;
-    u_io.uio_resid = nbytes;
+    u_io.uio_offset = pos;
+    u_io.uio_resid = len;
     u_io.uio_segflg = UIO_USERSPACE;
-    u_io.uio_rw = UIO_WRITE;
+    u_io.uio_rw = rw;
     u_io.uio_space = curproc->p_addrspace;
 
-    int err = VOP_WRITE(file->f_vnode, &u_io);
-    if (err)
+    err = rw == UIO_READ ? VOP_READ(file->f_vnode, &u_io) : VOP_WRITE(file->f_vnode, &u_io);
+    if (!err)
     {
-        lock_release(file->f_lock);
-        return err;
+        *ret = len - u_io.uio_resid;
     }
-    *ret = u_io.uio_offset - file->f_offset;
-    file->f_offset = u_io.uio_offset;
-    lock_release(file->f_lock);
+    _release_file(file);
 
-    return 0;
+    return err;
+}
+
+int sys_pread(int fd, userptr_t buf, size_t buflen, off_t pos, ssize_t *ret)
+{
+    return _sys_preadwrite(fd, buf, buflen, pos, UIO_READ, ret);
+}
+
+int sys_pwrite(int fd, const_userptr_t buf, size_t nbytes, off_t pos, ssize_t *ret)
+{
+    return _sys_preadwrite(fd, (userptr_t)buf, nbytes, pos, UIO_WRITE, ret);
 }
 
 int sys_lseek(int fd, off_t pos, int whence, off_t *ret)
@@ -228,9 +452,8 @@ int sys_lseek(int fd, off_t pos, int whence, off_t *ret)
     }
 
     int err = 0;
-    lock_acquire(curproc->f_table->ft_lock);
-    struct file *file = curproc->f_table->opened_files[fd];
-    lock_release(curproc->f_table->ft_lock);
+    struct stat f_stat;
+    struct file *file = _get_file(fd);
     if (file)
     {
         lock_acquire(file->f_lock);
@@ -263,16 +486,16 @@ int sys_lseek(int fd, off_t pos, int whence, off_t *ret)
                 }
                 break;
             case SEEK_END:
-                err = _update_offset_with_filesize(file);
+                err = VOP_STAT(file->f_vnode, &f_stat);
                 if (!err)
                 {
-                    if (file->f_offset + pos < 0)
+                    if (f_stat.st_size + pos < 0)
                     {
                         err = EINVAL;
                     }
                     else
                     {
-                        file->f_offset += pos;
+                        file->f_offset = f_stat.st_size + pos;
                         *ret = file->f_offset;
                     }
                 }
@@ -284,6 +507,7 @@ int sys_lseek(int fd, off_t pos, int whence, off_t *ret)
             err = ESPIPE;
         }
         lock_release(file->f_lock);
+        _release_file(file);
     }
     else // not opened
     {
@@ -302,34 +526,18 @@ int sys_close(int fd, int *ret)
         return EBADF;
     }
 
-    int err;
     lock_acquire(curproc->f_table->ft_lock);
     struct file *file = curproc->f_table->opened_files[fd];
-    if (file)
-    {
-        lock_acquire(file->f_lock);
-        if (file->f_ref_count == 1) // only itself
-        {
-            vfs_close(file->f_vnode); //don't know whether need to kfree this vnode. I reckon not
-            lock_release(file->f_lock);
-            lock_destroy(file->f_lock);
-            kfree(file);
-        }
-        else // some dup exits
-        {
-            file->f_ref_count--;
-            lock_release(file->f_lock);
-        }
-        curproc->f_table->opened_files[fd] = NULL;
-        *ret = 0;
-        err = 0;
-    }
-    else // not opened
+    _set_fd(curproc->f_table, fd, NULL);
+    lock_release(curproc->f_table->ft_lock);
+
+    if (!file) // not opened
     {
-        err = EBADF;
+        return EBADF;
     }
-    lock_release(curproc->f_table->ft_lock);
-    return err;
+    _release_file(file);
+    *ret = 0;
+    return 0;
 }
 
 int sys_dup2(int oldfd, int newfd, int *ret)
@@ -343,37 +551,31 @@ int sys_dup2(int oldfd, int newfd, int *ret)
     }
 
     int err = 0;
+    struct file *new_file = NULL;
     lock_acquire(curproc->f_table->ft_lock);
     struct file *file = curproc->f_table->opened_files[oldfd];
     if (file)
     {
-        if (oldfd == newfd)
+        if (oldfd != newfd)
         {
-            *ret = newfd;
-            err = 0;
-        }
-        else
-        {
-            struct file *new_file = curproc->f_table->opened_files[newfd];
-            if (new_file)
-            {
-                err = sys_close(newfd, ret);
-            }
-            if (!err)
-            {
-                lock_acquire(file->f_lock);
-                file->f_ref_count++;
-                lock_release(file->f_lock);
-                curproc->f_table->opened_files[newfd] = file;
-                *ret = newfd;
-            }
+            // whatever was at newfd gets closed once the table is unlocked
+            new_file = curproc->f_table->opened_files[newfd];
+            // the table's reference keeps the count above zero here
+            spinlock_data_fetchadd(&file->f_ref_count, 1);
+            _set_fd(curproc->f_table, newfd, file);
         }
+        *ret = newfd;
     }
     else // oldret not opened
     {
         err = EBADF;
     }
     lock_release(curproc->f_table->ft_lock);
+
+    if (new_file)
+    {
+        _release_file(new_file);
+    }
     return err;
 }
 
@@ -389,6 +591,8 @@ int init_process_file_table(struct proc *proc)
     {
         proc->f_table->opened_files[i] = NULL;
     }
+    bzero(proc->f_table->ft_inuse, sizeof(proc->f_table->ft_inuse));
+    proc->f_table->ft_fullwords = 0;
     proc->f_table->ft_lock = lock_create("ft_lock");
     if (!proc->f_table->ft_lock)
     {
@@ -39,6 +39,7 @@
 #include <elf.h>
 
 struct vnode;
+struct lock;
 
 struct region
 {
@@ -64,6 +65,7 @@ struct addrspace
 	paddr_t as_stackpbase;
 #else
 	struct region *as_regions;
+	struct lock *as_lock; // protects as_regions
 	int dirty_mask;
 #endif
 };
@@ -37,6 +37,7 @@
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <synch.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -56,6 +57,12 @@ as_create(void)
 	{
 		return NULL;
 	}
+	as->as_lock = lock_create("as_lock");
+	if (!as->as_lock)
+	{
+		kfree(as);
+		return NULL;
+	}
 	as->as_regions = NULL;
 	as->dirty_mask = 0;
 	return as;
@@ -70,6 +77,7 @@ int as_copy(struct addrspace *old, struct addrspace **ret)
 	}
 	new->dirty_mask = old->dirty_mask;
 
+	lock_acquire(old->as_lock);
 	struct region *old_region = old->as_regions;
 
 	while (old_region)
@@ -82,11 +90,13 @@ int as_copy(struct addrspace *old, struct addrspace **ret)
 								   old_region->permission & PERMISSION_EXECUTE);
 		if (err)
 		{
+			lock_release(old->as_lock);
 			as_destroy(new);
 			return err;
 		}
 		old_region = old_region->next_region;
 	}
+	lock_release(old->as_lock);
 	*ret = new;
 	int err = vm_copy(old, new);
 	if (err)
@@ -107,6 +117,7 @@ void as_destroy(struct addrspace *as)
 		kfree(tmp);
 	}
 
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -157,6 +168,7 @@ int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	new_region->permission = readable | writeable | executable;
 	new_region->next_region = NULL;
 
+	lock_acquire(as->as_lock);
 	if (as->as_regions)
 	{
 		struct region *iterator_region = as->as_regions;
@@ -170,6 +182,7 @@ int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	{
 		as->as_regions = new_region;
 	}
+	lock_release(as->as_lock);
 	return 0;
 }
 
@@ -187,9 +200,9 @@ int as_complete_load(struct addrspace *as)
 	return 0;
 }
 
-#define USER_STACKPAGES 16
+/* The main stack is thread stack slot 0 (see proc.h), so it's the same size. */
 int as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
 	*stackptr = USERSTACK;
-	return as_define_region(as, USERSTACK - PAGE_SIZE * USER_STACKPAGES, PAGE_SIZE * USER_STACKPAGES, PERMISSION_READ, PERMISSION_WRITE, 0);
+	return as_define_region(as, USERSTACK - PAGE_SIZE * THREAD_USTACKPAGES, PAGE_SIZE * THREAD_USTACKPAGES, PERMISSION_READ, PERMISSION_WRITE, 0);
 }
@@ -32,7 +32,7 @@ static void init_page_table()
 void vm_bootstrap(void)
 {
 	init_page_table();
-	page_table_lock = lock_create("page_table_lock");
+	page_table_lock = lock_create_adaptive("page_table_lock");
 }
 
 #define PAGE_BITS 12
@@ -64,21 +64,25 @@ static void update_tlb(vaddr_t faultvaddr, paddr_t frame_paddr, int dirty_mask)
 	splx(spl);
 }
 
+// Regions are only freed with the whole address space, so the one
+// found stays valid after the lock is dropped.
 static struct region *check_regions(struct addrspace *as, vaddr_t vaddr)
 {
+	lock_acquire(as->as_lock);
 	struct region *cur_region = as->as_regions;
 	while (cur_region)
 	{
 		if (vaddr >= cur_region->base_page_vaddr && vaddr < cur_region->base_page_vaddr + PAGE_SIZE * cur_region->page_nums)
 		{
-			return cur_region;
+			break;
 		}
 		else
 		{
 			cur_region = cur_region->next_region;
 		}
 	}
-	return NULL;
+	lock_release(as->as_lock);
+	return cur_region;
 }
 
 
@@ -30,6 +30,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/syscall.h>
+#include <kern/batch.h>
 #include <endian.h>
 #include <lib.h>
 #include <mips/trapframe.h>
@@ -38,6 +39,9 @@
 #include <copyinout.h>
 #include <syscall.h>
 
+static int syscall_dispatch(struct trapframe *tf, int callno,
+			    int32_t *retval);
+
 
 /*
  * System call dispatcher.
@@ -76,6 +80,9 @@
  * values) further arguments must be fetched from the user-level
  * stack, starting at sp+16 to skip over the slots for the
  * registerized values, with copyin().
+ *
+ * The switch on the call number is split out into syscall_dispatch
+ * so that syscall_batch can run calls through it too.
  */
 void
 syscall(struct trapframe *tf)
@@ -101,6 +108,49 @@ syscall(struct trapframe *tf)
 
 	retval = 0;
 
+	err = syscall_dispatch(tf, callno, &retval);
+
+	if (err) {
+		/*
+		 * Return the error code. This gets converted at
+		 * userlevel to a return value of -1 and the error
+		 * code in errno.
+		 */
+		tf->tf_v0 = err;
+		tf->tf_a3 = 1;      /* signal an error */
+	}
+	else {
+		/* Success. */
+		tf->tf_v0 = retval;
+		tf->tf_a3 = 0;      /* signal no error */
+	}
+
+	/*
+	 * Now, advance the program counter, to avoid restarting
+	 * the syscall over and over again.
+	 */
+
+	tf->tf_epc += 4;
+
+	/* Make sure the syscall code didn't forget to lower spl */
+	KASSERT(curthread->t_curspl == 0);
+	/* ...or leak any spinlocks */
+	KASSERT(curthread->t_iplhigh_count == 0);
+}
+
+/*
+ * Run system call CALLNO with its arguments in TF, and return the
+ * error code; put the return value in *RETVAL.
+ */
+static
+int
+syscall_dispatch(struct trapframe *tf, int callno, int32_t *retvalp)
+{
+	int32_t retval;
+	int err;
+
+	retval = *retvalp;
+
 	/* note the casts to userptr_t */
 
 	switch (callno) {
@@ -164,6 +214,15 @@ syscall(struct trapframe *tf)
 		err = sys_close(tf->tf_a0);
 		break;
 
+	    case SYS_pipe:
+		err = sys_pipe((userptr_t)tf->tf_a0);
+		break;
+
+	    case SYS_poll:
+		err = sys_poll((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+			       &retval);
+		break;
+
 	    case SYS_read:
 		err = sys_read(
 			tf->tf_a0,
@@ -178,6 +237,62 @@ syscall(struct trapframe *tf)
 			tf->tf_a2,
 			&retval);
 		break;
+	    case SYS_readv:
+		err = sys_readv(
+			tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+	    case SYS_writev:
+		err = sys_writev(
+			tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+	    case SYS_pread:
+	    case SYS_pwrite:
+		{
+			/*
+			 * The position is 64 bits wide and needs an
+			 * aligned register pair; a2 has the size, so
+			 * a3 is skipped and the position goes on the
+			 * stack, like lseek's whence.
+			 */
+			off_t pos;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &pos, sizeof(pos));
+			if (err) {
+				break;
+			}
+
+			err = (callno == SYS_pread) ?
+				sys_pread(tf->tf_a0, (userptr_t)tf->tf_a1,
+					  tf->tf_a2, pos, &retval) :
+				sys_pwrite(tf->tf_a0, (userptr_t)tf->tf_a1,
+					   tf->tf_a2, pos, &retval);
+		}
+		break;
+	    case SYS_copy_file_range:
+		{
+			/* The length is the fifth argument, on the stack. */
+			size_t len;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &len, sizeof(len));
+			if (err) {
+				break;
+			}
+
+			err = sys_copy_file_range(tf->tf_a0,
+						  (userptr_t)tf->tf_a1,
+						  tf->tf_a2,
+						  (userptr_t)tf->tf_a3,
+						  len, &retval);
+		}
+		break;
 	    case SYS_lseek:
 		{
 			/*
@@ -262,6 +377,49 @@ syscall(struct trapframe *tf)
 		break;
 
 
+	    /* scheduling calls */
+
+	    case SYS_sched_setaffinity:
+		err = sys_sched_setaffinity(tf->tf_a0, tf->tf_a1);
+		break;
+	    case SYS_sched_getaffinity:
+		err = sys_sched_getaffinity(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_schedstat:
+		err = sys_schedstat(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait((userptr_t)tf->tf_a0, tf->tf_a1);
+		break;
+	    case SYS_futex_wake:
+		err = sys_futex_wake((userptr_t)tf->tf_a0, tf->tf_a1,
+				     &retval);
+		break;
+
+	    case SYS___threadfork:
+		err = sys___threadfork(tf, (userptr_t)tf->tf_a0,
+				       (userptr_t)tf->tf_a1);
+		break;
+	    case SYS___threadexit:
+		sys___threadexit();
+		panic("Returning from threadexit\n");
+
+	    case SYS_aio_setup:
+		err = sys_aio_setup((userptr_t)tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_aio_enter:
+		err = sys_aio_enter(tf->tf_a0, tf->tf_a1, &retval);
+		break;
+
+	    case SYS_syscall_batch:
+		err = sys_syscall_batch(tf, (userptr_t)tf->tf_a0, tf->tf_a1,
+					&retval);
+		break;
+
+
 
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
@@ -269,33 +427,117 @@ syscall(struct trapframe *tf)
 		break;
 	}
 
+	*retvalp = retval;
+	return err;
+}
 
-	if (err) {
-		/*
-		 * Return the error code. This gets converted at
-		 * userlevel to a return value of -1 and the error
-		 * code in errno.
-		 */
-		tf->tf_v0 = err;
-		tf->tf_a3 = 1;      /* signal an error */
+/*
+ * Check if a call can go in a batch: it has to take all its
+ * arguments in registers, return at most 32 bits, and come back.
+ */
+static
+bool
+syscall_batchable(int callno)
+{
+	switch (callno) {
+	    case SYS_fork:
+	    case SYS_execv:
+	    case SYS__exit:
+	    case SYS___threadfork:
+	    case SYS___threadexit:
+	    case SYS_syscall_batch:
+	    case SYS_lseek:
+	    case SYS_pread:
+	    case SYS_pwrite:
+	    case SYS_copy_file_range:
+		return false;
 	}
-	else {
-		/* Success. */
-		tf->tf_v0 = retval;
-		tf->tf_a3 = 0;      /* signal no error */
+	return true;
+}
+
+/*
+ * syscall_batch: run the N calls in the array at UENTRIES one after
+ * another, and return how many were run.
+ *
+ * Each call goes through syscall_dispatch with a copy of our own
+ * trapframe with its number and arguments put in. The array is
+ * copied in once, and the entries that were run are copied back out
+ * once at the end, so a batch of N costs one trap and two copies
+ * instead of N traps.
+ */
+int
+sys_syscall_batch(struct trapframe *tf, userptr_t uentries, unsigned n,
+		  int32_t *retval)
+{
+	struct syscall_batch_entry *entries, *sbe;
+	struct syscall_batch_entry *from;
+	struct trapframe btf;
+	int32_t result;
+	unsigned i;
+	int err;
+
+	if (n == 0 || n > SYSCALL_BATCH_MAX) {
+		return EINVAL;
 	}
 
-	/*
-	 * Now, advance the program counter, to avoid restarting
-	 * the syscall over and over again.
-	 */
+	entries = kmalloc(n * sizeof(*entries));
+	if (entries == NULL) {
+		return ENOMEM;
+	}
+	err = copyin(uentries, entries, n * sizeof(*entries));
+	if (err) {
+		kfree(entries);
+		return err;
+	}
 
-	tf->tf_epc += 4;
+	for (i=0; i<n; i++) {
+		sbe = &entries[i];
+		from = NULL;
+		if (sbe->sbe_flags & SBE_ARG0RESULT) {
+			if (SBE_ARG0INDEX(sbe->sbe_flags) < i) {
+				from = &entries[SBE_ARG0INDEX(sbe->sbe_flags)];
+			}
+		}
 
-	/* Make sure the syscall code didn't forget to lower spl */
-	KASSERT(curthread->t_curspl == 0);
-	/* ...or leak any spinlocks */
-	KASSERT(curthread->t_iplhigh_count == 0);
+		if (!syscall_batchable(sbe->sbe_callno) ||
+		    ((sbe->sbe_flags & SBE_ARG0RESULT) && from == NULL)) {
+			sbe->sbe_result = -1;
+			sbe->sbe_errno = EINVAL;
+		}
+		else if (from != NULL && from->sbe_errno != 0) {
+			sbe->sbe_result = -1;
+			sbe->sbe_errno = from->sbe_errno;
+		}
+		else {
+			if (from != NULL) {
+				sbe->sbe_args[0] = from->sbe_result;
+			}
+			btf = *tf;
+			btf.tf_v0 = sbe->sbe_callno;
+			btf.tf_a0 = sbe->sbe_args[0];
+			btf.tf_a1 = sbe->sbe_args[1];
+			btf.tf_a2 = sbe->sbe_args[2];
+			btf.tf_a3 = sbe->sbe_args[3];
+
+			result = 0;
+			err = syscall_dispatch(&btf, sbe->sbe_callno, &result);
+			sbe->sbe_result = err ? -1 : result;
+			sbe->sbe_errno = err;
+		}
+
+		if (sbe->sbe_errno != 0 && (sbe->sbe_flags & SBE_STOPONERR)) {
+			i++;
+			break;
+		}
+	}
+
+	err = copyout(entries, uentries, i * sizeof(*entries));
+	kfree(entries);
+	if (err) {
+		return err;
+	}
+	*retval = i;
+	return 0;
 }
 
 /*
@@ -316,3 +558,24 @@ enter_forked_process(struct trapframe *tf)
 
 	mips_usermode(tf);
 }
+
+/*
+ * Enter user mode for a new thread made by threadfork.
+ *
+ * TF is a copy of the parent thread's trapframe, which gives us its
+ * $gp and status bits; start at ENTRY with ARG as the first argument
+ * and a fresh stack at STACKPTR. The entry point must not return.
+ */
+void
+enter_new_thread(struct trapframe *tf, vaddr_t entry, vaddr_t arg,
+		 vaddr_t stackptr)
+{
+	tf->tf_v0 = 0;
+	tf->tf_a3 = 0;
+	tf->tf_a0 = arg;
+	tf->tf_sp = stackptr;
+	tf->tf_ra = 0;
+	tf->tf_epc = entry;
+
+	mips_usermode(tf);
+}
@@ -174,6 +174,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 
 	V(cs->cs_rsem);
+	pollqueue_wake(&cs->cs_pollq);
 }
 
 /*
@@ -244,12 +245,12 @@ static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = dev->d_data;
+	size_t startresid = uio->uio_resid;
 	int result;
 	char ch;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -262,6 +263,18 @@ con_io(struct device *dev, struct uio *uio)
 
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
+			/*
+			 * Block for the first character only; after that,
+			 * return what has already been typed rather than
+			 * waiting for the rest of the line. This is what
+			 * makes POLLIN from con_poll mean a read won't
+			 * block. Holding the read lock means nobody else
+			 * can empty the buffer between the check and getch.
+			 */
+			if (uio->uio_resid < startresid &&
+			    cs->cs_gotchars_head == cs->cs_gotchars_tail) {
+				break;
+			}
 			ch = getch();
 			if (ch=='\r') {
 				ch = '\n';
@@ -302,10 +315,32 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Input is ready if there's a character in the buffer; con_io only
+ * blocks while it has nothing at all to return, so a read won't block
+ * either. con_input wakes pollers when one comes in. Output goes out
+ * a character at a time and is always allowed to start.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct poller *pl)
+{
+	struct con_softc *cs = dev->d_data;
+	int revents;
+
+	pollqueue_wait(&cs->cs_pollq, pl);
+	revents = POLLOUT;
+	if (cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		revents |= POLLIN;
+	}
+	return events & revents;
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -386,6 +421,7 @@ config_con(struct con_softc *cs, int unit)
 	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	pollqueue_init(&cs->cs_pollq);
 
 	the_console = cs;
 	con_userlock_read = rlk;
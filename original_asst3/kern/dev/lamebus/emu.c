@@ -52,6 +52,7 @@
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <poll.h>
 #include <emufs.h>
 #include "autoconf.h"
 
@@ -625,6 +626,34 @@ emufs_write(struct vnode *v, struct uio *uio)
 	return 0;
 }
 
+/*
+ * VOP_APPEND
+ *
+ * The emulator has no append operation, so this gets the size and
+ * then writes there as two separate requests. That is only atomic
+ * with respect to other writes through this kernel if nothing else
+ * writes the file in between; emufs is for getting files in and out
+ * of the host, not for sharing logs, so that's good enough.
+ */
+static
+int
+emufs_append(struct vnode *v, struct uio *uio)
+{
+	struct emufs_vnode *ev = v->vn_data;
+	off_t size;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_WRITE);
+
+	result = emu_getsize(ev->ev_emu, ev->ev_handle, &size);
+	if (result) {
+		return result;
+	}
+	uio->uio_offset = size;
+
+	return emufs_write(v, uio);
+}
+
 /*
  * VOP_IOCTL
  */
@@ -1088,10 +1117,12 @@ static const struct vnode_ops emufs_fileops = {
 	.vop_readlink = emufs_readlink_notlink,
 	.vop_getdirentry = emufs_uio_op_notdir,
 	.vop_write = emufs_write,
+	.vop_append = emufs_append,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
 	.vop_gettype = emufs_file_gettype,
 	.vop_isseekable = emufs_isseekable,
+	.vop_poll = poll_alwaysready,
 	.vop_fsync = emufs_fsync,
 	.vop_mmap = emufs_mmap,
 	.vop_truncate = emufs_truncate,
@@ -1122,10 +1153,12 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_readlink = emufs_uio_op_isdir,
 	.vop_getdirentry = emufs_getdirentry,
 	.vop_write = emufs_uio_op_isdir,
+	.vop_append = emufs_uio_op_isdir,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
 	.vop_gettype = emufs_dir_gettype,
 	.vop_isseekable = emufs_isseekable,
+	.vop_poll = poll_alwaysready,
 	.vop_fsync = emufs_void_op_isdir,
 	.vop_mmap = emufs_void_op_isdir,
 	.vop_truncate = emufs_truncate_isdir,
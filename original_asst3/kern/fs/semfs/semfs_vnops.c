@@ -136,7 +136,8 @@ semfs_getsem(struct semfs_vnode *semv)
  * Wakeup helper. We only need to wake up if there are sleepers, which
  * should only be the case if the old count is 0; and we only
  * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * will be more than 1. Likewise poll() only waits for the count to
+ * become nonzero.
  */
 static
 void
@@ -145,6 +146,7 @@ semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 	if (sem->sems_count > 0 || newcount == 0) {
 		return;
 	}
+	pollqueue_wake(&sem->sems_pollq);
 	if (newcount == 1) {
 		cv_signal(sem->sems_cv, sem->sems_lock);
 	}
@@ -153,6 +155,31 @@ semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 	}
 }
 
+/*
+ * poll() for semaphore vnodes. Reading (P) can go ahead when the
+ * count is above zero; writing (V) never blocks.
+ */
+static
+int
+semfs_poll(struct vnode *vn, int events, struct poller *pl)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	struct semfs_sem *sem;
+	int revents;
+
+	sem = semfs_getsem(semv);
+
+	lock_acquire(sem->sems_lock);
+	pollqueue_wait(&sem->sems_pollq, pl);
+	revents = POLLOUT;
+	if (sem->sems_count > 0) {
+		revents |= POLLIN;
+	}
+	lock_release(sem->sems_lock);
+
+	return events & revents;
+}
+
 /*
  * stat() for semaphore vnodes
  */
@@ -658,10 +685,12 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_readlink = vopfail_uio_isdir,
 	.vop_getdirentry = semfs_getdirentry,
 	.vop_write = vopfail_uio_isdir,
+	.vop_append = vopfail_uio_isdir,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_dirstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
+	.vop_poll = poll_alwaysready,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
@@ -691,10 +720,12 @@ static const struct vnode_ops semfs_semops = {
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
 	.vop_write = semfs_write,
+	.vop_append = semfs_write,	/* semaphores have no end */
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_semstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
+	.vop_poll = semfs_poll,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
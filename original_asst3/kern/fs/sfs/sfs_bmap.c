@@ -44,10 +44,15 @@
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
  * allocated.
+ *
+ * BUF is a block-sized buffer to read the indirect block into, or
+ * NULL to use a static one, which needs vfs_biglock. Lookups without
+ * the biglock (reads under sv_rwlock) must supply their own, and
+ * can't allocate.
  */
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+	 void *buf, daddr_t *diskblock)
 {
 	/*
 	 * I/O buffer for handling indirect blocks.
@@ -56,18 +61,26 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 * you would get space from the disk buffer cache for this,
 	 * not use a static area.
 	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	static uint32_t staticidbuf[SFS_DBPERIDB];
 
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t *idbuf;
 	daddr_t block;
 	daddr_t idblock;
 	uint32_t idnum, idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(sizeof(staticidbuf)==SFS_BLOCKSIZE);
 
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	if (buf == NULL) {
+		/* Since we're using a static buffer, we'd better be locked. */
+		KASSERT(vfs_biglock_do_i_hold());
+		idbuf = staticidbuf;
+	}
+	else {
+		KASSERT(!doalloc);
+		idbuf = buf;
+	}
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -155,13 +168,13 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		sv->sv_dirty = true;
 
 		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		bzero(idbuf, SFS_BLOCKSIZE);
 	}
 	else {
 		/*
 		 * We already have an indirect block allocated; load it.
 		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_readblock(sfs, idblock, idbuf, SFS_BLOCKSIZE);
 		if (result) {
 			return result;
 		}
@@ -181,7 +194,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		idbuf[idoff] = block;
 
 		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_writeblock(sfs, idblock, idbuf, SFS_BLOCKSIZE);
 		if (result) {
 			return result;
 		}
@@ -62,7 +62,8 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	/* Reads of file data may run under just the vnode's sv_rwlock. */
+	KASSERT(uio->uio_rw == UIO_READ || vfs_biglock_do_i_hold());
 
 	DEBUG(DB_SFS, "sfs: %s %llu\n",
 	      uio->uio_rw == UIO_READ ? "read" : "write",
@@ -143,12 +144,13 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
  *
  * SKIPSTART is the number of bytes to skip past at the beginning of
  * the sector; LEN is the number of bytes to actually read or write.
- * UIO is the area to do the I/O into.
+ * UIO is the area to do the I/O into. BUF is a block-sized buffer to
+ * use, or NULL for a static one (see sfs_io).
  */
 static
 int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
-	      uint32_t skipstart, uint32_t len)
+	      uint32_t skipstart, uint32_t len, char *buf)
 {
 	/*
 	 * I/O buffer for handling partial sectors.
@@ -157,9 +159,10 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 * you would get space from the disk buffer cache for this,
 	 * not use a static area.
 	 */
-	static char iobuf[SFS_BLOCKSIZE];
+	static char staticiobuf[SFS_BLOCKSIZE];
 
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	char *iobuf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,14 +172,20 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
+	if (buf == NULL) {
+		/* We're using a global static buffer; it had better be locked */
+		KASSERT(vfs_biglock_do_i_hold());
+		iobuf = staticiobuf;
+	}
+	else {
+		iobuf = buf;
+	}
 
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
-	/* Get the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	/* Get the disk block number (the buffer's free until we read) */
+	result = sfs_bmap(sv, fileblock, doalloc, buf, &diskblock);
 	if (result) {
 		return result;
 	}
@@ -187,13 +196,13 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		 * Zero the buffer.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		bzero(iobuf, SFS_BLOCKSIZE);
 	}
 	else {
 		/*
 		 * Read the block.
 		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
+		result = sfs_readblock(sfs, diskblock, iobuf, SFS_BLOCKSIZE);
 		if (result) {
 			return result;
 		}
@@ -211,7 +220,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 * If it was a write, write back the modified block.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
+		result = sfs_writeblock(sfs, diskblock, iobuf, SFS_BLOCKSIZE);
 		if (result) {
 			return result;
 		}
@@ -221,11 +230,12 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Do I/O (either read or write) of a single whole block. BUF is as
+ * for sfs_partialio.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_blockio(struct sfs_vnode *sv, struct uio *uio, char *buf)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	daddr_t diskblock;
@@ -241,7 +251,7 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
 	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, doalloc, buf, &diskblock);
 	if (result) {
 		return result;
 	}
@@ -287,6 +297,10 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ *
+ * Writes are done under vfs_biglock and use static buffers. Reads
+ * are done under just the vnode's sv_rwlock, so several can be going
+ * at once, and get a buffer of their own.
  */
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
@@ -295,9 +309,21 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	uint32_t nblocks, i;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	char *buf;
 
 	origresid = uio->uio_resid;
 
+	if (uio->uio_rw == UIO_READ) {
+		buf = kmalloc(SFS_BLOCKSIZE);
+		if (buf == NULL) {
+			return ENOMEM;
+		}
+	}
+	else {
+		KASSERT(vfs_biglock_do_i_hold());
+		buf = NULL;
+	}
+
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
 	 * remember how much extra there was in EXTRARESID so we can
@@ -309,6 +335,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 
 		if (uio->uio_offset >= size) {
 			/* At or past EOF - just return */
+			kfree(buf);
 			return 0;
 		}
 
@@ -336,7 +363,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		}
 
 		/* Call sfs_partialio() to do it. */
-		result = sfs_partialio(sv, uio, skip, len);
+		result = sfs_partialio(sv, uio, skip, len, buf);
 		if (result) {
 			goto out;
 		}
@@ -353,7 +380,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
 	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+		result = sfs_blockio(sv, uio, buf);
 		if (result) {
 			goto out;
 		}
@@ -365,7 +392,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	KASSERT(uio->uio_resid < SFS_BLOCKSIZE);
 
 	if (uio->uio_resid > 0) {
-		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
+		result = sfs_partialio(sv, uio, 0, uio->uio_resid, buf);
 		if (result) {
 			goto out;
 		}
@@ -384,6 +411,8 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
+	kfree(buf);
+
 	/* Done */
 	return result;
 }
@@ -432,7 +461,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 
 	/* Get the disk block number */
 	doalloc = (rw == UIO_WRITE);
-	result = sfs_bmap(sv, vnblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, vnblock, doalloc, NULL, &diskblock);
 	if (result) {
 		return result;
 	}
@@ -38,7 +38,9 @@
 #include <stat.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
+#include <poll.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -91,7 +93,9 @@ sfs_eachopendir(struct vnode *v, int openflags)
 }
 
 /*
- * Called for read(). sfs_io() does the work.
+ * Called for read(). sfs_io() does the work. Reads only need the
+ * file's size and block map to hold still, so they share sv_rwlock
+ * and leave vfs_biglock alone.
  */
 static
 int
@@ -102,9 +106,9 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
+	rw_rlock(sv->sv_rwlock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	rw_unlock(sv->sv_rwlock);
 
 	return result;
 }
@@ -121,9 +125,35 @@ sfs_write(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	rw_wlock(sv->sv_rwlock);
+	vfs_biglock_acquire();
+	result = sfs_io(sv, uio);
+	vfs_biglock_release();
+	rw_unlock(sv->sv_rwlock);
+
+	return result;
+}
+
+/*
+ * Called for write() on a file opened with O_APPEND. Picking up the
+ * size and writing there both happen under the write lock, so no
+ * other write can slip in between and be overwritten.
+ */
+static
+int
+sfs_append(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_WRITE);
+
+	rw_wlock(sv->sv_rwlock);
 	vfs_biglock_acquire();
+	uio->uio_offset = sv->sv_i.sfi_size;
 	result = sfs_io(sv, uio);
 	vfs_biglock_release();
+	rw_unlock(sv->sv_rwlock);
 
 	return result;
 }
@@ -250,8 +280,13 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	int result;
 
-	return sfs_itrunc(sv, len);
+	rw_wlock(sv->sv_rwlock);
+	result = sfs_itrunc(sv, len);
+	rw_unlock(sv->sv_rwlock);
+
+	return result;
 }
 
 /*
@@ -594,10 +629,12 @@ const struct vnode_ops sfs_fileops = {
 	.vop_readlink = vopfail_uio_notdir,
 	.vop_getdirentry = vopfail_uio_notdir,
 	.vop_write = sfs_write,
+	.vop_append = sfs_append,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
 	.vop_gettype = sfs_gettype,
 	.vop_isseekable = sfs_isseekable,
+	.vop_poll = poll_alwaysready,
 	.vop_fsync = sfs_fsync,
 	.vop_mmap = sfs_mmap,
 	.vop_truncate = sfs_truncate,
@@ -628,10 +665,12 @@ const struct vnode_ops sfs_dirops = {
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_nosys,
 	.vop_write = vopfail_uio_isdir,
+	.vop_append = vopfail_uio_isdir,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
 	.vop_gettype = sfs_gettype,
 	.vop_isseekable = sfs_isseekable,
+	.vop_poll = poll_alwaysready,
 	.vop_fsync = sfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
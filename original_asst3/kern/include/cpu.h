@@ -33,6 +33,7 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <kern/schedstat.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
@@ -59,8 +60,29 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Exited threads kept for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct workqueue *c_workqueue;	/* Deferred work (workqueue.c) */
+	unsigned c_rcudepth;		/* Open RCU read sections */
+
+	/*
+	 * Written by this cpu, read by other cpus without locking.
+	 * Used to find RCU grace periods; see rcu.h.
+	 */
+	bool c_rcuactive;		/* Running, so could be reading */
+	volatile unsigned c_rcuswitches; /* Passes through thread_switch */
+
+	/*
+	 * Accessed by other cpus without locking.
+	 *
+	 * c_wakeq is a stack of threads that other cpus have woken up
+	 * to run here, linked through t_wakenext. They push onto it
+	 * with LL/SC, and this cpu moves the threads to its run queue
+	 * in thread_switch. It holds a struct thread pointer, but is a
+	 * spinlock_data_t so it can be updated atomically.
+	 */
+	spinlock_data_t c_wakeq;
 
 	/*
 	 * Accessed by other cpus.
@@ -69,6 +91,7 @@ struct cpu {
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
+	struct schedstats c_schedstats;	/* Scheduler statistics */
 
 	/*
 	 * Accessed by other cpus.
@@ -92,6 +115,12 @@ struct cpu {
 	 * Accessed by other cpus. Protected inside hangman.c.
 	 */
 	HANGMAN_ACTOR(c_hangman);
+
+	/*
+	 * Spinlocks held, for the lock order validator. Only touched
+	 * by this cpu, with interrupts off.
+	 */
+	LOCKORDER_HELD(c_lockorder);
 };
 
 /*
@@ -35,6 +35,11 @@
 #define _FILETABLE_H_
 
 #include <limits.h> /* for OPEN_MAX */
+#include <spinlock.h>
+
+/* The in-use bitmap is kept in 32-bit words, one summary bit per word. */
+#define FT_WORDBITS	32
+#define FT_NWORDS	(OPEN_MAX / FT_WORDBITS)
 
 
 /*
@@ -48,15 +53,29 @@
  * or even to make it dynamic with the limit being user-settable. (See
  * setrlimit(2) on a Unix machine.)
  *
- * Because we only have single-threaded processes, the file table is
- * never shared and so it doesn't require synchronization. On fork,
- * the table is copied. Another exercise: what would you need to do to
- * make this code safe for multithreaded processes? What happens if
- * one thread calls close() while another one is in the middle of e.g.
- * read() using the same file handle?
+ * Alongside the array there is a bitmap of which slots are in use,
+ * and a summary word with a bit set for each bitmap word that is
+ * full. Finding the lowest free descriptor is then two first-zero
+ * searches on 32-bit words instead of a scan of the whole array,
+ * so opening a file costs the same however many are already open.
+ * This is also how copy and destroy skip over the empty slots.
+ *
+ * Threads made with threadfork share their process's file table, so
+ * the slots and the bitmap are protected by ft_lock. It is a
+ * spinlock because every operation on the table is a few loads and
+ * stores; nothing that can sleep (like closing a file) is done while
+ * holding it. On fork, the table is copied.
+ *
+ * One thread can close a file while another is in the middle of
+ * e.g. read() on it. So filetable_get hands back its own reference
+ * to the openfile, which filetable_put drops; the file stays open
+ * until the read is done even though the fd is already gone.
  */
 struct filetable {
+	struct spinlock ft_lock;	/* protects everything below */
 	struct openfile *ft_openfiles[OPEN_MAX];
+	uint32_t ft_inuse[FT_NWORDS];	/* bit set for each open fd */
+	uint32_t ft_fullwords;		/* bit set for each full ft_inuse word */
 };
 
 /*
@@ -69,6 +88,8 @@ struct filetable {
  * get/put - Retrieve a fd for use and put it back when done. (Checks
  *           okfd and also fails on files not open; returned openfile
  *           is not NULL.) Call put with the file returned from get.
+ *           Between the two the caller holds a reference to the file,
+ *           whatever happens to the fd meanwhile.
  * place -   Insert a file and return the fd.
  * placeat - Insert a file at a specific slot and return the file
  *           previously there.
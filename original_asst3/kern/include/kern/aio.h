@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KERN_AIO_H_
+#define _KERN_AIO_H_
+
+/*
+ * Asynchronous I/O rings, for the aio_setup() and aio_enter() system
+ * calls.
+ *
+ * A process sets up one ring area in its own memory: a struct
+ * aio_ring header, then ar_entries submission entries, then
+ * ar_entries completion entries. ar_entries must be a power of two
+ * no larger than AIO_MAXENTRIES.
+ *
+ * Both rings are indexed with free-running counters; counter value i
+ * is slot i & (ar_entries - 1). The process fills in submission
+ * entries and advances ar_sqtail; the kernel takes them and advances
+ * ar_sqhead. The kernel fills in completion entries and advances
+ * ar_cqtail; the process reads them and advances ar_cqhead. Each
+ * counter is only ever written by one side.
+ *
+ * Submissions are taken, and completions posted, only inside
+ * aio_enter(); the transfers themselves are done by kernel threads
+ * in the meantime. The kernel never has more than ar_entries
+ * operations outstanding, counting completions posted but not yet
+ * consumed, so the completion ring can't overflow.
+ *
+ * An operation reads or writes sqe_len bytes at sqe_offset in the
+ * file; the file's seek position is not used or changed. cqe_result
+ * is the number of bytes transferred, or minus the error code. Only
+ * files that can seek are allowed (others, like the console and
+ * pipes, could keep a kernel thread waiting indefinitely) and fail
+ * with ESPIPE. A transfer is at most AIO_MAXLEN bytes, one page,
+ * since the kernel holds the data in a buffer of its own meanwhile.
+ */
+
+#define AIO_READ	1
+#define AIO_WRITE	2
+
+#define AIO_MAXENTRIES	256		/* Largest ring */
+#define AIO_MAXLEN	4096		/* Largest single transfer */
+
+struct aio_sqe {
+	__u32 sqe_op;			/* AIO_READ or AIO_WRITE */
+	__i32 sqe_fd;			/* File handle */
+	__i64 sqe_offset;		/* Position in the file */
+	void *sqe_buf;			/* Buffer */
+	__u32 sqe_len;			/* Bytes to transfer */
+	__u64 sqe_data;			/* Handed back in the completion */
+};
+
+struct aio_cqe {
+	__u64 cqe_data;			/* sqe_data from the submission */
+	__i32 cqe_result;		/* Bytes transferred, or -errno */
+	__u32 cqe_pad;
+};
+
+struct aio_ring {
+	__u32 ar_entries;		/* Slots in each ring */
+	__u32 ar_sqhead;		/* Next submission to take (kernel) */
+	__u32 ar_sqtail;		/* Next submission slot to fill (user) */
+	__u32 ar_cqhead;		/* Next completion to read (user) */
+	__u32 ar_cqtail;		/* Next completion slot to fill (kernel) */
+	__u32 ar_pad;
+};
+
+/* Size of the whole ring area for N entries. */
+#define AIO_RING_SIZE(n) \
+	(sizeof(struct aio_ring) + \
+	 (n) * (sizeof(struct aio_sqe) + sizeof(struct aio_cqe)))
+
+#endif /* _KERN_AIO_H_ */
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KERN_BATCH_H_
+#define _KERN_BATCH_H_
+
+/*
+ * Entries for the syscall_batch() system call.
+ *
+ * Each entry is one system call, with its number and up to four
+ * arguments as they would go in registers a0-a3. The calls run in
+ * order, and each one's return value and error code (0 if it worked)
+ * are filled in. Calls that take arguments from the stack, return
+ * 64-bit values, or don't come back the ordinary way (fork, execv,
+ * _exit and the like) can't be batched and fail with EINVAL.
+ *
+ * With SBE_STOPONERR, the batch ends after this entry if it fails.
+ * With SBE_ARG0FROM(k), the first argument is replaced with the
+ * result of the earlier entry number k, so that for example an open
+ * can be followed by reads and a close of the file it opened. (If
+ * entry k failed, so does this one, with the same error.)
+ */
+
+#define SBE_STOPONERR		0x1
+#define SBE_ARG0RESULT		0x2
+#define SBE_ARG0FROM(k)		(SBE_ARG0RESULT | ((k) << 8))
+#define SBE_ARG0INDEX(flags)	(((flags) >> 8) & 0xff)
+
+/* Most entries in one batch. */
+#define SYSCALL_BATCH_MAX	64
+
+struct syscall_batch_entry {
+	__i32 sbe_callno;		/* System call number (SYS_*) */
+	__u32 sbe_flags;		/* SBE_* */
+	__u32 sbe_args[4];		/* Arguments, as for a0-a3 */
+	__i32 sbe_result;		/* Return value (out) */
+	__i32 sbe_errno;		/* Error code, or 0 (out) */
+};
+
+#endif /* _KERN_BATCH_H_ */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_SCHEDSTAT_H_
+#define _KERN_SCHEDSTAT_H_
+
+/*
+ * Scheduler statistics, for the schedstat() system call.
+ *
+ * Run-queue wait is the time from a thread being put on a run queue
+ * (made S_READY) until it actually runs. It is kept as a histogram
+ * with power-of-two buckets: ss_waithist[0] counts waits under one
+ * microsecond, and ss_waithist[i] for i > 0 counts waits of at least
+ * 2^(i-1) and under 2^i microseconds. The last bucket also counts
+ * anything longer. Timing waits costs something on every context
+ * switch, so the kernel doesn't do it until the first time the
+ * statistics are fetched; waits before that aren't counted.
+ *
+ * A voluntary switch is one where the outgoing thread went to sleep,
+ * exited, or called thread_yield itself; an involuntary switch is one
+ * where it was preempted by the timer interrupt.
+ *
+ * The run-queue length is sampled at each context switch, after the
+ * incoming thread has been taken off the queue, so the average length
+ * is ss_rqlensum / ss_switches.
+ *
+ * A remote wakeup is one made from another CPU, which goes through
+ * the target CPU's wakeup queue instead of its run queue lock; the
+ * IPI count is the number of unidle interprocessor interrupts taken,
+ * that is, the ones sent to wake an idle cpu for a remote wakeup;
+ * TLB shootdowns and the like aren't counted. Several remote wakeups
+ * in a burst share one IPI.
+ */
+
+#define SCHEDSTAT_BUCKETS 24
+
+struct schedstats {
+	__u64 ss_switches;		/* context switches */
+	__u64 ss_voluntary;		/* ...where the old thread gave up */
+	__u64 ss_involuntary;		/* ...where it was preempted */
+	__u64 ss_waits;			/* run-queue waits measured */
+	__u64 ss_waitns;		/* total wait time, in nanoseconds */
+	__u64 ss_maxwaitns;		/* longest wait, in nanoseconds */
+	__u64 ss_rqlensum;		/* sum of run-queue length samples */
+	__u64 ss_remotewakes;		/* wakeups queued by other cpus */
+	__u64 ss_ipis;			/* unidle interprocessor interrupts */
+	__u32 ss_rqlenmax;		/* longest run queue seen */
+	__u32 ss_waithist[SCHEDSTAT_BUCKETS];	/* wait time histogram */
+};
+
+/*
+ * Pass this as the cpu number to schedstat() to get the totals over
+ * all CPUs.
+ */
+#define SCHEDSTAT_ALLCPUS (-1)
+
+#endif /* _KERN_SCHEDSTAT_H_ */
@@ -109,12 +109,12 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
+#define SYS_readv        52
 //#define SYS_preadv     53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
+#define SYS_writev       57
 //#define SYS_pwritev    58
 #define SYS_lseek        59
 #define SYS_flock        60
@@ -197,6 +197,25 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Scheduling and threads --
+#define SYS_sched_setaffinity 121
+#define SYS_sched_getaffinity 122
+#define SYS_schedstat    123
+#define SYS_futex_wait   124
+#define SYS_futex_wake   125
+#define SYS___threadfork 126
+#define SYS___threadexit 127
+
+//                              -- File-to-file copying --
+#define SYS_copy_file_range 128
+
+//                              -- Asynchronous I/O --
+#define SYS_aio_setup    129
+#define SYS_aio_enter    130
+
+//                              -- Batching --
+#define SYS_syscall_batch 131
+
 /*CALLEND*/
 
 
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef LOCKORDER_H
+#define LOCKORDER_H
+
+/*
+ * Lock order validator. Enable with "options lockorder" in the kernel
+ * config; without it, everything here compiles to nothing.
+ *
+ * This is a cheaper cousin of hangman. Rather than looking for an
+ * actual deadlock each time a thread waits, it remembers the order
+ * in which lock classes have been taken and complains the first time
+ * some code takes two of them the other way around, whether or not
+ * that particular run would have deadlocked. Each inversion is
+ * reported once.
+ *
+ * A lock class is a name, as in lockprof, so all the "openfile" locks
+ * are one class. Spinlocks are keyed by the code address that called
+ * spinlock_init, or by their own address if statically initialized.
+ * Taking two locks of the same class is not checked, since there is
+ * no way to tell which order is meant.
+ *
+ * Sleep locks (locks and rwlocks) are tracked per thread; spinlocks
+ * are tracked per cpu, because the run queue lock is released by a
+ * different thread than the one that took it. A thread can't take a
+ * sleep lock while holding a spinlock, so the two sets never need to
+ * be compared.
+ */
+
+#include "opt-lockorder.h"
+
+#if OPT_LOCKORDER
+
+struct lockorder_class;	/* Opaque */
+
+/* Most locks one thread (or cpu) is expected to hold at once. */
+#define LOCKORDER_MAXHELD	16
+
+/* Per-lock validator hook. */
+struct lockorder {
+	struct lockorder_class *lo_class;
+};
+
+/* Per-thread (or per-cpu) list of classes held. */
+struct lockorder_held {
+	unsigned lh_num;		/* Entries in lh_classes */
+	unsigned lh_lost;		/* Held, but didn't fit */
+	struct lockorder_class *lh_classes[LOCKORDER_MAXHELD];
+};
+
+void lockorder_init(struct lockorder *lo, const char *name);
+void lockorder_init_anon(struct lockorder *lo, const void *key);
+void lockorder_heldinit(struct lockorder_held *lh);
+void lockorder_acquire(struct lockorder_held *lh, struct lockorder *lo);
+void lockorder_release(struct lockorder_held *lh, struct lockorder *lo);
+
+#define LOCKORDER(sym)		struct lockorder sym
+#define LOCKORDER_HELD(sym)	struct lockorder_held sym
+
+#define LOCKORDER_INITIALIZER	{ NULL }
+
+#define LOCKORDER_INIT(lo, name)	lockorder_init(lo, name)
+#define LOCKORDER_INITANON(lo, key)	lockorder_init_anon(lo, key)
+#define LOCKORDER_HELDINIT(lh)		lockorder_heldinit(lh)
+#define LOCKORDER_ACQUIRE(lh, lo)	lockorder_acquire(lh, lo)
+#define LOCKORDER_RELEASE(lh, lo)	lockorder_release(lh, lo)
+
+#else
+
+#define LOCKORDER(sym)
+#define LOCKORDER_HELD(sym)
+
+#define LOCKORDER_INIT(lo, name)
+#define LOCKORDER_INITANON(lo, key)
+#define LOCKORDER_HELDINIT(lh)
+#define LOCKORDER_ACQUIRE(lh, lo)
+#define LOCKORDER_RELEASE(lh, lo)
+
+#endif
+
+#endif /* LOCKORDER_H */
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+/*
+ * Lock contention profiler. Enable with "options lockprof" in the
+ * kernel config; without it, everything here compiles to nothing.
+ *
+ * Statistics are kept per name rather than per lock, so for example
+ * all the "openfile" locks are added up together. For each name we
+ * count acquisitions, acquisitions that had to wait, the total time
+ * spent waiting, and the longest time the lock was held. Spinlocks
+ * don't have names; they are keyed by the code address that called
+ * spinlock_init, or by their own address if statically initialized.
+ * (Look these up with gdb or addr2line.) Semaphores have no notion
+ * of a holder, so no hold time is recorded for them.
+ *
+ * Nothing is counted until lockprof_bootstrap is called, because the
+ * timing uses the realtime clock and that isn't attached until the
+ * bus has been probed.
+ */
+
+#include "opt-lockprof.h"
+
+#if OPT_LOCKPROF
+
+#include <kern/time.h>
+
+struct lockprof_stats;	/* Opaque */
+
+/* Per-lock profiler hook. */
+struct lockprof {
+	struct lockprof_stats *lp_stats;	/* Where to count */
+	struct timespec lp_holdstart;		/* When last acquired */
+};
+
+/* Per-acquire state, for timing the wait. */
+struct lockprof_waiter {
+	struct timespec lw_start;
+	bool lw_waiting;
+};
+
+void lockprof_bootstrap(void);
+
+void lockprof_init(struct lockprof *lp, const char *name);
+void lockprof_init_anon(struct lockprof *lp, const void *key);
+void lockprof_wait(struct lockprof_waiter *w);
+void lockprof_acquire(struct lockprof *lp, struct lockprof_waiter *w);
+void lockprof_release(struct lockprof *lp);
+
+/* Print the top N locks by contention, then zero all the counters. */
+void lockprof_dump(unsigned n);
+
+#define LOCKPROF(sym)		struct lockprof sym
+#define LOCKPROF_WAITER(sym)	struct lockprof_waiter sym = { {0, 0}, false }
+
+#define LOCKPROF_INITIALIZER	{ NULL, { 0, 0 } }
+
+#define LOCKPROF_INIT(lp, name)	lockprof_init(lp, name)
+#define LOCKPROF_INITANON(lp, key) lockprof_init_anon(lp, key)
+#define LOCKPROF_WAIT(w)	lockprof_wait(w)
+#define LOCKPROF_ACQUIRE(lp, w)	lockprof_acquire(lp, w)
+#define LOCKPROF_RELEASE(lp)	lockprof_release(lp)
+
+#else
+
+#define LOCKPROF(sym)
+#define LOCKPROF_WAITER(sym)
+
+#define LOCKPROF_INIT(lp, name)
+#define LOCKPROF_INITANON(lp, key)
+#define LOCKPROF_WAIT(w)
+#define LOCKPROF_ACQUIRE(lp, w)
+#define LOCKPROF_RELEASE(lp)
+
+#endif
+
+#endif /* LOCKPROF_H */
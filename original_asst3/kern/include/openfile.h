@@ -42,7 +42,8 @@
  *
  * This is pretty much just a wrapper around a vnode; the important
  * additional things we keep here are the open mode and the file's
- * seek position.
+ * seek position. Writes to a file opened with O_APPEND go through
+ * VOP_APPEND, which ignores the seek position.
  *
  * Open files are reference-counted because they get shared via fork
  * and dup2 calls. And they need locking because that sharing can be
@@ -51,6 +52,7 @@
 struct openfile {
 	struct vnode *of_vnode;
 	int of_accmode;	/* from open: O_RDONLY, O_WRONLY, or O_RDWR */
+	bool of_append;	/* from open: O_APPEND */
 
 	struct lock *of_offsetlock;	/* lock for of_offset */
 	off_t of_offset;
@@ -63,6 +65,9 @@ struct openfile {
 int openfile_open(char *filename, int openflags, mode_t mode,
 		  struct openfile **ret);
 
+/* make a pipe and open both ends */
+int openfile_pipe(struct openfile **readret, struct openfile **writeret);
+
 /* adjust the refcount on an openfile */
 void openfile_incref(struct openfile *);
 void openfile_decref(struct openfile *);
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Kernel side of poll(): readiness wakeups.
+ *
+ * Anything that can be polled and can become ready later (pipes,
+ * the console, semfs semaphores) has a pollqueue. Its poll function
+ * calls pollqueue_wait to register the poller on it, then checks and
+ * returns what's ready, all under whatever lock protects that state.
+ * Anything that makes it ready later calls pollqueue_wake under the
+ * same lock. Because registering comes before checking, a wakeup
+ * can't be missed between the check and the poller going to sleep.
+ *
+ * A poller sleeps on one wchan of its own no matter how many queues
+ * it is registered on; a wakeup on any of them sets a flag and wakes
+ * it. pollqueue_wake uses only spinlocks and may be called from an
+ * interrupt handler.
+ *
+ * Registrations only last for one pass over the descriptors; the
+ * poller drops them all before it sleeps again or returns.
+ */
+
+#include <kern/poll.h>
+#include <spinlock.h>
+
+struct poller;		/* Opaque; private to poll.c */
+struct pollreg;		/* Opaque; private to poll.c */
+struct vnode;
+
+struct pollqueue {
+	struct spinlock pq_lock;
+	struct pollreg *pq_head;	/* Registered pollers */
+};
+
+/*
+ * Functions:
+ *
+ * pollqueue_init    - Set up an empty queue.
+ * pollqueue_cleanup - Tear down a queue; nobody may be registered.
+ * pollqueue_wait    - Register POLLER on the queue, unless it's NULL
+ *                     (which means the caller won't sleep).
+ * pollqueue_wake    - Wake every poller registered on the queue.
+ *
+ * poll_alwaysready  - VOP_POLL for objects that never block, such as
+ *                     regular files: ready for reading and writing.
+ */
+void pollqueue_init(struct pollqueue *pq);
+void pollqueue_cleanup(struct pollqueue *pq);
+void pollqueue_wait(struct pollqueue *pq, struct poller *pl);
+void pollqueue_wake(struct pollqueue *pq);
+
+int poll_alwaysready(struct vnode *v, int events, struct poller *pl);
+
+
+#endif /* _POLL_H_ */
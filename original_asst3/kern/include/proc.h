@@ -41,6 +41,20 @@
 
 struct addrspace;
 struct vnode;
+struct aio_context;
+
+/*
+ * User stacks for threads made with threadfork. Slot 0 is the stack
+ * set up by as_define_stack; slot N is the THREAD_USTACKPAGES pages
+ * just below slot N-1. So slot 1 starts right below the main stack,
+ * and as_define_stack must make that THREAD_USTACKPAGES pages too.
+ *
+ * dumbvm has a fixed 18-page stack and room for only two regions
+ * besides it, so under DUMBVM there are no thread stacks and
+ * threadfork fails with ENOSYS.
+ */
+#define PROC_MAXTHREADS     32
+#define THREAD_USTACKPAGES  16
 
 /*
  * Process structure.
@@ -58,6 +72,11 @@ struct proc {
 	struct spinlock p_lock;		/* Lock for rest of this structure */
 	pid_t p_pid;			/* Process ID */
 
+	/* Threads; protected by p_threadslock */
+	int p_exitstatus;		/* Status for when the last one exits */
+	uint32_t p_ustacks;		/* User stack slots in use */
+	uint32_t p_ustacksdefined;	/* Slots with a VM region already */
+
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
 
@@ -65,6 +84,9 @@ struct proc {
 	struct vnode *p_cwd;		/* current working directory */
 	struct filetable *p_filetable;	/* table of open files */
 
+	/* Async I/O; set once, under p_lock */
+	struct aio_context *p_aio;	/* ring set up by aio_setup */
+
 	/* add more material here as needed */
 };
 
@@ -95,6 +117,21 @@ void proc_destroy(struct proc *proc);
  */
 void proc_exit(int status);
 
+/*
+ * Cause the current thread to leave its process. If it's the last
+ * one, the process exits with the status recorded by the most
+ * recent proc_exit call (success if none); otherwise the process
+ * carries on. Does not return.
+ */
+__DEAD void proc_threadexit(void);
+
+/*
+ * Allocate (and free) a user stack for a new thread in the current
+ * process. Returns the slot number and the initial stack pointer.
+ */
+int proc_ustack_alloc(unsigned *slot, vaddr_t *stackptr);
+void proc_ustack_free(unsigned slot);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Read-copy-update, for data that is read all the time and changed
+ * hardly ever.
+ *
+ * Readers bracket their accesses with rcu_read_lock/rcu_read_unlock
+ * and take no locks at all. Writers (who must be serialized among
+ * themselves by some ordinary lock) never change anything readers
+ * can see in place: they build a new version, publish it with
+ * rcu_assign, and then call rcu_synchronize before freeing the old
+ * version. rcu_synchronize returns once every reader that might still
+ * have been looking at the old version has finished.
+ *
+ * A read section keeps interrupts off on the current cpu, so it must
+ * be short and must not sleep. This is what makes it work: a cpu
+ * that has passed through thread_switch since the new version was
+ * published cannot still be in a read section that started before.
+ * (The implementation is in thread.c.)
+ */
+
+#include <membar.h>
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void rcu_synchronize(void);
+
+/*
+ * Publish a new version: make its contents visible before the
+ * pointer to it.
+ */
+#define rcu_assign(ptr, val) \
+	do { membar_store_store(); (ptr) = (val); } while (0)
+
+
+#endif /* _RCU_H_ */
@@ -48,14 +48,22 @@
  */
 #include <kern/sfs.h>
 
+struct rwlock;	/* from <synch.h> */
+
 /*
  * In-memory inode
+ *
+ * sv_rwlock lets file reads run in parallel. sfs_read holds it shared
+ * and does not take vfs_biglock; anything that changes the file's
+ * size or block map (write, truncate) holds it exclusive, and takes
+ * it before vfs_biglock.
  */
 struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct rwlock *sv_rwlock;       /* readers vs. size/map changes */
 };
 
 /*
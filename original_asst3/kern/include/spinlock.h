@@ -37,6 +37,8 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include <lockprof.h>
+#include <lockorder.h>
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -54,27 +56,57 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ *
+ * There are two flavors, chosen when the lock is initialized. An
+ * ordinary spinlock is a test-and-set lock: cheap, but when several
+ * CPUs want it, whichever one happens to get there first wins, and
+ * an unlucky CPU can starve. A ticket lock hands the lock out in the
+ * order it was asked for: each CPU takes a number from splk_next and
+ * waits for splk_lock (now serving) to reach it. Use a ticket lock
+ * for locks that are heavily contended across CPUs. Both flavors
+ * back off while waiting, so as not to hammer the lock word.
  */
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_next; /* Next ticket (ticket locks) */
+	bool splk_ticket;		    /* True for a ticket lock. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
+	LOCKPROF(splk_prof);                /* Contention profiler hook. */
+	LOCKORDER(splk_order);              /* Lock order validator hook. */
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
-				  HANGMAN_LOCKABLE_INITIALIZER }
+#if OPT_HANGMAN
+#define SPINLOCK_HANGMAN_INITIALIZER	, HANGMAN_LOCKABLE_INITIALIZER
+#else
+#define SPINLOCK_HANGMAN_INITIALIZER
+#endif
+#if OPT_LOCKPROF
+#define SPINLOCK_LOCKPROF_INITIALIZER	, LOCKPROF_INITIALIZER
+#else
+#define SPINLOCK_LOCKPROF_INITIALIZER
+#endif
+#if OPT_LOCKORDER
+#define SPINLOCK_LOCKORDER_INITIALIZER	, LOCKORDER_INITIALIZER
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_LOCKORDER_INITIALIZER
 #endif
+#define SPINLOCK_INITIALIZER_FLAVOR(ticket) \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, ticket, NULL \
+	  SPINLOCK_HANGMAN_INITIALIZER \
+	  SPINLOCK_LOCKPROF_INITIALIZER \
+	  SPINLOCK_LOCKORDER_INITIALIZER }
+#define SPINLOCK_INITIALIZER		SPINLOCK_INITIALIZER_FLAVOR(false)
+#define SPINLOCK_TICKET_INITIALIZER	SPINLOCK_INITIALIZER_FLAVOR(true)
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Same, but make it a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -84,6 +116,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -48,6 +48,7 @@ struct semaphore {
         struct wchan *sem_wchan;
         struct spinlock sem_lock;
         volatile unsigned sem_count;
+        LOCKPROF(sem_prof);             /* Contention profiler hook. */
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
@@ -71,6 +72,16 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * A lock made with lock_create_adaptive spins for a short while
+ * before sleeping if the thread holding it is running on another
+ * CPU. This is meant for locks that are only held across short
+ * critical sections, where the holder will probably let go before
+ * a context switch could be completed. Other locks always sleep.
+ *
+ * Locks do priority inheritance: a thread sleeping on a lock lends
+ * its priority to the holder (and onward, if the holder is itself
+ * asleep on another lock) until the holder releases it.
  */
 struct lock {
         char *lk_name;
@@ -78,9 +89,15 @@ struct lock {
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
         struct thread *volatile lk_holder;
+        bool lk_adaptive;               /* Spin before sleeping? */
+        struct thread *lk_waiters;      /* Sleepers, for inheritance. */
+        struct lock *lk_heldnext;       /* Next in holder's t_heldlocks. */
+        LOCKPROF(lk_prof);              /* Contention profiler hook. */
+        LOCKORDER(lk_order);            /* Lock order validator hook. */
 };
 
 struct lock *lock_create(const char *name);
+struct lock *lock_create_adaptive(const char *name);
 void lock_destroy(struct lock *);
 
 /*
@@ -131,7 +148,9 @@ void cv_destroy(struct cv *);
  *
  * For all three operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
- * on all operations with any particular CV.
+ * on all operations with any particular CV. cv_broadcast depends on it:
+ * rather than waking the sleepers all at once, it queues them on the
+ * lock, which wakes them one at a time as it is released.
  *
  * These operations must be atomic. You get to write them.
  */
@@ -140,4 +159,47 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * too, so a steady stream of readers cannot starve writers out. A
+ * consequence is that a thread that already holds a read lock must
+ * not try to get another one, as it can deadlock against a waiting
+ * writer.
+ *
+ * The deadlock detector only tracks the writer; lock cycles that go
+ * through a reader will not be reported. The lock order validator
+ * treats readers and writers alike.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+        char *rwlk_name;
+        HANGMAN_LOCKABLE(rwlk_hangman); /* Deadlock detector hook. */
+        struct wchan *rwlk_rwchan;      /* Readers sleep here */
+        struct wchan *rwlk_wwchan;      /* Writers sleep here */
+        struct spinlock rwlk_lock;
+        unsigned rwlk_readers;          /* Number of readers holding */
+        unsigned rwlk_wwaiting;         /* Number of writers waiting */
+        struct thread *rwlk_writer;     /* Writer holding, if any */
+        LOCKORDER(rwlk_order);          /* Lock order validator hook. */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rw_rlock  - Get the lock for reading.
+ *    rw_wlock  - Get the lock for writing.
+ *    rw_unlock - Release the lock, whichever way it is held.
+ */
+void rw_rlock(struct rwlock *);
+void rw_wlock(struct rwlock *);
+void rw_unlock(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -47,6 +47,10 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). You write this. */
 void enter_forked_process(struct trapframe *tf);
 
+/* Helper for threadfork(). */
+__DEAD void enter_new_thread(struct trapframe *tf, vaddr_t entry,
+			     vaddr_t arg, vaddr_t stackptr);
+
 /* Enter user mode. Does not return. */
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
@@ -54,6 +58,14 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 /* Setup function for exec. */
 void exec_bootstrap(void);
 
+/* Setup function for futexes. */
+void futex_bootstrap(void);
+
+/* Setup function for async I/O, and cleanup for a process's ring. */
+struct aio_context;
+void aio_bootstrap(void);
+void aio_destroy(struct aio_context *ac);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -74,8 +86,16 @@ int sys_getpid(pid_t *retval);
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
 int sys_close(int fd);
+int sys_pipe(userptr_t fdsp);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval);
 int sys_read(int fd, userptr_t buf, size_t size, int *retval);
 int sys_write(int fd, userptr_t buf, size_t size, int *retval);
+int sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t size, off_t pos, int *retval);
+int sys_copy_file_range(int infd, userptr_t inoffp, int outfd, userptr_t outoffp,
+			size_t len, int *retval);
 int sys_lseek(int fd, off_t offset, int code, off_t *retval);
 
 int sys_chdir(const_userptr_t path);
@@ -92,4 +112,16 @@ int sys_fstat(int fd, userptr_t statptr);
 int sys_fsync(int fd);
 int sys_ftruncate(int fd, off_t len);
 
+int sys_sched_setaffinity(pid_t pid, uint32_t mask);
+int sys_sched_getaffinity(pid_t pid, userptr_t mask);
+int sys_schedstat(int cpunum, userptr_t stats);
+int sys_futex_wait(userptr_t uaddr, int val);
+int sys_futex_wake(userptr_t uaddr, int count, int *retval);
+int sys___threadfork(struct trapframe *tf, userptr_t entry, userptr_t arg);
+__DEAD void sys___threadexit(void);
+int sys_aio_setup(userptr_t ring, unsigned entries);
+int sys_aio_enter(unsigned tosubmit, unsigned mincomplete, int *retval);
+int sys_syscall_batch(struct trapframe *tf, userptr_t entries, unsigned n,
+		      int32_t *retval);
+
 #endif /* _SYSCALL_H_ */
@@ -52,11 +52,22 @@ int threadlisttest(int, char **);
 /* thread tests */
 int threadtest(int, char **);
 int threadtest2(int, char **);
+int threadbench(int, char **);
+int affinitytest(int, char **);
 int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int rwlocktest(int, char **);
+int pitest(int, char **);
+int workqueuetest(int, char **);
+int workqueuebench(int, char **);
+int lockbench(int, char **);
+int rwlockbench(int, char **);
+int spinlockbench(int, char **);
+int cvbench(int, char **);
+int lockorderbench(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -39,8 +39,10 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <kern/time.h>
 
 struct cpu;
+struct schedstats;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -56,6 +58,22 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * Thread priorities. Higher numbers run first; threads of equal
+ * priority share the CPU round-robin. New threads get their parent's
+ * priority.
+ */
+#define PRI_MIN		0
+#define PRI_DEFAULT	10
+#define PRI_MAX		20
+
+/*
+ * CPU affinity masks have one bit per CPU number, so they cover
+ * MAXCPUS (32) CPUs. New threads get their parent's mask.
+ */
+#define AFFINITY_ALL	0xffffffffU
+#define AFFINITY_CPU(num)	((uint32_t)1 << (num))
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -79,11 +97,36 @@ struct thread {
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	struct thread *t_wakenext;	/* Link for cpu's remote wakeup queue */
+	bool t_wchan_excl;		/* Exclusive sleeper (see wchan.h) */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
+	LOCKORDER_HELD(t_lockorder);	/* Sleep locks held, for lockorder */
+
+	/*
+	 * Scheduling priority. t_basepri is what thread_setpriority
+	 * set; t_pri is what the scheduler uses, and may be higher
+	 * because of priority inheritance (see synch.c). The rest is
+	 * the inheritance bookkeeping, all protected by the lock
+	 * code's pi_lock.
+	 */
+	int t_basepri;			/* Priority as set */
+	volatile int t_pri;		/* Effective priority */
+	struct lock *t_blockedon;	/* Lock we're asleep on, if any */
+	struct lock *t_heldlocks;	/* Held locks that have waiters */
+	struct thread *t_lockwaitnext;	/* Next waiter on t_blockedon */
+
+	/* CPUs we may run on: bit N set for c_number N. */
+	uint32_t t_affinity;
+
+	/* User stack slot (see proc.h); 0 except for threadfork threads. */
+	unsigned t_ustack;
+
+	/* When we were last made runnable, for scheduler statistics. */
+	struct timespec t_readytime;
 
 	/*
 	 * Interrupt state fields.
@@ -158,6 +201,28 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Turn the cache of exited threads that thread_fork reuses on or
+ * off. It is on by default; this is for comparing with and without.
+ */
+void thread_cache_enable(bool on);
+
+/*
+ * Set the current thread's priority, PRI_MIN to PRI_MAX. (The
+ * effective priority may stay higher while we hold a lock someone
+ * more important is waiting for.) Implemented in synch.c, since it
+ * has to cooperate with priority inheritance.
+ */
+void thread_setpriority(int pri);
+
+/*
+ * Restrict the current thread to the CPUs in MASK, moving it off
+ * the current CPU if that's no longer among them. Bits for CPUs that
+ * don't exist are ignored. Returns EINVAL if MASK has no CPU left.
+ */
+int thread_setaffinity(uint32_t mask);
+uint32_t thread_getaffinity(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -169,5 +234,33 @@ void schedule(void);
  */
 void thread_consider_migration(void);
 
+/*
+ * Return the number of context switches done so far, summed over all
+ * CPUs. For statistics and benchmarks.
+ */
+unsigned thread_count_switches(void);
+
+/* Return the number of CPUs. */
+unsigned thread_count_cpus(void);
+
+/*
+ * Scheduler statistics (see <kern/schedstat.h>).
+ *
+ *    thread_schedstat_bootstrap - note that the clock is up, so
+ *                                 run-queue waits can be timed.
+ *    thread_schedstat_get       - copy out the stats for CPU number
+ *                                 CPUNUM, or the totals over all CPUs
+ *                                 if CPUNUM is SCHEDSTAT_ALLCPUS.
+ *                                 Returns EINVAL for a bad CPU number.
+ *                                 Also starts timing run-queue waits,
+ *                                 which is off until first asked for.
+ *    thread_schedstat_timewaits - start or stop timing run-queue waits.
+ *    thread_schedstat_reset     - zero the stats on all CPUs.
+ */
+void thread_schedstat_bootstrap(void);
+void thread_schedstat_timewaits(bool on);
+int thread_schedstat_get(int cpunum, struct schedstats *ret);
+void thread_schedstat_reset(void);
+
 
 #endif /* _THREAD_H_ */
@@ -33,6 +33,7 @@
 #include <spinlock.h>
 struct uio;
 struct stat;
+struct poller;
 
 
 /*
@@ -103,6 +104,14 @@ struct vnode {
  *                      amount written, and updating uio_offset to match.
  *                      Not allowed on directories or symlinks.
  *
+ *    vop_append      - Write data from uio at the end of the file,
+ *                      ignoring the offset passed in. Finding the end
+ *                      and writing there must be atomic with respect
+ *                      to other writes, so concurrent appends never
+ *                      overwrite each other. On return uio_offset is
+ *                      the end of the data written. Used for files
+ *                      opened with O_APPEND.
+ *
  *    vop_ioctl       - Perform ioctl operation OP on file using data
  *                      DATA. The interpretation of the data is specific
  *                      to each ioctl.
@@ -117,6 +126,14 @@ struct vnode {
  *                      and directories are seekable, but some devices are
  *                      not.
  *
+ *    vop_poll        - Return which of the POLL* events in EVENTS
+ *                      (see kern/poll.h) are ready now, plus POLLERR
+ *                      or POLLHUP if they apply. If POLLER is not
+ *                      NULL and the object could become ready later,
+ *                      first register it with pollqueue_wait on (at
+ *                      most) one pollqueue that will be woken when
+ *                      it does; see poll.h.
+ *
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
@@ -188,10 +205,13 @@ struct vnode_ops {
 	int (*vop_readlink)(struct vnode *link, struct uio *uio);
 	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio);
 	int (*vop_write)(struct vnode *file, struct uio *uio);
+	int (*vop_append)(struct vnode *file, struct uio *uio);
 	int (*vop_ioctl)(struct vnode *object, int op, userptr_t data);
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	bool (*vop_isseekable)(struct vnode *object);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct poller *poller);
 	int (*vop_fsync)(struct vnode *object);
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
@@ -232,10 +252,12 @@ struct vnode_ops {
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
 #define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_APPEND(vn, uio)             (__VOP(vn, append)(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
+#define VOP_POLL(vn, events, pl)        (__VOP(vn, poll)(vn, events, pl))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
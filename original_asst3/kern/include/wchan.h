@@ -36,6 +36,7 @@
 
 
 struct spinlock; /* in spinlock.h */
+struct thread; /* in thread.h */
 struct wchan; /* Opaque */
 
 /*
@@ -67,14 +68,40 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
 /*
- * Wake up one thread, or all threads, sleeping on a wait channel.
- * The associated spinlock should be locked.
+ * Wake up one thread, the first N threads, or all threads, sleeping
+ * on a wait channel. The associated spinlock should be locked.
+ * wchan_wakeN returns the number of threads woken.
+ *
+ * Some sleepers are exclusive: they are waiting for something only
+ * one of them can have at a time, so waking more than one is just a
+ * thundering herd. wchan_wakeall wakes only the first of those (and
+ * every other sleeper); the rest wait for another wakeup.
  *
  * The current implementation is FIFO but this is not promised by the
  * interface.
  */
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
+unsigned wchan_wakeN(struct wchan *wc, struct spinlock *lk, unsigned n);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Wake up thread T, which the caller knows is sleeping on the wait
+ * channel. The associated spinlock should be locked.
+ */
+void wchan_wakethread(struct wchan *wc, struct spinlock *lk,
+		      struct thread *t);
+
+/*
+ * Wake up the first NWAKE threads sleeping on FROM, and move the rest
+ * to sleep on TO instead, as exclusive sleepers. Both associated
+ * spinlocks must be locked, FROMLK first. A moved thread still
+ * relocks FROMLK when it wakes.
+ *
+ * This is for handing CV waiters straight to the lock they are going
+ * to want next instead of waking them all to fight over it.
+ */
+void wchan_requeue(struct wchan *from, struct spinlock *fromlk,
+		   struct wchan *to, struct spinlock *tolk, unsigned nwake);
+
 
 #endif /* _WCHAN_H_ */
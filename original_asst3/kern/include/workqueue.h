@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Workqueues: deferred work run by kernel worker threads.
+ *
+ * Each CPU has a queue and a worker thread that runs the items on it
+ * in order. Work items are embedded in the caller's own structures,
+ * so queueing never allocates memory and can be done from interrupt
+ * handlers. An item can be on at most one queue at a time; queueing
+ * one that is already pending does nothing. Once the function starts
+ * running the item is idle again, so it may be requeued (including
+ * by the function itself) or freed (likewise).
+ *
+ * Work functions run in a thread and may sleep, but while one runs
+ * nothing else on that CPU's queue does, so long waits hold up
+ * everyone else's work.
+ */
+
+struct workqueue;	/* Opaque */
+
+struct work {
+	void (*w_func)(void *arg);	/* Function to call */
+	void *w_arg;			/* Argument for it */
+
+	/* Internal state, protected by the owning queue's lock. */
+	struct work *w_next;		/* Next on queue */
+	struct workqueue *w_wq;		/* Queue last put on */
+	unsigned w_ticks;		/* Delay left, in hardclocks */
+	unsigned w_seq;			/* Order made pending, for flush */
+	unsigned w_state;		/* WORK_* */
+};
+
+#define WORK_IDLE	0	/* Not queued (may be running) */
+#define WORK_PENDING	1	/* Waiting for the worker */
+#define WORK_DELAYED	2	/* Waiting for its delay to expire */
+
+#define WORK_INITIALIZER(func, arg) \
+	{ func, arg, NULL, NULL, 0, 0, WORK_IDLE }
+
+/*
+ * Functions:
+ *
+ * work_init           - Set up a work item to call FUNC(ARG).
+ *
+ * workqueue_enqueue   - Queue a work item on the current CPU. Returns
+ *                       false (and does nothing) if it's already queued.
+ *
+ * workqueue_enqueue_delayed
+ *                     - Same, but don't run it until at least TICKS
+ *                       hardclocks (see HZ in clock.h) have passed.
+ *
+ * workqueue_cancel    - Dequeue a work item if it is queued, and in
+ *                       any case wait for it to finish if it is running.
+ *                       Afterwards the item may be freed, unless someone
+ *                       else requeues it. Returns true if it was queued.
+ *                       Must not be called from the item's own function.
+ *
+ * workqueue_flush     - Wait until all work queued on any CPU before the
+ *                       call has been run. Items that are still delayed
+ *                       are not waited for.
+ */
+void work_init(struct work *w, void (*func)(void *arg), void *arg);
+bool workqueue_enqueue(struct work *w);
+bool workqueue_enqueue_delayed(struct work *w, unsigned ticks);
+bool workqueue_cancel(struct work *w);
+void workqueue_flush(void);
+
+/*
+ * Internal hooks. workqueue_start is called once on each CPU as it
+ * comes up to create its queue and worker; workqueue_tick is called
+ * from hardclock to count down delayed items.
+ */
+void workqueue_start(void);
+void workqueue_tick(void);
+
+
+#endif /* _WORKQUEUE_H_ */
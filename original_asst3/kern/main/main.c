@@ -49,6 +49,7 @@
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockprof.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
 
@@ -121,6 +122,12 @@ boot(void)
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
 	KASSERT(curthread->t_curspl == 0);
+	/* Scheduler statistics need the clock too. */
+	thread_schedstat_bootstrap();
+#if OPT_LOCKPROF
+	/* The profiler needs the clock, so wait until now. */
+	lockprof_bootstrap();
+#endif
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
@@ -130,6 +137,8 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	exec_bootstrap();
+	futex_bootstrap();
+	aio_bootstrap();
 	thread_start_cpus();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
@@ -30,6 +30,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/reboot.h>
+#include <kern/schedstat.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
 #include <limits.h>
@@ -45,6 +46,7 @@
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockprof.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 
@@ -500,6 +502,106 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Upper bound, in microseconds, of the wait-histogram bucket that
+ * holds the PCT'th percentile of run-queue waits.
+ */
+static
+unsigned
+schedstat_percentile(const struct schedstats *ss, unsigned pct)
+{
+	uint64_t want, seen;
+	unsigned i;
+
+	want = (ss->ss_waits * pct + 99) / 100;
+	seen = 0;
+	for (i=0; i<SCHEDSTAT_BUCKETS - 1; i++) {
+		seen += ss->ss_waithist[i];
+		if (seen >= want) {
+			break;
+		}
+	}
+	return 1U << i;
+}
+
+static
+void
+schedstat_print(const char *name, const struct schedstats *ss)
+{
+	uint64_t rqavg10;
+
+	rqavg10 = ss->ss_switches == 0 ? 0 :
+		ss->ss_rqlensum * 10 / ss->ss_switches;
+	kprintf("%-5s %10llu %10llu %10llu %3llu.%llu %5u %10llu "
+		"%6u %6u %8llu %8llu %8llu\n",
+		name, ss->ss_switches, ss->ss_voluntary, ss->ss_involuntary,
+		rqavg10 / 10, rqavg10 % 10, ss->ss_rqlenmax, ss->ss_waits,
+		schedstat_percentile(ss, 50), schedstat_percentile(ss, 99),
+		ss->ss_maxwaitns / 1000, ss->ss_remotewakes, ss->ss_ipis);
+}
+
+/*
+ * Command for printing (or resetting) the scheduler statistics.
+ */
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	struct schedstats ss;
+	char name[8];
+	int i;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		thread_schedstat_reset();
+		return 0;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		/* Until the next time the stats are read. */
+		thread_schedstat_timewaits(false);
+		return 0;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: ss [reset|off]\n");
+		return 0;
+	}
+
+	kprintf("%-5s %10s %10s %10s %5s %5s %10s %6s %6s %8s %8s %8s\n",
+		"cpu", "switches", "voluntary", "preempted", "rqavg",
+		"rqmax", "waits", "p50us", "p99us", "maxus", "rwakeups",
+		"ipis");
+	for (i=0; thread_schedstat_get(i, &ss) == 0; i++) {
+		snprintf(name, sizeof(name), "%d", i);
+		schedstat_print(name, &ss);
+	}
+	thread_schedstat_get(SCHEDSTAT_ALLCPUS, &ss);
+	schedstat_print("all", &ss);
+	kprintf("(percentiles are histogram bucket upper bounds)\n");
+	return 0;
+}
+
+#if OPT_LOCKPROF
+/*
+ * Command for printing the most contended locks.
+ */
+static
+int
+cmd_lockprof(int nargs, char **args)
+{
+	unsigned n = 10;
+
+	if (nargs == 2) {
+		n = atoi(args[1]);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: lp [count]\n");
+		return 0;
+	}
+
+	lockprof_dump(n);
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -569,6 +671,8 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Thread fork/exit benchmark    ",
+	"[tt5] CPU affinity test             ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -576,6 +680,15 @@ static const char *testmenu[] = {
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
+	"[sy5] Rwlock test                   ",
+	"[sy6] Priority inheritance test     ",
+	"[lb]  Lock benchmark                ",
+	"[rwb] Rwlock benchmark              ",
+	"[slb] Spinlock benchmark            ",
+	"[cvb] CV wakeup benchmark           ",
+	"[lob] Lock order checking overhead  ",
+	"[wq1] Workqueue test                ",
+	"[wqb] Workqueue benchmark           ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[wt]  waitpid test                  ",
 	"[fs1] Filesystem test               ",
@@ -606,6 +719,10 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[ss] Scheduler stats [reset|off]    ",
+#if OPT_LOCKPROF
+	"[lp] Lock profile (top N, resets)   ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -657,6 +774,10 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "ss",         cmd_schedstats },
+#if OPT_LOCKPROF
+	{ "lp",         cmd_lockprof },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -673,12 +794,23 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadbench },
+	{ "tt5",	affinitytest },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	rwlocktest },
+	{ "sy6",	pitest },
+	{ "lb",		lockbench },
+	{ "rwb",	rwlockbench },
+	{ "slb",	spinlockbench },
+	{ "cvb",	cvbench },
+	{ "lob",	lockorderbench },
+	{ "wq1",	workqueuetest },
+	{ "wqb",	workqueuebench },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
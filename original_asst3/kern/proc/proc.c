@@ -44,6 +44,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <spl.h>
 #include <synch.h>
 #include <proc.h>
@@ -52,6 +53,7 @@
 #include <vnode.h>
 #include <pid.h>
 #include <filetable.h>
+#include <syscall.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -88,6 +90,11 @@ proc_create(const char *name)
 	spinlock_init(&proc->p_lock);
 	proc->p_pid = INVALID_PID;
 
+	/* Thread fields */
+	proc->p_exitstatus = _MKWAIT_EXIT(0);
+	proc->p_ustacks = 1;		/* the original stack */
+	proc->p_ustacksdefined = 1;
+
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
@@ -95,6 +102,9 @@ proc_create(const char *name)
 	proc->p_cwd = NULL;
 	proc->p_filetable = NULL;
 
+	/* Async I/O fields */
+	proc->p_aio = NULL;
+
 	return proc;
 }
 
@@ -124,6 +134,12 @@ proc_destroy(struct proc *proc)
 	 * incorrect to destroy it.)
 	 */
 
+	/* Async I/O fields; the I/O in progress holds open files */
+	if (proc->p_aio) {
+		aio_destroy(proc->p_aio);
+		proc->p_aio = NULL;
+	}
+
 	/* VFS fields */
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
@@ -291,6 +307,16 @@ proc_fork(struct proc **ret)
 	}
 #endif
 
+	/*
+	 * The copied address space has all our thread stacks in it,
+	 * and the thread calling fork may be running on any of them,
+	 * so keep them all reserved in the child.
+	 */
+	lock_acquire(curproc->p_threadslock);
+	newproc->p_ustacks = curproc->p_ustacks;
+	newproc->p_ustacksdefined = curproc->p_ustacksdefined;
+	lock_release(curproc->p_threadslock);
+
 	/* VM fields */
 	as = proc_getas();
 	if (as != NULL) {
@@ -346,6 +372,10 @@ proc_unfork(struct proc *newproc)
 
 /*
  * Make the current process exit.
+ *
+ * With more than one thread, this only takes the calling thread
+ * away; the process lives on until the last thread is gone, and
+ * then exits with the status from the last call here.
  */
 void
 proc_exit(int status)
@@ -355,23 +385,158 @@ proc_exit(int status)
 	/* The kernel isn't supposed to exit. */
 	KASSERT(proc != kproc);
 
-	/* Set exit status and wake up anyone waiting for us. */
-	pid_setexitstatus(status);
+	lock_acquire(proc->p_threadslock);
+	proc->p_exitstatus = status;
+	lock_release(proc->p_threadslock);
+
+	proc_threadexit();
+}
+
+/*
+ * Make the current thread leave its process.
+ *
+ * Deciding whether we're the last thread and getting out of
+ * p_threads happen together under p_threadslock, so that two threads
+ * exiting at once can't both think someone else will clean up. The
+ * last thread also posts the exit status in there, because
+ * pid_setexitstatus works on curproc.
+ */
+void
+proc_threadexit(void)
+{
+	struct proc *proc = curproc;
+	struct thread *cur = curthread;
+	unsigned num, i;
+	bool last;
+	int spl;
+
+	/* The kernel isn't supposed to exit. */
+	KASSERT(proc != kproc);
+	KASSERT(cur->t_proc == proc);
+
+	lock_acquire(proc->p_threadslock);
+	num = threadarray_num(&proc->p_threads);
+	last = (num == 1);
+	if (last) {
+		/* Set exit status and wake up anyone waiting for us. */
+		pid_setexitstatus(proc->p_exitstatus);
+	}
+	if (cur->t_ustack != 0) {
+		proc->p_ustacks &= ~((uint32_t)1 << cur->t_ustack);
+		cur->t_ustack = 0;
+	}
+	for (i=0; i<num; i++) {
+		if (threadarray_get(&proc->p_threads, i) == cur) {
+			threadarray_remove(&proc->p_threads, i);
+			break;
+		}
+	}
+	KASSERT(i < num);
+
+	/*
+	 * Drop t_proc before p_threadslock: once the lock is released
+	 * the last thread may destroy the process at any time.
+	 */
+	spl = splhigh();
+	cur->t_proc = NULL;
+	splx(spl);
+	lock_release(proc->p_threadslock);
 
-	/* Detach from the process and attach to the kernel process. */
-	KASSERT(curthread->t_proc == proc);
-	proc_remthread(curthread);
-	proc_addthread(kproc, curthread);
+	/* Attach to the kernel process. */
+	proc_addthread(kproc, cur);
 
-	/* There should be no threads left in the target process. */
-	KASSERT(threadarray_num(&proc->p_threads) == 0);
+	if (last) {
+		/* There should be no threads left in the target process. */
+		KASSERT(threadarray_num(&proc->p_threads) == 0);
 
-	/* Now we can destroy the process. */
-	proc_destroy(proc);
+		/* Now we can destroy the process. */
+		proc_destroy(proc);
+	}
 
 	thread_exit();
 }
 
+#if OPT_DUMBVM
+/*
+ * No thread stacks under dumbvm; see proc.h.
+ */
+int
+proc_ustack_alloc(unsigned *slot, vaddr_t *stackptr)
+{
+	(void)slot;
+	(void)stackptr;
+	return ENOSYS;
+}
+#else
+/*
+ * Allocate a user stack slot for a new thread in the current process,
+ * defining its VM region the first time the slot is used. Regions
+ * can't be taken out of an address space, so a freed slot keeps its
+ * region (and its memory) for the next thread to use. Other threads
+ * in the process may be faulting on the region list meanwhile; the
+ * VM system's as_define_region has to lock it against that.
+ */
+int
+proc_ustack_alloc(unsigned *slot, vaddr_t *stackptr)
+{
+	struct proc *proc = curproc;
+	struct addrspace *as;
+	vaddr_t top;
+	unsigned i;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+
+	lock_acquire(proc->p_threadslock);
+	for (i=1; i<PROC_MAXTHREADS; i++) {
+		if ((proc->p_ustacks & ((uint32_t)1 << i)) == 0) {
+			break;
+		}
+	}
+	if (i == PROC_MAXTHREADS) {
+		lock_release(proc->p_threadslock);
+		return ENOMEM;
+	}
+
+	top = USERSTACK - i * THREAD_USTACKPAGES * PAGE_SIZE;
+	if ((proc->p_ustacksdefined & ((uint32_t)1 << i)) == 0) {
+		result = as_define_region(as,
+					  top - THREAD_USTACKPAGES * PAGE_SIZE,
+					  THREAD_USTACKPAGES * PAGE_SIZE,
+					  1, 1, 0);
+		if (result) {
+			lock_release(proc->p_threadslock);
+			return result;
+		}
+		proc->p_ustacksdefined |= (uint32_t)1 << i;
+	}
+	proc->p_ustacks |= (uint32_t)1 << i;
+	lock_release(proc->p_threadslock);
+
+	*slot = i;
+	*stackptr = top;
+	return 0;
+}
+#endif /* OPT_DUMBVM */
+
+/*
+ * Give back a slot from proc_ustack_alloc that never got used.
+ */
+void
+proc_ustack_free(unsigned slot)
+{
+	struct proc *proc = curproc;
+
+	KASSERT(slot > 0 && slot < PROC_MAXTHREADS);
+
+	lock_acquire(proc->p_threadslock);
+	proc->p_ustacks &= ~((uint32_t)1 << slot);
+	lock_release(proc->p_threadslock);
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
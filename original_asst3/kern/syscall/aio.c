@@ -0,0 +1,537 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Asynchronous I/O rings. (See <kern/aio.h> for the user side.)
+ *
+ * aio_enter copies submissions in from the process's ring and turns
+ * each one into a request holding a reference to the open file and
+ * a kernel buffer (already filled, for a write). Requests go on one
+ * global queue served by a fixed pool of worker threads, which do
+ * the VOP_READ or VOP_WRITE on the kernel buffer and then move the
+ * request to its context's done list. Completions are posted into
+ * the ring, and read data copied out to the user buffer, only by
+ * aio_enter in the process itself, because the workers don't run
+ * in the process's address space.
+ *
+ * So a single-threaded process can have up to AIO_NWORKERS
+ * operations actually running at once (and up to the ring size
+ * queued), where with read and write it would have one.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/aio.h>
+#include <lib.h>
+#include <uio.h>
+#include <vm.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <thread.h>
+#include <copyinout.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <syscall.h>
+
+#define AIO_NWORKERS	4
+
+struct aio_request {
+	struct aio_context *rq_ctx;	/* Context it was submitted on */
+	struct openfile *rq_file;	/* File (NULL if it failed early) */
+	enum uio_rw rq_rw;		/* Read or write */
+	off_t rq_pos;			/* Position in file */
+	userptr_t rq_ubuf;		/* User's buffer */
+	size_t rq_len;			/* Length of transfer */
+	void *rq_kbuf;			/* Kernel copy of the data */
+	uint64_t rq_data;		/* For the completion */
+	int rq_result;			/* Bytes transferred, or -errno */
+	struct aio_request *rq_next;	/* Next on queue or done list */
+};
+
+struct aio_context {
+	userptr_t ac_ring;		/* Ring area in user memory */
+	unsigned ac_entries;		/* Slots in each ring */
+	struct lock *ac_lock;		/* Lock for the rest */
+	struct cv *ac_cv;		/* Signaled when a request is done */
+	unsigned ac_sqhead;		/* Our copy of ar_sqhead */
+	unsigned ac_cqtail;		/* Our copy of ar_cqtail */
+	unsigned ac_inflight;		/* Requests queued or running */
+	unsigned ac_ndone;		/* Requests on the done list */
+	struct aio_request *ac_done;	/* Done list, oldest first */
+	struct aio_request **ac_donetail;
+};
+
+/* The request queue the workers take from, oldest first. */
+static struct lock *aio_qlock;
+static struct cv *aio_qcv;
+static struct aio_request *aio_qhead;
+static struct aio_request **aio_qtail = &aio_qhead;
+
+////////////////////////////////////////////////////////////
+// requests
+
+static
+void
+aio_request_destroy(struct aio_request *rq)
+{
+	if (rq->rq_file != NULL) {
+		openfile_decref(rq->rq_file);
+	}
+	if (rq->rq_kbuf != NULL) {
+		kfree(rq->rq_kbuf);
+	}
+	kfree(rq);
+}
+
+/*
+ * Put a finished request on its context's done list.
+ */
+static
+void
+aio_done(struct aio_context *ac, struct aio_request *rq)
+{
+	KASSERT(lock_do_i_hold(ac->ac_lock));
+
+	rq->rq_next = NULL;
+	*ac->ac_donetail = rq;
+	ac->ac_donetail = &rq->rq_next;
+	ac->ac_ndone++;
+}
+
+/*
+ * Do the transfer for a request.
+ */
+static
+void
+aio_doio(struct aio_request *rq)
+{
+	struct iovec iov;
+	struct uio kuio;
+	struct vnode *vn;
+	int result;
+
+	vn = rq->rq_file->of_vnode;
+	uio_kinit(&iov, &kuio, rq->rq_kbuf, rq->rq_len, rq->rq_pos, rq->rq_rw);
+	result = (rq->rq_rw == UIO_READ) ?
+		VOP_READ(vn, &kuio) :
+		VOP_WRITE(vn, &kuio);
+	rq->rq_result = result ? -result : (int)(rq->rq_len - kuio.uio_resid);
+}
+
+/*
+ * Worker thread: take requests off the queue forever.
+ */
+static
+void
+aio_thread(void *unused1, unsigned long unused2)
+{
+	struct aio_request *rq;
+	struct aio_context *ac;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		lock_acquire(aio_qlock);
+		while (aio_qhead == NULL) {
+			cv_wait(aio_qcv, aio_qlock);
+		}
+		rq = aio_qhead;
+		aio_qhead = rq->rq_next;
+		if (aio_qhead == NULL) {
+			aio_qtail = &aio_qhead;
+		}
+		lock_release(aio_qlock);
+
+		aio_doio(rq);
+
+		/* Once ac_inflight drops, the context may be destroyed. */
+		ac = rq->rq_ctx;
+		lock_acquire(ac->ac_lock);
+		aio_done(ac, rq);
+		ac->ac_inflight--;
+		cv_broadcast(ac->ac_cv, ac->ac_lock);
+		lock_release(ac->ac_lock);
+	}
+}
+
+/*
+ * Set up the queue and start the workers.
+ */
+void
+aio_bootstrap(void)
+{
+	unsigned i;
+	int result;
+
+	/* Request buffers are kmalloc'd; keep them to one page each. */
+	COMPILE_ASSERT(AIO_MAXLEN <= PAGE_SIZE);
+
+	aio_qlock = lock_create("aio queue");
+	aio_qcv = cv_create("aio queue");
+	if (aio_qlock == NULL || aio_qcv == NULL) {
+		panic("aio_bootstrap: Out of memory\n");
+	}
+
+	for (i=0; i<AIO_NWORKERS; i++) {
+		result = thread_fork("aio", NULL, aio_thread, NULL, i);
+		if (result) {
+			panic("aio_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// contexts
+
+/*
+ * Wait for a context's requests to finish and throw it away, along
+ * with any completions that were never posted.
+ */
+void
+aio_destroy(struct aio_context *ac)
+{
+	struct aio_request *rq;
+
+	lock_acquire(ac->ac_lock);
+	while (ac->ac_inflight > 0) {
+		cv_wait(ac->ac_cv, ac->ac_lock);
+	}
+	lock_release(ac->ac_lock);
+
+	while (ac->ac_done != NULL) {
+		rq = ac->ac_done;
+		ac->ac_done = rq->rq_next;
+		aio_request_destroy(rq);
+	}
+
+	cv_destroy(ac->ac_cv);
+	lock_destroy(ac->ac_lock);
+	kfree(ac);
+}
+
+/* User addresses of the parts of the ring. */
+#define AIO_HDRFIELD(ac, field) \
+	((userptr_t)&((struct aio_ring *)(ac)->ac_ring)->field)
+#define AIO_SQEADDR(ac, i) \
+	((ac)->ac_ring + sizeof(struct aio_ring) + \
+	 ((i) & ((ac)->ac_entries - 1)) * sizeof(struct aio_sqe))
+#define AIO_CQEADDR(ac, i) \
+	((ac)->ac_ring + sizeof(struct aio_ring) + \
+	 (ac)->ac_entries * sizeof(struct aio_sqe) + \
+	 ((i) & ((ac)->ac_entries - 1)) * sizeof(struct aio_cqe))
+
+/*
+ * aio_setup: make RING the current process's ring.
+ */
+int
+sys_aio_setup(userptr_t ring, unsigned entries)
+{
+	struct aio_context *ac;
+	struct aio_ring hdr;
+	bool busy;
+	int result;
+
+	if (entries == 0 || entries > AIO_MAXENTRIES ||
+	    (entries & (entries - 1)) != 0) {
+		return EINVAL;
+	}
+	if ((vaddr_t)ring % sizeof(uint64_t) != 0) {
+		return EINVAL;
+	}
+	if (curproc->p_aio != NULL) {
+		return EBUSY;
+	}
+
+	/* Initialize the header, which also checks the address. */
+	bzero(&hdr, sizeof(hdr));
+	hdr.ar_entries = entries;
+	result = copyout(&hdr, ring, sizeof(hdr));
+	if (result) {
+		return result;
+	}
+
+	ac = kmalloc(sizeof(*ac));
+	if (ac == NULL) {
+		return ENOMEM;
+	}
+	ac->ac_ring = ring;
+	ac->ac_entries = entries;
+	ac->ac_lock = lock_create("aio");
+	if (ac->ac_lock == NULL) {
+		kfree(ac);
+		return ENOMEM;
+	}
+	ac->ac_cv = cv_create("aio");
+	if (ac->ac_cv == NULL) {
+		lock_destroy(ac->ac_lock);
+		kfree(ac);
+		return ENOMEM;
+	}
+	ac->ac_sqhead = 0;
+	ac->ac_cqtail = 0;
+	ac->ac_inflight = 0;
+	ac->ac_ndone = 0;
+	ac->ac_done = NULL;
+	ac->ac_donetail = &ac->ac_done;
+
+	/* Another thread may have gotten in first. */
+	spinlock_acquire(&curproc->p_lock);
+	busy = (curproc->p_aio != NULL);
+	if (!busy) {
+		curproc->p_aio = ac;
+	}
+	spinlock_release(&curproc->p_lock);
+	if (busy) {
+		aio_destroy(ac);
+		return EBUSY;
+	}
+	return 0;
+}
+
+/*
+ * Turn one submission entry into a request and start it. A bad
+ * entry doesn't fail the system call; it gets a completion with the
+ * error instead, like a transfer that fails.
+ */
+static
+int
+aio_submit(struct aio_context *ac, const struct aio_sqe *sqe)
+{
+	struct aio_request *rq;
+	struct openfile *file;
+	int result;
+
+	rq = kmalloc(sizeof(*rq));
+	if (rq == NULL) {
+		return ENOMEM;
+	}
+	rq->rq_ctx = ac;
+	rq->rq_file = NULL;
+	rq->rq_rw = (sqe->sqe_op == AIO_READ) ? UIO_READ : UIO_WRITE;
+	rq->rq_pos = sqe->sqe_offset;
+	rq->rq_ubuf = (userptr_t)sqe->sqe_buf;
+	rq->rq_len = sqe->sqe_len;
+	rq->rq_kbuf = NULL;
+	rq->rq_data = sqe->sqe_data;
+	rq->rq_result = 0;
+	rq->rq_next = NULL;
+
+	if ((sqe->sqe_op != AIO_READ && sqe->sqe_op != AIO_WRITE) ||
+	    sqe->sqe_len > AIO_MAXLEN || sqe->sqe_offset < 0) {
+		result = EINVAL;
+		goto fail;
+	}
+
+	result = filetable_get(curproc->p_filetable, sqe->sqe_fd, &file);
+	if (result) {
+		goto fail;
+	}
+	if (file->of_accmode == (rq->rq_rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+		filetable_put(curproc->p_filetable, sqe->sqe_fd, file);
+		result = EBADF;
+		goto fail;
+	}
+	/*
+	 * Reading the console or a pipe can wait forever, tying up a
+	 * worker that every process shares (and aio_destroy with it).
+	 */
+	if (!VOP_ISSEEKABLE(file->of_vnode)) {
+		filetable_put(curproc->p_filetable, sqe->sqe_fd, file);
+		result = ESPIPE;
+		goto fail;
+	}
+	/* The request keeps the file open even if the fd is closed. */
+	openfile_incref(file);
+	filetable_put(curproc->p_filetable, sqe->sqe_fd, file);
+	rq->rq_file = file;
+
+	rq->rq_kbuf = kmalloc(rq->rq_len > 0 ? rq->rq_len : 1);
+	if (rq->rq_kbuf == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+	if (rq->rq_rw == UIO_WRITE) {
+		result = copyin(rq->rq_ubuf, rq->rq_kbuf, rq->rq_len);
+		if (result) {
+			goto fail;
+		}
+	}
+
+	ac->ac_inflight++;
+
+	lock_acquire(aio_qlock);
+	*aio_qtail = rq;
+	aio_qtail = &rq->rq_next;
+	cv_signal(aio_qcv, aio_qlock);
+	lock_release(aio_qlock);
+	return 0;
+
+ fail:
+	rq->rq_result = -result;
+	aio_done(ac, rq);
+	return 0;
+}
+
+/*
+ * Move requests from the done list into the completion ring while
+ * there's room, given the user's completion head CQHEAD. A request
+ * only comes off the done list once its completion is in the ring,
+ * so if copying that out fails it's posted next time instead of
+ * being lost.
+ */
+static
+int
+aio_post(struct aio_context *ac, unsigned cqhead)
+{
+	struct aio_request *rq;
+	struct aio_cqe cqe;
+	int result;
+
+	while (ac->ac_done != NULL && ac->ac_cqtail - cqhead < ac->ac_entries) {
+		rq = ac->ac_done;
+
+		if (rq->rq_rw == UIO_READ && rq->rq_result > 0) {
+			result = copyout(rq->rq_kbuf, rq->rq_ubuf,
+					 rq->rq_result);
+			if (result) {
+				rq->rq_result = -result;
+			}
+		}
+
+		cqe.cqe_data = rq->rq_data;
+		cqe.cqe_result = rq->rq_result;
+		cqe.cqe_pad = 0;
+
+		result = copyout(&cqe, AIO_CQEADDR(ac, ac->ac_cqtail),
+				 sizeof(cqe));
+		if (result) {
+			return result;
+		}
+		ac->ac_cqtail++;
+
+		ac->ac_done = rq->rq_next;
+		if (ac->ac_done == NULL) {
+			ac->ac_donetail = &ac->ac_done;
+		}
+		ac->ac_ndone--;
+		aio_request_destroy(rq);
+	}
+	return 0;
+}
+
+/*
+ * aio_enter: submit, post, and wait.
+ */
+int
+sys_aio_enter(unsigned tosubmit, unsigned mincomplete, int *retval)
+{
+	struct aio_context *ac;
+	struct aio_sqe sqe;
+	unsigned sqtail, cqhead, submitted;
+	int result, result2;
+
+	ac = curproc->p_aio;
+	if (ac == NULL) {
+		return EINVAL;
+	}
+	if (mincomplete > ac->ac_entries) {
+		mincomplete = ac->ac_entries;
+	}
+
+	lock_acquire(ac->ac_lock);
+
+	result = copyin(AIO_HDRFIELD(ac, ar_sqtail), &sqtail, sizeof(sqtail));
+	if (result) {
+		goto out;
+	}
+	result = copyin(AIO_HDRFIELD(ac, ar_cqhead), &cqhead, sizeof(cqhead));
+	if (result) {
+		goto out;
+	}
+	if (sqtail - ac->ac_sqhead > ac->ac_entries ||
+	    ac->ac_cqtail - cqhead > ac->ac_entries) {
+		/* The process has scribbled on its counters. */
+		result = EINVAL;
+		goto out;
+	}
+
+	/*
+	 * Submit. Stop when everything in flight, done, or posted but
+	 * unread would fill the completion ring.
+	 */
+	submitted = 0;
+	while (submitted < tosubmit && ac->ac_sqhead != sqtail &&
+	       ac->ac_inflight + ac->ac_ndone + (ac->ac_cqtail - cqhead)
+	       < ac->ac_entries) {
+		result = copyin(AIO_SQEADDR(ac, ac->ac_sqhead), &sqe,
+				sizeof(sqe));
+		if (result) {
+			break;
+		}
+		result = aio_submit(ac, &sqe);
+		if (result) {
+			break;
+		}
+		ac->ac_sqhead++;
+		submitted++;
+	}
+	/* Having submitted something is success. */
+	if (submitted > 0) {
+		result = 0;
+	}
+
+	/* Post what's done, then wait for more if asked to. */
+	if (result == 0) {
+		result = aio_post(ac, cqhead);
+	}
+	while (result == 0 && ac->ac_cqtail - cqhead < mincomplete &&
+	       ac->ac_inflight > 0) {
+		cv_wait(ac->ac_cv, ac->ac_lock);
+		result = aio_post(ac, cqhead);
+	}
+
+	*retval = submitted;
+
+ out:
+	/* Always tell the process how far we got. */
+	result2 = copyout(&ac->ac_sqhead, AIO_HDRFIELD(ac, ar_sqhead),
+			  sizeof(ac->ac_sqhead));
+	if (result2 == 0) {
+		result2 = copyout(&ac->ac_cqtail, AIO_HDRFIELD(ac, ar_cqtail),
+				  sizeof(ac->ac_cqtail));
+	}
+	lock_release(ac->ac_lock);
+	return result ? result : result2;
+}
@@ -37,6 +37,7 @@
 #include <kern/limits.h>
 #include <kern/seek.h>
 #include <kern/stat.h>
+#include <limits.h>
 #include <lib.h>
 #include <uio.h>
 #include <proc.h>
@@ -105,19 +106,19 @@ sys_open(const_userptr_t upath, int flags, mode_t mode, int *retval)
 }
 
 /*
- * Common logic for read and write.
+ * Common logic for read, write, readv, and writev.
  *
- * Look up the fd, then use VOP_READ or VOP_WRITE.
+ * Look up the fd, then use VOP_READ or VOP_WRITE on all the buffers
+ * in IOV at once. SIZE is their total length.
  */
 static
 int
-sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
-	      int badaccmode, ssize_t *retval)
+sys_readwrite(int fd, struct iovec *iov, unsigned iovcnt, size_t size,
+	      enum uio_rw rw, int badaccmode, ssize_t *retval)
 {
 	struct openfile *file;
 	bool locked;
 	off_t pos;
-	struct iovec iov;
 	struct uio useruio;
 	int result;
 
@@ -142,13 +143,29 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 		goto fail;
 	}
 
-	/* set up a uio with the buffer, its size, and the current offset */
-	uio_uinit(&iov, &useruio, buf, size, pos, rw);
+	/* set up a uio with the buffers, their size, and the current offset */
+	useruio.uio_iov = iov;
+	useruio.uio_iovcnt = iovcnt;
+	useruio.uio_offset = pos;
+	useruio.uio_resid = size;
+	useruio.uio_segflg = UIO_USERSPACE;
+	useruio.uio_rw = rw;
+	useruio.uio_space = proc_getas();
 
-	/* do the read or write */
-	result = (rw == UIO_READ) ?
-		VOP_READ(file->of_vnode, &useruio) :
-		VOP_WRITE(file->of_vnode, &useruio);
+	/*
+	 * Do the read or write. Appends go to the end of the file
+	 * wherever that is by the time the vnode is locked, and leave
+	 * the seek position after the data written.
+	 */
+	if (rw == UIO_READ) {
+		result = VOP_READ(file->of_vnode, &useruio);
+	}
+	else if (file->of_append) {
+		result = VOP_APPEND(file->of_vnode, &useruio);
+	}
+	else {
+		result = VOP_WRITE(file->of_vnode, &useruio);
+	}
 	if (result) {
 		goto fail;
 	}
@@ -183,7 +200,11 @@ fail:
 int
 sys_read(int fd, userptr_t buf, size_t size, int *retval)
 {
-	return sys_readwrite(fd, buf, size, UIO_READ, O_WRONLY, retval);
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_readwrite(fd, &iov, 1, size, UIO_READ, O_WRONLY, retval);
 }
 
 /*
@@ -192,7 +213,387 @@ sys_read(int fd, userptr_t buf, size_t size, int *retval)
 int
 sys_write(int fd, userptr_t buf, size_t size, int *retval)
 {
-	return sys_readwrite(fd, buf, size, UIO_WRITE, O_RDONLY, retval);
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return sys_readwrite(fd, &iov, 1, size, UIO_WRITE, O_RDONLY, retval);
+}
+
+/*
+ * Common logic for readv and writev: copy in the iovec array, check
+ * it, and hand the lot to sys_readwrite so it goes to the file in one
+ * VOP call under one hold of the offset lock.
+ *
+ * Most callers only pass a few buffers, so for up to UIO_FASTIOV of
+ * them we use an array on the stack instead of calling kmalloc.
+ */
+#define UIO_FASTIOV	8
+
+static
+int
+sys_readwritev(int fd, const_userptr_t uiov, int iovcnt, enum uio_rw rw,
+	       int badaccmode, ssize_t *retval)
+{
+	struct iovec fastiov[UIO_FASTIOV];
+	struct iovec *iov;
+	size_t size;
+	int i, result;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+
+	if (iovcnt <= UIO_FASTIOV) {
+		iov = fastiov;
+	}
+	else {
+		iov = kmalloc(iovcnt * sizeof(*iov));
+		if (iov == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	/* The user-level struct iovec has the same layout as ours. */
+	result = copyin(uiov, iov, iovcnt * sizeof(*iov));
+	if (result) {
+		goto out;
+	}
+
+	/* The total must not wrap, and must fit in the return value. */
+	size = 0;
+	for (i=0; i<iovcnt; i++) {
+		if (size + iov[i].iov_len < size ||
+		    (ssize_t)(size + iov[i].iov_len) < 0) {
+			result = EINVAL;
+			goto out;
+		}
+		size += iov[i].iov_len;
+	}
+
+	result = sys_readwrite(fd, iov, iovcnt, size, rw, badaccmode, retval);
+ out:
+	if (iov != fastiov) {
+		kfree(iov);
+	}
+	return result;
+}
+
+/*
+ * readv() - use sys_readwritev
+ */
+int
+sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_READ, O_WRONLY, retval);
+}
+
+/*
+ * writev() - use sys_readwritev
+ */
+int
+sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_WRITE, O_RDONLY, retval);
+}
+
+/*
+ * Common logic for pread and pwrite.
+ *
+ * Like sys_readwrite, but at the position given instead of the seek
+ * position, which is neither used nor changed. So this never takes
+ * the offset lock, and threads or processes sharing an open file can
+ * do I/O at different places in it at the same time.
+ */
+static
+int
+sys_preadwrite(int fd, userptr_t buf, size_t size, off_t pos,
+	       enum uio_rw rw, int badaccmode, ssize_t *retval)
+{
+	struct openfile *file;
+	struct iovec iov;
+	struct uio useruio;
+	int result;
+
+	result = filetable_get(curproc->p_filetable, fd, &file);
+	if (result) {
+		return result;
+	}
+
+	if (file->of_accmode == badaccmode) {
+		result = EBADF;
+		goto out;
+	}
+	/* There's no position to speak of on a device or a pipe. */
+	if (!VOP_ISSEEKABLE(file->of_vnode)) {
+		result = ESPIPE;
+		goto out;
+	}
+	if (pos < 0) {
+		result = EINVAL;
+		goto out;
+	}
+
+	uio_uinit(&iov, &useruio, buf, size, pos, rw);
+	result = (rw == UIO_READ) ?
+		VOP_READ(file->of_vnode, &useruio) :
+		VOP_WRITE(file->of_vnode, &useruio);
+	if (result == 0) {
+		*retval = size - useruio.uio_resid;
+	}
+
+ out:
+	filetable_put(curproc->p_filetable, fd, file);
+	return result;
+}
+
+/*
+ * pread() - use sys_preadwrite
+ */
+int
+sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	return sys_preadwrite(fd, buf, size, pos, UIO_READ, O_WRONLY, retval);
+}
+
+/*
+ * pwrite() - use sys_preadwrite
+ */
+int
+sys_pwrite(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	return sys_preadwrite(fd, buf, size, pos, UIO_WRITE, O_RDONLY,
+			      retval);
+}
+
+/*
+ * copy_file_range() - copy data from one open file to another without
+ * passing it through userspace.
+ *
+ * For each end, if the offset pointer is NULL the file's seek position
+ * is used and advanced, as read or write would; otherwise the off_t
+ * it points to is used and updated instead, and the seek position is
+ * left alone, as with pread or pwrite.
+ *
+ * The data goes through a kernel buffer a chunk at a time. We stop at
+ * end of file or on a short read (so a console or pipe at the input
+ * end behaves like read). If something fails after some data has
+ * been copied, that amount is returned, as for a short write.
+ *
+ * An output file opened with O_APPEND is refused with EBADF, as in
+ * Linux, since the copy writes at offsets of its own choosing.
+ */
+#define COPYBUF_SIZE	4096
+
+static
+void
+copy_lockpair(struct lock *a, struct lock *b, bool acquire)
+{
+	struct lock *tmp;
+
+	/* Always take the two in address order so we can't deadlock. */
+	if ((uintptr_t)a > (uintptr_t)b) {
+		tmp = a;
+		a = b;
+		b = tmp;
+	}
+	if (acquire) {
+		if (a != NULL) {
+			lock_acquire(a);
+		}
+		if (b != NULL) {
+			lock_acquire(b);
+		}
+	}
+	else {
+		if (b != NULL) {
+			lock_release(b);
+		}
+		if (a != NULL) {
+			lock_release(a);
+		}
+	}
+}
+
+/*
+ * Get the starting position for one end of copy_file_range: either
+ * from the user's pointer or, if that's NULL, from the file, in which
+ * case return the offset lock that needs to be held for it.
+ */
+static
+int
+copy_getpos(struct openfile *file, const_userptr_t offp,
+	    off_t *pos, struct lock **lock_ret)
+{
+	int result;
+
+	*lock_ret = NULL;
+	if (offp != NULL) {
+		if (!VOP_ISSEEKABLE(file->of_vnode)) {
+			return ESPIPE;
+		}
+		result = copyin(offp, pos, sizeof(*pos));
+		if (result) {
+			return result;
+		}
+		if (*pos < 0) {
+			return EINVAL;
+		}
+	}
+	else if (VOP_ISSEEKABLE(file->of_vnode)) {
+		/* read once the lock is held */
+		*lock_ret = file->of_offsetlock;
+	}
+	else {
+		*pos = 0;
+	}
+	return 0;
+}
+
+int
+sys_copy_file_range(int infd, userptr_t inoffp, int outfd, userptr_t outoffp,
+		    size_t len, int *retval)
+{
+	struct filetable *ft;
+	struct openfile *infile, *outfile;
+	struct lock *inlock, *outlock;
+	off_t inpos, outpos;
+	struct iovec iov;
+	struct uio kuio;
+	size_t done, chunk, got, put;
+	char *buf;
+	bool locked;
+	int result;
+
+	ft = curproc->p_filetable;
+
+	result = filetable_get(ft, infd, &infile);
+	if (result) {
+		return result;
+	}
+	result = filetable_get(ft, outfd, &outfile);
+	if (result) {
+		filetable_put(ft, infd, infile);
+		return result;
+	}
+
+	buf = NULL;
+	locked = false;
+
+	if (infile->of_accmode == O_WRONLY ||
+	    outfile->of_accmode == O_RDONLY || outfile->of_append) {
+		result = EBADF;
+		goto out;
+	}
+
+	result = copy_getpos(infile, inoffp, &inpos, &inlock);
+	if (result) {
+		goto out;
+	}
+	result = copy_getpos(outfile, outoffp, &outpos, &outlock);
+	if (result) {
+		goto out;
+	}
+	if (inlock != NULL && inlock == outlock) {
+		/* one seek position can't be both the source and the target */
+		result = EINVAL;
+		goto out;
+	}
+
+	/* The amount copied has to fit in the return value. */
+	if ((ssize_t)len < 0) {
+		len = (size_t)-1 >> 1;
+	}
+
+	buf = kmalloc(COPYBUF_SIZE);
+	if (buf == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	copy_lockpair(inlock, outlock, true);
+	locked = true;
+	if (inlock != NULL) {
+		inpos = infile->of_offset;
+	}
+	if (outlock != NULL) {
+		outpos = outfile->of_offset;
+	}
+
+	/* Copying a file over an overlapping part of itself is not allowed. */
+	if (infile->of_vnode == outfile->of_vnode && len > 0 &&
+	    inpos < outpos + (off_t)len && outpos < inpos + (off_t)len) {
+		result = EINVAL;
+		goto out;
+	}
+
+	done = 0;
+	while (done < len) {
+		chunk = len - done;
+		if (chunk > COPYBUF_SIZE) {
+			chunk = COPYBUF_SIZE;
+		}
+
+		uio_kinit(&iov, &kuio, buf, chunk, inpos, UIO_READ);
+		result = VOP_READ(infile->of_vnode, &kuio);
+		if (result) {
+			break;
+		}
+		got = chunk - kuio.uio_resid;
+		if (got == 0) {
+			/* end of file */
+			break;
+		}
+
+		uio_kinit(&iov, &kuio, buf, got, outpos, UIO_WRITE);
+		result = VOP_WRITE(outfile->of_vnode, &kuio);
+		if (result) {
+			break;
+		}
+		put = got - kuio.uio_resid;
+
+		/* Only count as read what actually got written. */
+		inpos += put;
+		outpos += put;
+		done += put;
+		if (put < got || got < chunk) {
+			break;
+		}
+	}
+	if (done > 0) {
+		result = 0;
+	}
+
+	if (result == 0) {
+		if (inlock != NULL) {
+			infile->of_offset = inpos;
+		}
+		else if (inoffp != NULL) {
+			result = copyout(&inpos, inoffp, sizeof(inpos));
+		}
+	}
+	if (result == 0) {
+		if (outlock != NULL) {
+			outfile->of_offset = outpos;
+		}
+		else if (outoffp != NULL) {
+			result = copyout(&outpos, outoffp, sizeof(outpos));
+		}
+	}
+	if (result == 0) {
+		*retval = done;
+	}
+
+ out:
+	if (locked) {
+		copy_lockpair(inlock, outlock, false);
+	}
+	if (buf != NULL) {
+		kfree(buf);
+	}
+	filetable_put(ft, outfd, outfile);
+	filetable_put(ft, infd, infile);
+	return result;
 }
 
 /*
@@ -333,6 +734,64 @@ sys_dup2(int oldfd, int newfd, int *retval)
 	return 0;
 }
 
+/*
+ * pipe() - make a pipe with openfile_pipe, put both ends in the file
+ * table, and hand back the two fds.
+ */
+int
+sys_pipe(userptr_t fdsp)
+{
+	struct filetable *ft;
+	struct openfile *readfile, *writefile, *junk;
+	int fds[2];
+	int result;
+
+	ft = curproc->p_filetable;
+
+	result = openfile_pipe(&readfile, &writefile);
+	if (result) {
+		return result;
+	}
+
+	result = filetable_place(ft, readfile, &fds[0]);
+	if (result) {
+		openfile_decref(readfile);
+		openfile_decref(writefile);
+		return result;
+	}
+	result = filetable_place(ft, writefile, &fds[1]);
+	if (result) {
+		/*
+		 * The table has our reference to readfile now. Another
+		 * thread may already have closed fds[0], or even put
+		 * something else there; either way, take out and drop
+		 * whatever is there, as close would.
+		 */
+		filetable_placeat(ft, NULL, fds[0], &junk);
+		if (junk != NULL) {
+			openfile_decref(junk);
+		}
+		openfile_decref(writefile);
+		return result;
+	}
+
+	result = copyout(fds, fdsp, sizeof(fds));
+	if (result) {
+		/* as above, for both fds */
+		filetable_placeat(ft, NULL, fds[0], &junk);
+		if (junk != NULL) {
+			openfile_decref(junk);
+		}
+		filetable_placeat(ft, NULL, fds[1], &junk);
+		if (junk != NULL) {
+			openfile_decref(junk);
+		}
+		return result;
+	}
+
+	return 0;
+}
+
 /*
  * chdir() - change directory. Send the path off to the vfs layer.
  */
@@ -34,9 +34,74 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <vm.h>
 #include <openfile.h>
 #include <filetable.h>
 
+/* All the summary bits for the words of ft_inuse. */
+#define FT_ALLWORDS \
+	(FT_NWORDS == 32 ? 0xffffffffU : ((uint32_t)1 << FT_NWORDS) - 1)
+
+/*
+ * Return the number of the lowest clear bit in a word that has one.
+ * This is a binary search rather than a loop over the bits, so it
+ * takes the same five steps whatever the word holds.
+ */
+static
+unsigned
+filetable_ffz(uint32_t word)
+{
+	unsigned bit = 0;
+
+	KASSERT(word != 0xffffffffU);
+
+	/* look for the lowest set bit of the complement */
+	word = ~word;
+	if ((word & 0xffff) == 0) {
+		word >>= 16;
+		bit += 16;
+	}
+	if ((word & 0xff) == 0) {
+		word >>= 8;
+		bit += 8;
+	}
+	if ((word & 0xf) == 0) {
+		word >>= 4;
+		bit += 4;
+	}
+	if ((word & 0x3) == 0) {
+		word >>= 2;
+		bit += 2;
+	}
+	if ((word & 0x1) == 0) {
+		bit += 1;
+	}
+	return bit;
+}
+
+/*
+ * Record in the bitmap that a slot has been filled or emptied.
+ */
+static
+void
+filetable_setinuse(struct filetable *ft, int fd, bool inuse)
+{
+	unsigned ix = fd / FT_WORDBITS;
+	uint32_t mask = (uint32_t)1 << (fd % FT_WORDBITS);
+
+	KASSERT(spinlock_do_i_hold(&ft->ft_lock));
+
+	if (inuse) {
+		ft->ft_inuse[ix] |= mask;
+		if (ft->ft_inuse[ix] == 0xffffffffU) {
+			ft->ft_fullwords |= (uint32_t)1 << ix;
+		}
+	}
+	else {
+		ft->ft_inuse[ix] &= ~mask;
+		ft->ft_fullwords &= ~((uint32_t)1 << ix);
+	}
+}
 
 /*
  * Construct a filetable.
@@ -47,36 +112,56 @@ filetable_create(void)
 	struct filetable *ft;
 	int fd;
 
+	/* the summary word has to cover the whole bitmap */
+	COMPILE_ASSERT(OPEN_MAX % FT_WORDBITS == 0);
+	COMPILE_ASSERT(FT_NWORDS <= 32);
+	/* every process gets one; keep it to a single-page kmalloc */
+	COMPILE_ASSERT(sizeof(struct filetable) <= PAGE_SIZE);
+
 	ft = kmalloc(sizeof(struct filetable));
 	if (ft == NULL) {
 		return NULL;
 	}
 
+	spinlock_init(&ft->ft_lock);
+
 	/* the table starts empty */
 	for (fd = 0; fd < OPEN_MAX; fd++) {
 		ft->ft_openfiles[fd] = NULL;
 	}
+	bzero(ft->ft_inuse, sizeof(ft->ft_inuse));
+	ft->ft_fullwords = 0;
 
 	return ft;
 }
 
 /*
- * Destroy a filetable.
+ * Destroy a filetable. No other thread can be using it any more, so
+ * this doesn't lock, which is as well since closing files can sleep.
  */
 void
 filetable_destroy(struct filetable *ft)
 {
+	unsigned ix;
+	uint32_t word;
 	int fd;
 
 	KASSERT(ft != NULL);
 
-	/* Close any open files. */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		if (ft->ft_openfiles[fd] != NULL) {
+	/* Close any open files, going by the bitmap. */
+	for (ix = 0; ix < FT_NWORDS; ix++) {
+		word = ft->ft_inuse[ix];
+		while (word != 0) {
+			/* take the lowest set bit out of the word */
+			fd = ix * FT_WORDBITS + filetable_ffz(~word);
+			word &= word - 1;
+
+			KASSERT(ft->ft_openfiles[fd] != NULL);
 			openfile_decref(ft->ft_openfiles[fd]);
 			ft->ft_openfiles[fd] = NULL;
 		}
 	}
+	spinlock_cleanup(&ft->ft_lock);
 	kfree(ft);
 }
 
@@ -100,6 +185,8 @@ filetable_copy(struct filetable *src, struct filetable **dest_ret)
 {
 	struct filetable *dest;
 	struct openfile *file;
+	unsigned ix;
+	uint32_t word;
 	int fd;
 
 	/* Copying the nonexistent table avoids special cases elsewhere */
@@ -113,14 +200,24 @@ filetable_copy(struct filetable *src, struct filetable **dest_ret)
 		return ENOMEM;
 	}
 
-	/* share the entries */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		file = src->ft_openfiles[fd];
-		if (file != NULL) {
+	/* share the entries; the empty ones are already NULL */
+	spinlock_acquire(&src->ft_lock);
+	for (ix = 0; ix < FT_NWORDS; ix++) {
+		word = src->ft_inuse[ix];
+		while (word != 0) {
+			/* take the lowest set bit out of the word */
+			fd = ix * FT_WORDBITS + filetable_ffz(~word);
+			word &= word - 1;
+
+			file = src->ft_openfiles[fd];
+			KASSERT(file != NULL);
 			openfile_incref(file);
+			dest->ft_openfiles[fd] = file;
 		}
-		dest->ft_openfiles[fd] = file;
+		dest->ft_inuse[ix] = src->ft_inuse[ix];
 	}
+	dest->ft_fullwords = src->ft_fullwords;
+	spinlock_release(&src->ft_lock);
 
 	*dest_ret = dest;
 	return 0;
@@ -145,6 +242,9 @@ filetable_okfd(struct filetable *ft, int fd)
  * This checks that the file handle is in range and fails rather than
  * returning a null openfile; it only yields files that are actually
  * open.
+ *
+ * The caller gets a reference of its own, so that another thread
+ * closing the fd can't destroy the openfile while it's in use.
  */
 int
 filetable_get(struct filetable *ft, int fd, struct openfile **ret)
@@ -155,36 +255,36 @@ filetable_get(struct filetable *ft, int fd, struct openfile **ret)
 		return EBADF;
 	}
 
+	spinlock_acquire(&ft->ft_lock);
 	file = ft->ft_openfiles[fd];
 	if (file == NULL) {
+		spinlock_release(&ft->ft_lock);
 		return EBADF;
 	}
+	openfile_incref(file);
+	spinlock_release(&ft->ft_lock);
 
 	*ret = file;
 	return 0;
 }
 
 /*
- * Put a file handle back when done with it. This does not actually do
- * anything (other than crosscheck) but it's always good practice to
- * build things so when you take them out you put them back again
- * rather than dropping them on the floor. Then if you need to do
- * something at cleanup time you can put it in this function instead
- * of having to hunt for all the places to insert the new logic.
- *
- * (For example, if you have multithreaded processes you will need to
- * insert additional lock and/or refcount manipulations here and in
- * filetable_get.)
+ * Put a file handle back when done with it. This drops the reference
+ * filetable_get took. If the fd was closed in the meantime (by
+ * another thread) this may be the last reference, and then the file
+ * really gets closed here.
  *
  * The openfile should be the one returned from filetable_get. If you
- * want to manipulate the table so the assertion's no longer true, get
- * your own reference to the openfile (with openfile_incref) and call
- * filetable_put before mucking about.
+ * want to keep using it after calling filetable_put, get your own
+ * reference to it (with openfile_incref) first.
  */
 void
 filetable_put(struct filetable *ft, int fd, struct openfile *file)
 {
-	KASSERT(ft->ft_openfiles[fd] == file);
+	(void)ft;
+	(void)fd;
+
+	openfile_decref(file);
 }
 
 /*
@@ -200,17 +300,26 @@ filetable_put(struct filetable *ft, int fd, struct openfile *file)
 int
 filetable_place(struct filetable *ft, struct openfile *file, int *fd_ret)
 {
+	unsigned ix;
 	int fd;
 
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		if (ft->ft_openfiles[fd] == NULL) {
-			ft->ft_openfiles[fd] = file;
-			*fd_ret = fd;
-			return 0;
-		}
+	spinlock_acquire(&ft->ft_lock);
+	if ((ft->ft_fullwords & FT_ALLWORDS) == FT_ALLWORDS) {
+		spinlock_release(&ft->ft_lock);
+		return EMFILE;
 	}
 
-	return EMFILE;
+	/* the first word with room, then the first free slot in it */
+	ix = filetable_ffz(ft->ft_fullwords);
+	fd = ix * FT_WORDBITS + filetable_ffz(ft->ft_inuse[ix]);
+	KASSERT(ft->ft_openfiles[fd] == NULL);
+
+	ft->ft_openfiles[fd] = file;
+	filetable_setinuse(ft, fd, true);
+	spinlock_release(&ft->ft_lock);
+
+	*fd_ret = fd;
+	return 0;
 }
 
 /*
@@ -232,6 +341,9 @@ filetable_placeat(struct filetable *ft, struct openfile *newfile, int fd,
 {
 	KASSERT(filetable_okfd(ft, fd));
 
+	spinlock_acquire(&ft->ft_lock);
 	*oldfile_ret = ft->ft_openfiles[fd];
 	ft->ft_openfiles[fd] = newfile;
+	filetable_setinuse(ft, fd, newfile != NULL);
+	spinlock_release(&ft->ft_lock);
 }
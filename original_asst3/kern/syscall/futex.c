@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes: wait and wake on user addresses.
+ *
+ * A futex is just an int of user memory. Userland updates it with
+ * its own atomic operations and only calls into the kernel when it
+ * has to sleep (futex_wait) or when there may be sleepers to wake
+ * (futex_wake). The kernel has no state for a futex nobody is
+ * waiting on, so the uncontended case costs no system call at all.
+ *
+ * Sleepers are kept in a fixed hash table of buckets keyed by
+ * address space and user address. Each bucket has a sleep lock
+ * rather than a spinlock, because futex_wait has to read user memory
+ * (which may fault) while deciding whether to sleep. The waiters in
+ * a bucket all sleep on the bucket's CV; futex_wake marks the ones
+ * it picks and broadcasts, and anyone not picked (a different futex
+ * that hashes to the same bucket) goes back to sleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define FUTEX_BUCKETS 64
+
+/*
+ * One sleeping thread. These live on the sleeper's stack.
+ */
+struct futex_waiter {
+	struct addrspace *fw_as;	/* Address space of the futex */
+	vaddr_t fw_addr;		/* User address of the futex */
+	bool fw_woken;			/* Set by futex_wake */
+	struct futex_waiter *fw_next;	/* Next in bucket, oldest first */
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct cv *fb_cv;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_table[FUTEX_BUCKETS];
+
+/*
+ * Set up the hash table.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_BUCKETS; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		futex_table[i].fb_cv = cv_create("futex");
+		if (futex_table[i].fb_lock == NULL ||
+		    futex_table[i].fb_cv == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+/*
+ * Find the bucket for a futex.
+ */
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	uintptr_t h;
+
+	h = (addr >> 2) ^ ((uintptr_t)as >> 6);
+	return &futex_table[h % FUTEX_BUCKETS];
+}
+
+/*
+ * sys_futex_wait
+ * If the int at UADDR still holds VAL, sleep until futex_wake is
+ * called on it. Otherwise fail with EAGAIN right away; the caller
+ * should look at the value again.
+ *
+ * The check and going to sleep happen under the bucket lock, which
+ * futex_wake also takes, so a wake issued after the value changes
+ * cannot be missed.
+ */
+int
+sys_futex_wait(userptr_t uaddr, int val)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter w, **pp;
+	int cur, result;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	w.fw_as = proc_getas();
+	w.fw_addr = (vaddr_t)uaddr;
+	w.fw_woken = false;
+	w.fw_next = NULL;
+	fb = futex_hash(w.fw_as, w.fw_addr);
+
+	lock_acquire(fb->fb_lock);
+	result = copyin(uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	/* Go on the end of the list, so wakes are first come first served */
+	for (pp = &fb->fb_waiters; *pp != NULL; pp = &(*pp)->fw_next) {
+		/* nothing */
+	}
+	*pp = &w;
+
+	/* futex_wake takes us off the list */
+	while (!w.fw_woken) {
+		cv_wait(fb->fb_cv, fb->fb_lock);
+	}
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+/*
+ * sys_futex_wake
+ * Wake up to COUNT threads sleeping in futex_wait on UADDR, and
+ * return how many were woken.
+ */
+int
+sys_futex_wake(userptr_t uaddr, int count, int *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *w, **pp;
+	struct addrspace *as;
+	int woken;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0 || count < 0) {
+		return EINVAL;
+	}
+
+	as = proc_getas();
+	fb = futex_hash(as, (vaddr_t)uaddr);
+	woken = 0;
+
+	lock_acquire(fb->fb_lock);
+	pp = &fb->fb_waiters;
+	while (*pp != NULL && woken < count) {
+		w = *pp;
+		if (w->fw_as == as && w->fw_addr == (vaddr_t)uaddr) {
+			*pp = w->fw_next;
+			w->fw_woken = true;
+			woken++;
+		}
+		else {
+			pp = &w->fw_next;
+		}
+	}
+	if (woken > 0) {
+		cv_broadcast(fb->fb_cv, fb->fb_lock);
+	}
+	lock_release(fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
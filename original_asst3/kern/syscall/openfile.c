@@ -37,6 +37,7 @@
 #include <lib.h>
 #include <synch.h>
 #include <vfs.h>
+#include <pipe.h>
 #include <openfile.h>
 
 /*
@@ -44,7 +45,7 @@
  */
 static
 struct openfile *
-openfile_create(struct vnode *vn, int accmode)
+openfile_create(struct vnode *vn, int accmode, bool append)
 {
 	struct openfile *file;
 
@@ -58,7 +59,7 @@ openfile_create(struct vnode *vn, int accmode)
 		return NULL;
 	}
 
-	file->of_offsetlock = lock_create("openfile");
+	file->of_offsetlock = lock_create_adaptive("openfile");
 	if (file->of_offsetlock == NULL) {
 		kfree(file);
 		return NULL;
@@ -68,6 +69,7 @@ openfile_create(struct vnode *vn, int accmode)
 
 	file->of_vnode = vn;
 	file->of_accmode = accmode;
+	file->of_append = append;
 	file->of_offset = 0;
 	file->of_refcount = 1;
 
@@ -106,7 +108,8 @@ openfile_open(char *filename, int openflags, mode_t mode,
 		return result;
 	}
 
-	file = openfile_create(vn, openflags & O_ACCMODE);
+	file = openfile_create(vn, openflags & O_ACCMODE,
+			       (openflags & O_APPEND) != 0);
 	if (file == NULL) {
 		vfs_close(vn);
 		return ENOMEM;
@@ -116,6 +119,40 @@ openfile_open(char *filename, int openflags, mode_t mode,
 	return 0;
 }
 
+/*
+ * Make a pipe (with pipe_create) and wrap each end in an openfile
+ * object: the read end read-only and the write end write-only.
+ */
+int
+openfile_pipe(struct openfile **readret, struct openfile **writeret)
+{
+	struct vnode *readvn, *writevn;
+	struct openfile *readfile, *writefile;
+	int result;
+
+	result = pipe_create(&readvn, &writevn);
+	if (result) {
+		return result;
+	}
+
+	readfile = openfile_create(readvn, O_RDONLY, false);
+	if (readfile == NULL) {
+		vfs_close(readvn);
+		vfs_close(writevn);
+		return ENOMEM;
+	}
+	writefile = openfile_create(writevn, O_WRONLY, false);
+	if (writefile == NULL) {
+		openfile_decref(readfile);
+		vfs_close(writevn);
+		return ENOMEM;
+	}
+
+	*readret = readfile;
+	*writeret = writefile;
+	return 0;
+}
+
 /*
  * Increment the reference count on an openfile.
  */
@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * poll(): wait for any of several file descriptors to become ready.
+ *
+ * sys_poll looks up all the descriptors once, then goes over them
+ * asking each vnode what is ready (VOP_POLL). If nothing is, each
+ * vnode has also registered the poller on its pollqueue while
+ * checking, so the poller goes to sleep on its own wchan until one
+ * of those queues is woken or the timeout runs out, then drops the
+ * registrations and goes over the descriptors again.
+ *
+ * The timeout is a delayed work item that wakes the poller the same
+ * way a pollqueue does.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <lib.h>
+#include <clock.h>
+#include <wchan.h>
+#include <workqueue.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <poll.h>
+#include <syscall.h>
+
+/*
+ * One poller's registration on one pollqueue. These live in an array
+ * in the poller, one slot per descriptor.
+ */
+struct pollreg {
+	struct poller *pr_poller;	/* Who to wake */
+	struct pollqueue *pr_queue;	/* Queue we're on */
+	struct pollreg *pr_next;	/* Next on queue */
+	struct pollreg *pr_prev;	/* Previous on queue */
+};
+
+/*
+ * A thread in poll(). This lives on the thread's stack.
+ */
+struct poller {
+	struct spinlock pl_lock;	/* Protects pl_woken, pl_timedout */
+	struct wchan *pl_wchan;		/* Where we sleep */
+	bool pl_woken;			/* A pollqueue was woken */
+	bool pl_timedout;		/* The timeout ran out */
+	struct pollreg *pl_regs;	/* Registrations, pl_maxregs of them */
+	unsigned pl_nregs;		/* Number in use */
+	unsigned pl_maxregs;
+	struct work pl_timeout;		/* Timeout */
+};
+
+////////////////////////////////////////////////////////////
+// pollqueue
+
+void
+pollqueue_init(struct pollqueue *pq)
+{
+	spinlock_init(&pq->pq_lock);
+	pq->pq_head = NULL;
+}
+
+void
+pollqueue_cleanup(struct pollqueue *pq)
+{
+	KASSERT(pq->pq_head == NULL);
+	spinlock_cleanup(&pq->pq_lock);
+}
+
+/*
+ * Register PL on PQ, if PL isn't NULL.
+ */
+void
+pollqueue_wait(struct pollqueue *pq, struct poller *pl)
+{
+	struct pollreg *pr;
+
+	if (pl == NULL) {
+		return;
+	}
+
+	KASSERT(pl->pl_nregs < pl->pl_maxregs);
+	pr = &pl->pl_regs[pl->pl_nregs++];
+	pr->pr_poller = pl;
+	pr->pr_queue = pq;
+
+	spinlock_acquire(&pq->pq_lock);
+	pr->pr_prev = NULL;
+	pr->pr_next = pq->pq_head;
+	if (pq->pq_head != NULL) {
+		pq->pq_head->pr_prev = pr;
+	}
+	pq->pq_head = pr;
+	spinlock_release(&pq->pq_lock);
+}
+
+/*
+ * Wake up one poller.
+ */
+static
+void
+poller_wake(struct poller *pl, bool timedout)
+{
+	spinlock_acquire(&pl->pl_lock);
+	if (timedout) {
+		pl->pl_timedout = true;
+	}
+	else {
+		pl->pl_woken = true;
+	}
+	wchan_wakeall(pl->pl_wchan, &pl->pl_lock);
+	spinlock_release(&pl->pl_lock);
+}
+
+/*
+ * Wake up everyone registered on PQ. They stay registered until they
+ * drop it themselves.
+ */
+void
+pollqueue_wake(struct pollqueue *pq)
+{
+	struct pollreg *pr;
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pr = pq->pq_head; pr != NULL; pr = pr->pr_next) {
+		poller_wake(pr->pr_poller, false);
+	}
+	spinlock_release(&pq->pq_lock);
+}
+
+/*
+ * VOP_POLL for things that are always ready.
+ */
+int
+poll_alwaysready(struct vnode *v, int events, struct poller *pl)
+{
+	(void)v;
+	(void)pl;
+	return events & (POLLIN | POLLOUT);
+}
+
+////////////////////////////////////////////////////////////
+// poller
+
+/*
+ * Timeout function for pl_timeout.
+ */
+static
+void
+poller_timeout(void *arg)
+{
+	struct poller *pl = arg;
+
+	poller_wake(pl, true);
+}
+
+static
+int
+poller_init(struct poller *pl, unsigned maxregs)
+{
+	pl->pl_wchan = wchan_create("poll");
+	if (pl->pl_wchan == NULL) {
+		return ENOMEM;
+	}
+	pl->pl_regs = kmalloc(maxregs * sizeof(pl->pl_regs[0]));
+	if (pl->pl_regs == NULL) {
+		wchan_destroy(pl->pl_wchan);
+		return ENOMEM;
+	}
+	spinlock_init(&pl->pl_lock);
+	pl->pl_woken = false;
+	pl->pl_timedout = false;
+	pl->pl_nregs = 0;
+	pl->pl_maxregs = maxregs;
+	work_init(&pl->pl_timeout, poller_timeout, pl);
+	return 0;
+}
+
+/*
+ * Drop all of PL's registrations. Once this returns no pollqueue can
+ * reach PL any more.
+ */
+static
+void
+poller_unregister(struct poller *pl)
+{
+	struct pollreg *pr;
+	struct pollqueue *pq;
+	unsigned i;
+
+	for (i=0; i<pl->pl_nregs; i++) {
+		pr = &pl->pl_regs[i];
+		pq = pr->pr_queue;
+
+		spinlock_acquire(&pq->pq_lock);
+		if (pr->pr_prev != NULL) {
+			pr->pr_prev->pr_next = pr->pr_next;
+		}
+		else {
+			KASSERT(pq->pq_head == pr);
+			pq->pq_head = pr->pr_next;
+		}
+		if (pr->pr_next != NULL) {
+			pr->pr_next->pr_prev = pr->pr_prev;
+		}
+		spinlock_release(&pq->pq_lock);
+	}
+	pl->pl_nregs = 0;
+}
+
+static
+void
+poller_cleanup(struct poller *pl)
+{
+	KASSERT(pl->pl_nregs == 0);
+	workqueue_cancel(&pl->pl_timeout);
+	spinlock_cleanup(&pl->pl_lock);
+	kfree(pl->pl_regs);
+	wchan_destroy(pl->pl_wchan);
+}
+
+////////////////////////////////////////////////////////////
+// system call
+
+/*
+ * Ask every descriptor what's ready and fill in revents. Register PL
+ * on the way if it isn't NULL. Returns how many are ready.
+ */
+static
+unsigned
+poll_scan(struct pollfd *fds, struct openfile **files, unsigned nfds,
+	  struct poller *pl)
+{
+	unsigned i, nready;
+	int revents;
+
+	nready = 0;
+	for (i=0; i<nfds; i++) {
+		if (fds[i].fd < 0) {
+			revents = 0;
+		}
+		else if (files[i] == NULL) {
+			revents = POLLNVAL;
+		}
+		else {
+			revents = VOP_POLL(files[i]->of_vnode,
+					   fds[i].events, pl);
+			revents &= fds[i].events | POLLERR | POLLHUP;
+		}
+		fds[i].revents = revents;
+		if (revents != 0) {
+			nready++;
+		}
+	}
+	return nready;
+}
+
+/*
+ * poll() - see above. Each descriptor is looked up once and held
+ * for the whole call, so a pollqueue we're registered on can't go
+ * away under us even if the descriptor is closed meanwhile.
+ */
+int
+sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval)
+{
+	struct filetable *ft;
+	struct pollfd *fds;
+	struct openfile **files;
+	struct poller pl;
+	unsigned i, nready;
+	bool timedout;
+	int result;
+
+	if (nfds > OPEN_MAX) {
+		return EINVAL;
+	}
+
+	fds = kmalloc(nfds * sizeof(fds[0]));
+	if (fds == NULL) {
+		return ENOMEM;
+	}
+	files = kmalloc(nfds * sizeof(files[0]));
+	if (files == NULL) {
+		kfree(fds);
+		return ENOMEM;
+	}
+	result = copyin(ufds, fds, nfds * sizeof(fds[0]));
+	if (result) {
+		kfree(files);
+		kfree(fds);
+		return result;
+	}
+	result = poller_init(&pl, nfds);
+	if (result) {
+		kfree(files);
+		kfree(fds);
+		return result;
+	}
+
+	ft = curproc->p_filetable;
+	for (i=0; i<nfds; i++) {
+		files[i] = NULL;
+		if (fds[i].fd >= 0 &&
+		    filetable_get(ft, fds[i].fd, &files[i]) == 0) {
+			openfile_incref(files[i]);
+			filetable_put(ft, fds[i].fd, files[i]);
+		}
+	}
+
+	if (timeout > 0) {
+		workqueue_enqueue_delayed(&pl.pl_timeout,
+			((uint64_t)timeout * HZ + 999) / 1000);
+	}
+
+	while (1) {
+		/* don't register if we're not going to sleep */
+		nready = poll_scan(fds, files, nfds, timeout != 0 ? &pl : NULL);
+		if (nready > 0 || timeout == 0) {
+			break;
+		}
+
+		spinlock_acquire(&pl.pl_lock);
+		while (!pl.pl_woken && !pl.pl_timedout) {
+			wchan_sleep(pl.pl_wchan, &pl.pl_lock);
+		}
+		timedout = pl.pl_timedout;
+		pl.pl_woken = false;
+		spinlock_release(&pl.pl_lock);
+
+		poller_unregister(&pl);
+		if (timedout) {
+			/* one last look, without registering */
+			timeout = 0;
+		}
+	}
+	poller_unregister(&pl);
+	poller_cleanup(&pl);
+
+	for (i=0; i<nfds; i++) {
+		if (files[i] != NULL) {
+			openfile_decref(files[i]);
+		}
+	}
+	kfree(files);
+
+	result = copyout(fds, ufds, nfds * sizeof(fds[0]));
+	kfree(fds);
+	if (result) {
+		return result;
+	}
+	*retval = nready;
+	return 0;
+}
@@ -395,6 +395,13 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 		as_destroy(oldvm);
 	}
 
+	/* The new image has only the original stack (see threadfork). */
+	lock_acquire(curproc->p_threadslock);
+	curproc->p_ustacks = 1;
+	curproc->p_ustacksdefined = 1;
+	lock_release(curproc->p_threadslock);
+	curthread->t_ustack = 0;
+
 	/*
 	 * Now that we know we're succeeding, change the current thread's
 	 * name to reflect the new process.
@@ -557,9 +564,21 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	char *path;
 	struct argbuf kargv;
 	vaddr_t entrypoint, stackptr;
+	unsigned nthreads;
 	int argc;
 	int result;
 
+	/*
+	 * Throwing away the address space would pull it out from
+	 * under any other threads (see threadfork), so refuse.
+	 */
+	lock_acquire(curproc->p_threadslock);
+	nthreads = threadarray_num(&curproc->p_threads);
+	lock_release(curproc->p_threadslock);
+	if (nthreads > 1) {
+		return EBUSY;
+	}
+
 	path = kmalloc(PATH_MAX);
 	if (!path) {
 		return ENOMEM;
@@ -594,6 +613,12 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	/* don't need this any more */
 	kfree(path);
 
+	/* Any async I/O ring was in the old image. */
+	if (curproc->p_aio != NULL) {
+		aio_destroy(curproc->p_aio);
+		curproc->p_aio = NULL;
+	}
+
 	/* Send the argv strings to the process. */
 	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
 	if (result) {
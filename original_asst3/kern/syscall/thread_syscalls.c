@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Thread and scheduling syscalls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/schedstat.h>
+#include <lib.h>
+#include <machine/trapframe.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/*
+ * Affinity belongs to threads, but there are no thread ids to name
+ * them by; a pid stands for the calling thread. So only the calling
+ * process may be named, as itself or as 0, and in a process with
+ * several threads (see threadfork) only the caller is affected.
+ */
+static
+int
+sched_checkpid(pid_t pid)
+{
+	if (pid != 0 && pid != curproc->p_pid) {
+		return ESRCH;
+	}
+	return 0;
+}
+
+/*
+ * sys_sched_setaffinity
+ * Restrict the calling thread to the CPUs whose bits are set in MASK.
+ */
+int
+sys_sched_setaffinity(pid_t pid, uint32_t mask)
+{
+	int result;
+
+	result = sched_checkpid(pid);
+	if (result) {
+		return result;
+	}
+	return thread_setaffinity(mask);
+}
+
+/*
+ * sys_sched_getaffinity
+ * Copy out the calling thread's affinity mask.
+ */
+int
+sys_sched_getaffinity(pid_t pid, userptr_t umask)
+{
+	uint32_t mask;
+	int result;
+
+	result = sched_checkpid(pid);
+	if (result) {
+		return result;
+	}
+	mask = thread_getaffinity();
+	return copyout(&mask, umask, sizeof(mask));
+}
+
+/*
+ * sys_schedstat
+ * Copy out the scheduler statistics for one CPU, or for all of them
+ * if CPUNUM is SCHEDSTAT_ALLCPUS.
+ */
+int
+sys_schedstat(int cpunum, userptr_t ustats)
+{
+	struct schedstats ss;
+	int result;
+
+	result = thread_schedstat_get(cpunum, &ss);
+	if (result) {
+		return result;
+	}
+	return copyout(&ss, ustats, sizeof(ss));
+}
+
+/*
+ * What a new thread from threadfork needs to get going. The parent
+ * allocates this and the child frees it.
+ */
+struct threadfork_args {
+	struct trapframe ta_tf;		/* Copy of the parent's trapframe */
+	vaddr_t ta_entry;		/* User entry point */
+	vaddr_t ta_arg;			/* Argument for the entry point */
+	vaddr_t ta_stackptr;		/* Initial user stack pointer */
+	unsigned ta_ustack;		/* User stack slot */
+};
+
+static
+void
+threadfork_newthread(void *vargs, unsigned long junk)
+{
+	struct threadfork_args *args = vargs;
+	struct trapframe mytf;
+	vaddr_t entry, arg, stackptr;
+
+	(void)junk;
+
+	/* As in fork, move everything onto our stack and free the copy. */
+	mytf = args->ta_tf;
+	entry = args->ta_entry;
+	arg = args->ta_arg;
+	stackptr = args->ta_stackptr;
+	curthread->t_ustack = args->ta_ustack;
+	kfree(args);
+
+	enter_new_thread(&mytf, entry, arg, stackptr);
+}
+
+/*
+ * sys___threadfork
+ * Start a new thread in the current process, sharing its address
+ * space and file table, running ENTRY(ARG) on a stack of its own.
+ * ENTRY must not return; it should call __threadexit instead.
+ */
+int
+sys___threadfork(struct trapframe *tf, userptr_t entry, userptr_t arg)
+{
+	struct threadfork_args *args;
+	int result;
+
+	args = kmalloc(sizeof(*args));
+	if (args == NULL) {
+		return ENOMEM;
+	}
+	args->ta_tf = *tf;
+	args->ta_entry = (vaddr_t)entry;
+	args->ta_arg = (vaddr_t)arg;
+
+	result = proc_ustack_alloc(&args->ta_ustack, &args->ta_stackptr);
+	if (result) {
+		kfree(args);
+		return result;
+	}
+
+	result = thread_fork(curthread->t_name, curproc,
+			     threadfork_newthread, args, 0);
+	if (result) {
+		proc_ustack_free(args->ta_ustack);
+		kfree(args);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * sys___threadexit
+ * End the calling thread. If it was the last thread in the process,
+ * the process exits too.
+ */
+void
+sys___threadexit(void)
+{
+	proc_threadexit();
+}
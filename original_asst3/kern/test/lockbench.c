@@ -0,0 +1,739 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock microbenchmarks.
+ *
+ * Runs 1..N threads hammering on one lock, for short and for long
+ * critical sections, first with an ordinary (sleeping) lock and then
+ * with an adaptive one. For each run we print the throughput in
+ * lock acquisitions per second and the number of context switches
+ * incurred.
+ *
+ * The number of CPUs is set in sys161.conf; to see the adaptive lock
+ * do anything useful there needs to be more than one. Running this
+ * on 1, 2, 4, and 8 CPUs shows how the two lock flavors scale.
+ *
+ * The reader-writer benchmark is similar: each thread does a mix of
+ * reads and writes, and we compare an rwlock against an ordinary
+ * lock that serializes everything, for several write percentages.
+ *
+ * The spinlock benchmark pins one thread to each of 1..N cpus and
+ * has them all take one spinlock as fast as they can for a while,
+ * as a test-and-set lock and then as a ticket lock. Besides the
+ * throughput it prints the most and fewest acquisitions any one cpu
+ * got, to show how fair each flavor is.
+ *
+ * The CV benchmark has many threads waiting on one CV, and wakes them
+ * all repeatedly, once with a cv_signal per waiter (which is what
+ * waking everyone used to cost) and once with cv_broadcast (which
+ * hands the waiters to the lock instead). It prints the context
+ * switches and time per round.
+ *
+ * The lock order benchmark is single-threaded: it takes a few locks
+ * in a fixed order and lets them go, over and over, and prints what
+ * one acquire/release costs. Build kernels with no checking, with
+ * hangman, and with lockorder and run it on each to compare.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define MAXTHREADS	8	/* default/maximum number of threads */
+#define NLOOPS		200	/* acquisitions per thread per run */
+#define SHORTWORK	10	/* iterations inside a short critsec */
+#define LONGWORK	1000	/* iterations inside a long critsec */
+
+static struct lock *benchlock;
+static struct rwlock *benchrwlock;
+static struct semaphore *benchdone;
+static volatile unsigned long benchwork;
+static unsigned benchcrit;
+
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	unsigned i, j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NLOOPS; i++) {
+		lock_acquire(benchlock);
+		for (j=0; j<benchcrit; j++) {
+			benchwork++;
+		}
+		lock_release(benchlock);
+	}
+	V(benchdone);
+}
+
+/*
+ * Do one run with NTHREADS threads and print the results.
+ */
+static
+void
+lockbench_run(bool adaptive, unsigned crit, unsigned nthreads)
+{
+	struct timespec before, after, duration;
+	unsigned switches, i;
+	uint64_t nsecs, ops;
+	int result;
+
+	benchlock = adaptive ? lock_create_adaptive("lockbench") :
+		lock_create("lockbench");
+	if (benchlock == NULL) {
+		panic("lockbench: lock_create failed\n");
+	}
+	benchcrit = crit;
+
+	switches = thread_count_switches();
+	gettime(&before);
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("lockbench", NULL, lockbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(benchdone);
+	}
+
+	gettime(&after);
+	switches = thread_count_switches() - switches;
+
+	timespec_sub(&after, &before, &duration);
+	nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+	ops = (uint64_t)nthreads * NLOOPS;
+
+	kprintf("%-8s %-5s %2u threads: %8llu acq/sec, %6u switches\n",
+		adaptive ? "adaptive" : "sleeping",
+		crit == SHORTWORK ? "short" : "long",
+		nthreads,
+		nsecs == 0 ? 0ULL :
+		(unsigned long long)(ops * 1000000000ULL / nsecs),
+		switches);
+
+	lock_destroy(benchlock);
+	benchlock = NULL;
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	unsigned maxthreads, n;
+
+	if (nargs > 2) {
+		kprintf("Usage: lb [maxthreads]\n");
+		return EINVAL;
+	}
+	maxthreads = nargs == 2 ? atoi(args[1]) : MAXTHREADS;
+	if (maxthreads == 0) {
+		maxthreads = 1;
+	}
+
+	benchdone = sem_create("lockbench", 0);
+	if (benchdone == NULL) {
+		panic("lockbench: sem_create failed\n");
+	}
+
+	kprintf("Starting lock benchmark...\n");
+	for (n=1; n<=maxthreads; n++) {
+		lockbench_run(false, SHORTWORK, n);
+		lockbench_run(true, SHORTWORK, n);
+	}
+	for (n=1; n<=maxthreads; n++) {
+		lockbench_run(false, LONGWORK, n);
+		lockbench_run(true, LONGWORK, n);
+	}
+	kprintf("Lock benchmark done.\n");
+
+	sem_destroy(benchdone);
+	benchdone = NULL;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+static unsigned benchwritepct;
+
+static
+void
+rwlockbenchthread(void *junk, unsigned long num)
+{
+	unsigned i, j;
+	bool write;
+
+	(void)junk;
+
+	for (i=0; i<NLOOPS; i++) {
+		/* spread the writes evenly across threads and loops */
+		write = ((i + num * 7) % 100) < benchwritepct;
+		if (benchrwlock == NULL) {
+			lock_acquire(benchlock);
+		}
+		else if (write) {
+			rw_wlock(benchrwlock);
+		}
+		else {
+			rw_rlock(benchrwlock);
+		}
+		for (j=0; j<SHORTWORK; j++) {
+			if (write) {
+				benchwork++;
+			}
+			else {
+				(void)benchwork;
+			}
+		}
+		if (benchrwlock == NULL) {
+			lock_release(benchlock);
+		}
+		else {
+			rw_unlock(benchrwlock);
+		}
+	}
+	V(benchdone);
+}
+
+static
+void
+rwlockbench_run(bool userw, unsigned writepct, unsigned nthreads)
+{
+	struct timespec before, after, duration;
+	unsigned i;
+	uint64_t nsecs, ops;
+	int result;
+
+	if (userw) {
+		benchrwlock = rwlock_create("rwlockbench");
+		if (benchrwlock == NULL) {
+			panic("rwlockbench: rwlock_create failed\n");
+		}
+	}
+	else {
+		benchlock = lock_create("rwlockbench");
+		if (benchlock == NULL) {
+			panic("rwlockbench: lock_create failed\n");
+		}
+	}
+	benchwritepct = writepct;
+
+	gettime(&before);
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("rwlockbench", NULL, rwlockbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("rwlockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(benchdone);
+	}
+
+	gettime(&after);
+
+	timespec_sub(&after, &before, &duration);
+	nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+	ops = (uint64_t)nthreads * NLOOPS;
+
+	kprintf("%-6s %3u%% writes %2u threads: %8llu ops/sec\n",
+		userw ? "rwlock" : "lock",
+		writepct, nthreads,
+		nsecs == 0 ? 0ULL :
+		(unsigned long long)(ops * 1000000000ULL / nsecs));
+
+	if (userw) {
+		rwlock_destroy(benchrwlock);
+		benchrwlock = NULL;
+	}
+	else {
+		lock_destroy(benchlock);
+		benchlock = NULL;
+	}
+}
+
+int
+rwlockbench(int nargs, char **args)
+{
+	static const unsigned writepcts[] = { 0, 10, 50 };
+	unsigned maxthreads, n, i;
+
+	if (nargs > 2) {
+		kprintf("Usage: rwb [maxthreads]\n");
+		return EINVAL;
+	}
+	maxthreads = nargs == 2 ? atoi(args[1]) : MAXTHREADS;
+	if (maxthreads == 0) {
+		maxthreads = 1;
+	}
+
+	benchdone = sem_create("rwlockbench", 0);
+	if (benchdone == NULL) {
+		panic("rwlockbench: sem_create failed\n");
+	}
+
+	kprintf("Starting rwlock benchmark...\n");
+	for (i=0; i<ARRAYCOUNT(writepcts); i++) {
+		for (n=1; n<=maxthreads; n++) {
+			rwlockbench_run(false, writepcts[i], n);
+			rwlockbench_run(true, writepcts[i], n);
+		}
+	}
+	kprintf("Rwlock benchmark done.\n");
+
+	sem_destroy(benchdone);
+	benchdone = NULL;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+#define SPINMAXCPUS	32	/* can't pin to more than this */
+#define SPINBENCHMS	200	/* length of a run */
+#define SPINTHINK	20	/* iterations between acquisitions */
+
+static struct spinlock benchspinlock;
+static unsigned spinbench_ncpus;
+static volatile unsigned spinbench_ready;
+static volatile bool spinbench_stop;
+static uint64_t spinbench_nsecs;
+static unsigned spinbench_counts[SPINMAXCPUS];
+
+static
+void
+spinlockbenchthread(void *junk, unsigned long cpu)
+{
+	struct timespec start, now, duration;
+	volatile unsigned think;
+	unsigned count;
+	int result;
+
+	(void)junk;
+
+	result = thread_setaffinity(AFFINITY_CPU(cpu));
+	if (result) {
+		panic("spinlockbench: thread_setaffinity: %s\n",
+		      strerror(result));
+	}
+
+	/* Start together once everyone is on their cpu. */
+	spinlock_acquire(&benchspinlock);
+	spinbench_ready++;
+	spinlock_release(&benchspinlock);
+	while (spinbench_ready < spinbench_ncpus) {
+		/* nothing */
+	}
+
+	/* The thread on cpu 0 keeps time. */
+	if (cpu == 0) {
+		gettime(&start);
+	}
+
+	count = 0;
+	while (!spinbench_stop) {
+		spinlock_acquire(&benchspinlock);
+		benchwork++;
+		spinlock_release(&benchspinlock);
+		count++;
+
+		for (think=0; think<SPINTHINK; think++) {
+			/* nothing */
+		}
+
+		if (cpu == 0 && count % 64 == 0) {
+			gettime(&now);
+			timespec_sub(&now, &start, &duration);
+			spinbench_nsecs = duration.tv_sec * 1000000000ULL +
+				duration.tv_nsec;
+			if (spinbench_nsecs >= SPINBENCHMS * 1000000ULL) {
+				spinbench_stop = true;
+			}
+		}
+	}
+	spinbench_counts[cpu] = count;
+	V(benchdone);
+}
+
+/*
+ * Do one run on NCPUS cpus and print the results.
+ */
+static
+void
+spinlockbench_run(bool ticket, unsigned ncpus)
+{
+	unsigned i, min, max;
+	uint64_t ops;
+	int result;
+
+	if (ticket) {
+		spinlock_init_ticket(&benchspinlock);
+	}
+	else {
+		spinlock_init(&benchspinlock);
+	}
+	spinbench_ncpus = ncpus;
+	spinbench_ready = 0;
+	spinbench_stop = false;
+
+	for (i=0; i<ncpus; i++) {
+		result = thread_fork("spinlockbench", NULL,
+				     spinlockbenchthread, NULL, i);
+		if (result) {
+			panic("spinlockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<ncpus; i++) {
+		P(benchdone);
+	}
+
+	ops = 0;
+	min = max = spinbench_counts[0];
+	for (i=0; i<ncpus; i++) {
+		ops += spinbench_counts[i];
+		if (spinbench_counts[i] < min) {
+			min = spinbench_counts[i];
+		}
+		if (spinbench_counts[i] > max) {
+			max = spinbench_counts[i];
+		}
+	}
+
+	kprintf("%-6s %2u cpus: %9llu acq/sec, per-cpu max %u min %u\n",
+		ticket ? "ticket" : "tas", ncpus,
+		spinbench_nsecs == 0 ? 0ULL :
+		(unsigned long long)(ops * 1000000000ULL / spinbench_nsecs),
+		max, min);
+
+	spinlock_cleanup(&benchspinlock);
+}
+
+int
+spinlockbench(int nargs, char **args)
+{
+	unsigned maxcpus, n;
+
+	if (nargs > 2) {
+		kprintf("Usage: slb [maxcpus]\n");
+		return EINVAL;
+	}
+	maxcpus = thread_count_cpus();
+	if (nargs == 2 && (unsigned)atoi(args[1]) < maxcpus) {
+		maxcpus = atoi(args[1]);
+	}
+	if (maxcpus > SPINMAXCPUS) {
+		maxcpus = SPINMAXCPUS;
+	}
+	if (maxcpus == 0) {
+		maxcpus = 1;
+	}
+
+	benchdone = sem_create("spinlockbench", 0);
+	if (benchdone == NULL) {
+		panic("spinlockbench: sem_create failed\n");
+	}
+
+	kprintf("Starting spinlock benchmark...\n");
+	for (n=1; n<=maxcpus; n++) {
+		spinlockbench_run(false, n);
+		spinlockbench_run(true, n);
+	}
+	kprintf("Spinlock benchmark done.\n");
+
+	sem_destroy(benchdone);
+	benchdone = NULL;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+#define CVMAXTHREADS	32	/* default maximum number of waiters */
+#define CVROUNDS	50	/* wakeups per run */
+
+static struct cv *benchcv;
+static struct cv *benchreadycv;
+static unsigned cvbench_nthreads;
+static unsigned cvbench_waiting;
+static unsigned cvbench_gen;
+
+static
+void
+cvbenchthread(void *junk, unsigned long num)
+{
+	unsigned i, j, gen;
+
+	(void)junk;
+	(void)num;
+
+	lock_acquire(benchlock);
+	for (i=0; i<CVROUNDS; i++) {
+		gen = cvbench_gen;
+		cvbench_waiting++;
+		if (cvbench_waiting == cvbench_nthreads) {
+			cv_signal(benchreadycv, benchlock);
+		}
+		while (cvbench_gen == gen) {
+			cv_wait(benchcv, benchlock);
+		}
+		/* Do a little work with the lock, like a real waiter. */
+		for (j=0; j<SHORTWORK; j++) {
+			benchwork++;
+		}
+	}
+	lock_release(benchlock);
+	V(benchdone);
+}
+
+/*
+ * Do one run with NTHREADS waiters and print the results.
+ */
+static
+void
+cvbench_run(bool broadcast, unsigned nthreads)
+{
+	struct timespec before, after, duration;
+	unsigned switches, i, j;
+	uint64_t nsecs;
+	int result;
+
+	benchlock = lock_create("cvbench");
+	benchcv = cv_create("cvbench");
+	benchreadycv = cv_create("cvbench-ready");
+	if (benchlock == NULL || benchcv == NULL || benchreadycv == NULL) {
+		panic("cvbench: out of memory\n");
+	}
+	cvbench_nthreads = nthreads;
+	cvbench_waiting = 0;
+	cvbench_gen = 0;
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("cvbench", NULL, cvbenchthread, NULL, i);
+		if (result) {
+			panic("cvbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	switches = thread_count_switches();
+	gettime(&before);
+
+	lock_acquire(benchlock);
+	for (i=0; i<CVROUNDS; i++) {
+		while (cvbench_waiting < nthreads) {
+			cv_wait(benchreadycv, benchlock);
+		}
+		cvbench_waiting = 0;
+		cvbench_gen++;
+		if (broadcast) {
+			cv_broadcast(benchcv, benchlock);
+		}
+		else {
+			for (j=0; j<nthreads; j++) {
+				cv_signal(benchcv, benchlock);
+			}
+		}
+	}
+	lock_release(benchlock);
+
+	for (i=0; i<nthreads; i++) {
+		P(benchdone);
+	}
+
+	gettime(&after);
+	switches = thread_count_switches() - switches;
+
+	timespec_sub(&after, &before, &duration);
+	nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+
+	kprintf("%-9s %2u waiters: %5u switches/round, %8llu ns/round\n",
+		broadcast ? "broadcast" : "signalall", nthreads,
+		switches / CVROUNDS,
+		(unsigned long long)(nsecs / CVROUNDS));
+
+	cv_destroy(benchreadycv);
+	cv_destroy(benchcv);
+	lock_destroy(benchlock);
+	benchreadycv = NULL;
+	benchcv = NULL;
+	benchlock = NULL;
+}
+
+int
+cvbench(int nargs, char **args)
+{
+	unsigned maxthreads, n;
+
+	if (nargs > 2) {
+		kprintf("Usage: cvb [maxthreads]\n");
+		return EINVAL;
+	}
+	maxthreads = nargs == 2 ? atoi(args[1]) : CVMAXTHREADS;
+	if (maxthreads == 0) {
+		maxthreads = 1;
+	}
+
+	benchdone = sem_create("cvbench", 0);
+	if (benchdone == NULL) {
+		panic("cvbench: sem_create failed\n");
+	}
+
+	kprintf("Starting CV benchmark...\n");
+	for (n=1; n<=maxthreads; n*=2) {
+		cvbench_run(false, n);
+		cvbench_run(true, n);
+	}
+	kprintf("CV benchmark done.\n");
+
+	sem_destroy(benchdone);
+	benchdone = NULL;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+#define ORDERDEPTH	4	/* locks held at once */
+#define ORDERLOOPS	20000	/* default rounds per run */
+
+/*
+ * What's checking lock operations in this kernel. These are compile
+ * time options, so to compare them build a kernel with each and run
+ * the benchmark on all of them.
+ */
+#if OPT_HANGMAN && OPT_LOCKORDER
+#define ORDERCHECKER	"hangman+lockorder"
+#elif OPT_HANGMAN
+#define ORDERCHECKER	"hangman"
+#elif OPT_LOCKORDER
+#define ORDERCHECKER	"lockorder"
+#else
+#define ORDERCHECKER	"none"
+#endif
+
+/*
+ * Print the average cost of one acquire/release pair.
+ */
+static
+void
+lockorderbench_print(const char *what, const struct timespec *before,
+		     const struct timespec *after, unsigned loops)
+{
+	struct timespec duration;
+	uint64_t nsecs, ops;
+
+	timespec_sub(after, before, &duration);
+	nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+	ops = (uint64_t)loops * ORDERDEPTH;
+	kprintf("%-9s %-17s: %6llu ns per acquire/release\n",
+		what, ORDERCHECKER, (unsigned long long)(nsecs / ops));
+}
+
+/*
+ * Take ORDERDEPTH locks, always in the same order, and let them go
+ * again, LOOPS times; then the same with spinlocks. Uncontended, so
+ * this measures just the bookkeeping on the lock paths.
+ */
+int
+lockorderbench(int nargs, char **args)
+{
+	struct lock *locks[ORDERDEPTH];
+	struct spinlock spinlocks[ORDERDEPTH];
+	struct timespec before, after;
+	char name[32];
+	unsigned loops, i, j;
+
+	if (nargs > 2) {
+		kprintf("Usage: lob [loops]\n");
+		return EINVAL;
+	}
+	loops = nargs == 2 ? atoi(args[1]) : ORDERLOOPS;
+	if (loops == 0) {
+		loops = 1;
+	}
+
+	for (i=0; i<ORDERDEPTH; i++) {
+		snprintf(name, sizeof(name), "lockorderbench %u", i);
+		locks[i] = lock_create(name);
+		if (locks[i] == NULL) {
+			panic("lockorderbench: lock_create failed\n");
+		}
+		spinlock_init(&spinlocks[i]);
+	}
+
+	kprintf("Starting lock order benchmark...\n");
+
+	gettime(&before);
+	for (i=0; i<loops; i++) {
+		for (j=0; j<ORDERDEPTH; j++) {
+			lock_acquire(locks[j]);
+		}
+		for (j=ORDERDEPTH; j-- > 0; ) {
+			lock_release(locks[j]);
+		}
+	}
+	gettime(&after);
+	lockorderbench_print("lock", &before, &after, loops);
+
+	/*
+	 * All the spinlocks were initialized by the same call, so for
+	 * lockorder they're one class and nesting them isn't checked.
+	 * That still measures the cost of the hooks themselves.
+	 */
+	gettime(&before);
+	for (i=0; i<loops; i++) {
+		for (j=0; j<ORDERDEPTH; j++) {
+			spinlock_acquire(&spinlocks[j]);
+		}
+		for (j=ORDERDEPTH; j-- > 0; ) {
+			spinlock_release(&spinlocks[j]);
+		}
+	}
+	gettime(&after);
+	lockorderbench_print("spinlock", &before, &after, loops);
+
+	kprintf("Lock order benchmark done.\n");
+
+	for (i=0; i<ORDERDEPTH; i++) {
+		spinlock_cleanup(&spinlocks[i]);
+		lock_destroy(locks[i]);
+	}
+	return 0;
+}
@@ -35,7 +35,9 @@
 #include <kern/wait.h>
 #include <lib.h>
 #include <clock.h>
+#include <spinlock.h>
 #include <thread.h>
+#include <current.h>
 #include <synch.h>
 #include <test.h>
 
@@ -51,6 +53,7 @@ static struct semaphore *testsem;
 static struct lock *testlock;
 static struct cv *testcv;
 static struct semaphore *donesem;
+static struct rwlock *testrwlock;
 
 static
 void
@@ -80,6 +83,12 @@ inititems(void)
 			panic("synchtest: sem_create failed\n");
 		}
 	}
+	if (testrwlock==NULL) {
+		testrwlock = rwlock_create("testrwlock");
+		if (testrwlock == NULL) {
+			panic("synchtest: rwlock_create failed\n");
+		}
+	}
 }
 
 static
@@ -400,3 +409,250 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock test.
+ *
+ * One thread in four is a writer and updates the test values the same
+ * way locktest does; the rest are readers and check that the values
+ * they see are consistent. We also count how many readers are inside
+ * at once, which should be zero whenever a writer is in, and ought to
+ * get above one at some point if readers are really sharing.
+ */
+
+#define NRWLOOPS      120
+#define RWWRITERS     4		/* one thread in RWWRITERS writes */
+
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static unsigned rwcount_cur;
+static unsigned rwcount_max;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: Mismatch on %s\n", num, msg);
+	kprintf("Test failed\n");
+
+	rw_unlock(testrwlock);
+
+	V(donesem);
+	thread_exit();
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	unsigned long v1, v2, v3;
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % RWWRITERS == 0) {
+			rw_wlock(testrwlock);
+			if (rwcount_cur != 0) {
+				rwfail(num, "readers present during write");
+			}
+			testval1 = num;
+			testval2 = num*num;
+			testval3 = num%3;
+			thread_yield();
+			if (testval1 != num) {
+				rwfail(num, "testval1/num");
+			}
+			if (testval2 != num*num) {
+				rwfail(num, "testval2/num");
+			}
+			rw_unlock(testrwlock);
+		}
+		else {
+			rw_rlock(testrwlock);
+			spinlock_acquire(&rwcount_lock);
+			rwcount_cur++;
+			if (rwcount_cur > rwcount_max) {
+				rwcount_max = rwcount_cur;
+			}
+			spinlock_release(&rwcount_lock);
+
+			v1 = testval1;
+			thread_yield();
+			v2 = testval2;
+			v3 = testval3;
+			if (v2 != v1*v1) {
+				rwfail(num, "testval2/testval1");
+			}
+			if (v3 != v1%3) {
+				rwfail(num, "testval3/testval1");
+			}
+
+			spinlock_acquire(&rwcount_lock);
+			rwcount_cur--;
+			spinlock_release(&rwcount_lock);
+			rw_unlock(testrwlock);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwlocktest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+
+	testval1 = testval2 = testval3 = 0;
+	rwcount_cur = rwcount_max = 0;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwtestthread,
+				     NULL, i);
+		if (result) {
+			panic("rwlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	kprintf("Most readers inside at once: %u\n", rwcount_max);
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+/*
+ * Priority inheritance test.
+ *
+ * The classic inversion: a low-priority thread takes a lock, a
+ * high-priority thread blocks on it, and then a medium-priority
+ * thread hogs the CPU. Without inheritance the low thread never gets
+ * to run and release the lock, so the high thread waits for as long
+ * as the medium one cares to run. With inheritance the low thread
+ * runs at high priority until it lets go, so the high thread only
+ * waits about as long as the lock is held.
+ *
+ * This is only really interesting with one CPU; with more, the
+ * threads may get spread around and the inversion doesn't happen.
+ */
+
+#define PILOWHOLD	100	/* ms the low thread holds the lock */
+#define PIMEDHOG	1000	/* ms the medium thread hogs the CPU */
+
+enum { PI_LOW, PI_MEDIUM, PI_HIGH };
+
+static struct semaphore *pireadysem;
+static volatile unsigned pihighwait;
+static volatile int pilowpri;
+
+static
+unsigned
+pi_elapsed(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	return diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+}
+
+static
+void
+pitestthread(void *junk, unsigned long which)
+{
+	struct timespec start;
+
+	(void)junk;
+
+	switch (which) {
+	    case PI_LOW:
+		thread_setpriority(PRI_MIN);
+		lock_acquire(testlock);
+		V(pireadysem);
+		gettime(&start);
+		while (pi_elapsed(&start) < PILOWHOLD) {
+			/* spin */
+		}
+		pilowpri = curthread->t_pri;
+		lock_release(testlock);
+		break;
+	    case PI_MEDIUM:
+		V(pireadysem);
+		thread_setpriority((PRI_MIN + PRI_MAX) / 2);
+		gettime(&start);
+		while (pi_elapsed(&start) < PIMEDHOG) {
+			/* spin */
+		}
+		break;
+	    case PI_HIGH:
+		V(pireadysem);
+		gettime(&start);
+		lock_acquire(testlock);
+		pihighwait = pi_elapsed(&start);
+		lock_release(testlock);
+		break;
+	}
+	V(donesem);
+}
+
+int
+pitest(int nargs, char **args)
+{
+	static const char *const names[] = { "pilow", "pimedium", "pihigh" };
+	static const unsigned long order[] = { PI_LOW, PI_HIGH, PI_MEDIUM };
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting priority inheritance test...\n");
+
+	pireadysem = sem_create("pireadysem", 0);
+	if (pireadysem == NULL) {
+		panic("pitest: sem_create failed\n");
+	}
+	pihighwait = 0;
+	pilowpri = -1;
+
+	/*
+	 * Run at top priority ourselves so each thread gets set up
+	 * before the next one can interfere. The threads inherit this
+	 * and lower their own priorities as needed.
+	 */
+	thread_setpriority(PRI_MAX);
+	for (i=0; i<3; i++) {
+		result = thread_fork(names[order[i]], NULL, pitestthread,
+				     NULL, order[i]);
+		if (result) {
+			panic("pitest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		P(pireadysem);
+	}
+	for (i=0; i<3; i++) {
+		P(donesem);
+	}
+	thread_setpriority(PRI_DEFAULT);
+	sem_destroy(pireadysem);
+	pireadysem = NULL;
+
+	kprintf("Low thread was at priority %d while holding the lock\n",
+		pilowpri);
+	kprintf("High thread waited %u ms (lock held %u ms, "
+		"CPU hogged %u ms)\n", pihighwait, PILOWHOLD, PIMEDHOG);
+	if (pihighwait >= PIMEDHOG) {
+		kprintf("Test failed: priority inversion\n");
+	}
+	kprintf("Priority inheritance test done.\n");
+
+	return 0;
+}
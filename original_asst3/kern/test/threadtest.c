@@ -32,11 +32,18 @@
  */
 #include <types.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
+#include <current.h>
+#include <cpu.h>
 #include <synch.h>
 #include <test.h>
 
 #define NTHREADS  8
+#define NFORKS    2000	/* forks done by threadbench */
+#define NPINNED   8	/* pinned threads in affinitytest */
+#define NHOGS     8	/* unpinned threads in affinitytest */
+#define NPINLOOPS 200	/* yields per thread in affinitytest */
 
 static struct semaphore *tsem = NULL;
 
@@ -144,3 +151,151 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+static
+void
+nullthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(tsem);
+}
+
+/*
+ * Fork/exit benchmark: fork threads that exit immediately, one at a
+ * time, and see how many we can get through per second. This is
+ * mostly a measure of thread_fork and exorcise overhead. It runs
+ * once with the thread cache off and once with it on, so the two
+ * can be compared on the same kernel.
+ */
+static
+void
+threadbench_run(bool cache)
+{
+	struct timespec start, end, diff;
+	uint64_t ns;
+	int i, result;
+
+	thread_cache_enable(cache);
+
+	gettime(&start);
+	for (i=0; i<NFORKS; i++) {
+		result = thread_fork("threadbench", NULL, nullthread,
+				     NULL, i);
+		if (result) {
+			panic("threadbench: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+		P(tsem);
+	}
+	gettime(&end);
+
+	timespec_sub(&end, &start, &diff);
+	ns = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+	kprintf("cache %-3s: %d forks in %llu.%09lu seconds: "
+		"%llu forks/sec\n", cache ? "on" : "off",
+		NFORKS, (unsigned long long)diff.tv_sec,
+		(unsigned long)diff.tv_nsec,
+		(unsigned long long)(NFORKS * 1000000000ULL / (ns ? ns : 1)));
+}
+
+int
+threadbench(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting fork/exit benchmark...\n");
+	threadbench_run(false);
+	threadbench_run(true);
+	kprintf("Fork/exit benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Affinity test: pin some threads, and check after every yield that
+ * they're still where they were put, while a crowd of unpinned
+ * threads gets the migration code going. Even-numbered pinned
+ * threads pin themselves to cpu 0, which makes them move if they
+ * weren't there already; odd ones stay where they started.
+ */
+static volatile unsigned affinity_failures;
+
+static
+void
+pinnedthread(void *junk, unsigned long num)
+{
+	unsigned cpu, i;
+	int result;
+
+	(void)junk;
+
+	cpu = (num % 2 == 0) ? 0 : curcpu->c_number;
+	result = thread_setaffinity(AFFINITY_CPU(cpu));
+	if (result) {
+		panic("affinitytest: thread_setaffinity: %s\n",
+		      strerror(result));
+	}
+	for (i=0; i<NPINLOOPS; i++) {
+		if (curcpu->c_number != cpu) {
+			kprintf("Thread %lu: pinned to cpu %u, found on %u\n",
+				num, cpu, curcpu->c_number);
+			affinity_failures++;
+			break;
+		}
+		thread_yield();
+	}
+	V(tsem);
+}
+
+static
+void
+hogthread(void *junk, unsigned long num)
+{
+	volatile int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NPINLOOPS * 1000; i++) {
+		/* nothing */
+	}
+	V(tsem);
+}
+
+int
+affinitytest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting affinity test...\n");
+
+	affinity_failures = 0;
+	for (i=0; i<NPINNED + NHOGS; i++) {
+		result = thread_fork(i < NPINNED ? "pinned" : "hog", NULL,
+				     i < NPINNED ? pinnedthread : hogthread,
+				     NULL, i);
+		if (result) {
+			panic("affinitytest: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NPINNED + NHOGS; i++) {
+		P(tsem);
+	}
+
+	if (affinity_failures > 0) {
+		kprintf("Test failed: %u pinned threads migrated\n",
+			affinity_failures);
+	}
+	kprintf("Affinity test done.\n");
+
+	return 0;
+}
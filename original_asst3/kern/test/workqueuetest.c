@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Workqueue tests.
+ *
+ * wq1 checks that queued work runs, that flush waits for it, that a
+ * delayed item doesn't run early, and that cancel stops a pending
+ * item.
+ *
+ * wqb compares the latency of handing a job to a workqueue against
+ * forking a thread for it: each job records when it was handed off
+ * and when it started running, and we average the difference.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define NWORKS		32	/* items for wq1 */
+#define WQDELAY		(HZ / 4)	/* delay for wq1's delayed item */
+#define NJOBS		500	/* jobs for wqb */
+
+struct wqjob {
+	struct work j_work;
+	struct timespec j_start;	/* When handed off */
+	unsigned j_num;
+};
+
+static struct wqjob wqjobs[NWORKS];
+static struct spinlock wqcount_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned wqcount;
+static volatile bool wqdelayran;
+static struct semaphore *wqsem;
+static uint64_t wqlatency;		/* Total ns, for wqb */
+
+static
+void
+wqinit(void)
+{
+	if (wqsem == NULL) {
+		wqsem = sem_create("wqsem", 0);
+		if (wqsem == NULL) {
+			panic("workqueuetest: sem_create failed\n");
+		}
+	}
+}
+
+static
+void
+wqcountfunc(void *arg)
+{
+	struct wqjob *job = arg;
+
+	KASSERT(job->j_num < NWORKS);
+
+	/* Items may be on several CPUs' queues if we migrated. */
+	spinlock_acquire(&wqcount_lock);
+	wqcount++;
+	spinlock_release(&wqcount_lock);
+}
+
+static
+void
+wqdelayfunc(void *arg)
+{
+	(void)arg;
+	wqdelayran = true;
+}
+
+int
+workqueuetest(int nargs, char **args)
+{
+	struct work delayed;
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting workqueue test...\n");
+
+	wqcount = 0;
+	for (i=0; i<NWORKS; i++) {
+		wqjobs[i].j_num = i;
+		work_init(&wqjobs[i].j_work, wqcountfunc, &wqjobs[i]);
+		if (!workqueue_enqueue(&wqjobs[i].j_work)) {
+			panic("workqueuetest: fresh item already queued\n");
+		}
+	}
+	workqueue_flush();
+	if (wqcount != NWORKS) {
+		panic("workqueuetest: %u of %u items ran before flush "
+		      "returned\n", wqcount, NWORKS);
+	}
+	kprintf("Immediate work: ok\n");
+
+	wqdelayran = false;
+	work_init(&delayed, wqdelayfunc, NULL);
+	workqueue_enqueue_delayed(&delayed, WQDELAY);
+	if (workqueue_enqueue_delayed(&delayed, WQDELAY)) {
+		panic("workqueuetest: delayed item queued twice\n");
+	}
+	workqueue_flush();
+	if (wqdelayran) {
+		panic("workqueuetest: delayed item ran early\n");
+	}
+	clocksleep(1);
+	workqueue_flush();
+	if (!wqdelayran) {
+		panic("workqueuetest: delayed item never ran\n");
+	}
+	kprintf("Delayed work: ok\n");
+
+	wqdelayran = false;
+	workqueue_enqueue_delayed(&delayed, WQDELAY);
+	if (!workqueue_cancel(&delayed)) {
+		panic("workqueuetest: cancel didn't find delayed item\n");
+	}
+	clocksleep(1);
+	if (wqdelayran) {
+		panic("workqueuetest: cancelled item ran\n");
+	}
+	if (workqueue_cancel(&delayed)) {
+		panic("workqueuetest: cancelled item still queued\n");
+	}
+	kprintf("Cancel: ok\n");
+
+	kprintf("Workqueue test done.\n");
+	return 0;
+}
+
+/*
+ * Time from J_START to now, added to wqlatency.
+ */
+static
+void
+wqb_stamp(struct wqjob *job)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, &job->j_start, &diff);
+	wqlatency += diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+}
+
+static
+void
+wqb_workfunc(void *arg)
+{
+	wqb_stamp(arg);
+	V(wqsem);
+}
+
+static
+void
+wqb_threadfunc(void *arg, unsigned long junk)
+{
+	(void)junk;
+	wqb_stamp(arg);
+	V(wqsem);
+}
+
+static
+void
+wqb_report(const char *what, const struct timespec *start)
+{
+	struct timespec end, diff;
+	uint64_t ns;
+
+	gettime(&end);
+	timespec_sub(&end, start, &diff);
+	ns = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+	kprintf("%-10s %u jobs: %6llu ns avg latency, %8llu jobs/sec\n",
+		what, NJOBS, (unsigned long long)(wqlatency / NJOBS),
+		(unsigned long long)(NJOBS * 1000000000ULL / (ns ? ns : 1)));
+}
+
+int
+workqueuebench(int nargs, char **args)
+{
+	struct wqjob job;
+	struct timespec start;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	wqinit();
+	kprintf("Starting workqueue benchmark...\n");
+
+	wqlatency = 0;
+	work_init(&job.j_work, wqb_workfunc, &job);
+	gettime(&start);
+	for (i=0; i<NJOBS; i++) {
+		gettime(&job.j_start);
+		workqueue_enqueue(&job.j_work);
+		P(wqsem);
+	}
+	wqb_report("workqueue", &start);
+
+	wqlatency = 0;
+	gettime(&start);
+	for (i=0; i<NJOBS; i++) {
+		gettime(&job.j_start);
+		result = thread_fork("wqbench", NULL, wqb_threadfunc,
+				     &job, 0);
+		if (result) {
+			panic("workqueuebench: thread_fork: %s\n",
+			      strerror(result));
+		}
+		P(wqsem);
+	}
+	wqb_report("thread", &start);
+
+	kprintf("Workqueue benchmark done.\n");
+	return 0;
+}
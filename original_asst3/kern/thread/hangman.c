@@ -156,6 +156,40 @@ hangman_acquire(struct hangman_actor *a,
 	spinlock_release(&hangman_lock);
 }
 
+/*
+ * Note that a has acquired l in shared mode (e.g. as one of several
+ * readers of a reader-writer lock). Since a lockable can only record
+ * one holder, shared holders are not tracked at all: this just ends
+ * the wait started by hangman_wait, and there is no corresponding
+ * release. Cycles that pass through a shared holder go undetected.
+ */
+void
+hangman_acquire_shared(struct hangman_actor *a,
+		       struct hangman_lockable *l)
+{
+	if (l == &hangman_lock.splk_hangman) {
+		/* don't recurse */
+		return;
+	}
+
+	spinlock_acquire(&hangman_lock);
+
+	if (a->a_waiting != l) {
+		spinlock_release(&hangman_lock);
+		panic("hangman_acquire_shared: not waiting for lock %s (%p)\n",
+		      l->l_name, l);
+	}
+	if (l->l_holding != NULL) {
+		spinlock_release(&hangman_lock);
+		panic("hangman_acquire_shared: lock %s (%p) held by %s (%p)\n",
+		      l->l_name, l, l->l_holding->a_name, l->l_holding);
+	}
+
+	a->a_waiting = NULL;
+
+	spinlock_release(&hangman_lock);
+}
+
 void
 hangman_release(struct hangman_actor *a,
 		struct hangman_lockable *l)
@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Lock order validator. See lockorder.h.
+ *
+ * The first time a class B is taken while a class A is held, we
+ * search the graph of orders seen so far for a path from B back to
+ * A. If there is one, taking B here closes a cycle and we report it;
+ * otherwise we record the edge A -> B. Edges are only ever added, so
+ * once a pair has been seen the check is a single bit test with no
+ * locking, which is what makes this cheap enough to leave on.
+ *
+ * As in lockprof, everything lives in fixed tables and is protected
+ * by bare spinlock words taken with interrupts off, because we are
+ * called from inside spinlock_acquire and spinlock_release.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <current.h>
+#include <thread.h>
+#include <lockorder.h>
+
+/* Number of distinct classes we can track; the rest are ignored. */
+#define LOCKORDER_MAXCLASSES	128
+
+/* Longest name kept; longer names are truncated (and may collide). */
+#define LOCKORDER_NAMELEN	24
+
+/* Words in one row of the order matrix. */
+#define LOCKORDER_ROWWORDS	(LOCKORDER_MAXCLASSES / 32)
+
+struct lockorder_class {
+	char lc_name[LOCKORDER_NAMELEN];
+	unsigned lc_index;		/* Row/column in the matrices */
+};
+
+static struct lockorder_class lockorder_table[LOCKORDER_MAXCLASSES];
+static unsigned lockorder_count;
+static spinlock_data_t lockorder_tablelock = SPINLOCK_DATA_INITIALIZER;
+
+/* Where locks go once the table is full. Never checked. */
+static struct lockorder_class lockorder_untracked = {
+	"(untracked)", LOCKORDER_MAXCLASSES
+};
+
+/*
+ * lockorder_before[a] has bit b set if class a has been held while
+ * class b was taken. lockorder_reported[a] has bit b set once taking
+ * b while holding a has been reported as an inversion; such edges
+ * are not added to lockorder_before, so the graph stays acyclic.
+ */
+static uint32_t lockorder_before[LOCKORDER_MAXCLASSES][LOCKORDER_ROWWORDS];
+static uint32_t lockorder_reported[LOCKORDER_MAXCLASSES][LOCKORDER_ROWWORDS];
+static spinlock_data_t lockorder_graphlock = SPINLOCK_DATA_INITIALIZER;
+
+/*
+ * Search scratch space and the cycle found, protected by the graph
+ * lock (the stack is too small for them). The cycle is printed after
+ * the graph lock is dropped; lockorder_reporting is set meanwhile,
+ * which turns off checking (kprintf takes locks too) and keeps
+ * anyone else from overwriting lockorder_path.
+ */
+static uint8_t lockorder_parent[LOCKORDER_MAXCLASSES];
+static uint8_t lockorder_stack[LOCKORDER_MAXCLASSES];
+static uint8_t lockorder_path[LOCKORDER_MAXCLASSES];
+static unsigned lockorder_pathlen;
+static volatile bool lockorder_reporting;
+
+/*
+ * Take and drop one of our bare spinlock words. Return the old spl
+ * so it can be restored.
+ */
+static
+int
+lockorder_lock(volatile spinlock_data_t *sd)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(sd) != 0 ||
+	       spinlock_data_testandset(sd) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+	return spl;
+}
+
+static
+void
+lockorder_unlock(volatile spinlock_data_t *sd, int spl)
+{
+	membar_any_store();
+	spinlock_data_set(sd, 0);
+	splx(spl);
+}
+
+static
+bool
+lockorder_isset(uint32_t matrix[][LOCKORDER_ROWWORDS], unsigned a, unsigned b)
+{
+	return (matrix[a][b / 32] & ((uint32_t)1 << (b % 32))) != 0;
+}
+
+static
+void
+lockorder_set(uint32_t matrix[][LOCKORDER_ROWWORDS], unsigned a, unsigned b)
+{
+	matrix[a][b / 32] |= (uint32_t)1 << (b % 32);
+}
+
+/*
+ * Find (or add) the class for NAME.
+ */
+static
+struct lockorder_class *
+lockorder_lookup(const char *name)
+{
+	struct lockorder_class *lc;
+	char key[LOCKORDER_NAMELEN];
+	unsigned i;
+	int spl;
+
+	/* Truncate first, so truncated names match each other. */
+	snprintf(key, sizeof(key), "%s", name);
+
+	spl = lockorder_lock(&lockorder_tablelock);
+	for (i=0; i<lockorder_count; i++) {
+		lc = &lockorder_table[i];
+		if (!strcmp(lc->lc_name, key)) {
+			goto done;
+		}
+	}
+	if (lockorder_count < LOCKORDER_MAXCLASSES) {
+		lc = &lockorder_table[lockorder_count];
+		strcpy(lc->lc_name, key);
+		lc->lc_index = lockorder_count;
+		lockorder_count++;
+	}
+	else {
+		lc = &lockorder_untracked;
+	}
+ done:
+	lockorder_unlock(&lockorder_tablelock, spl);
+	return lc;
+}
+
+void
+lockorder_init(struct lockorder *lo, const char *name)
+{
+	lo->lo_class = lockorder_lookup(name);
+}
+
+/*
+ * For locks without names (spinlocks). KEY is the address of the
+ * code that initialized the lock.
+ */
+void
+lockorder_init_anon(struct lockorder *lo, const void *key)
+{
+	char name[LOCKORDER_NAMELEN];
+
+	snprintf(name, sizeof(name), "spinlock %p", key);
+	lockorder_init(lo, name);
+}
+
+void
+lockorder_heldinit(struct lockorder_held *lh)
+{
+	lh->lh_num = 0;
+	lh->lh_lost = 0;
+}
+
+/*
+ * Look for a path FROM -> ... -> TO in lockorder_before. If there is
+ * one, leave it in lockorder_path and return true. Call with the
+ * graph lock held.
+ */
+static
+bool
+lockorder_search(unsigned from, unsigned to)
+{
+	uint32_t visited[LOCKORDER_ROWWORDS];
+	unsigned sp, a, b, n;
+
+	bzero(visited, sizeof(visited));
+	visited[from / 32] |= (uint32_t)1 << (from % 32);
+	lockorder_stack[0] = from;
+	sp = 1;
+	while (sp > 0) {
+		a = lockorder_stack[--sp];
+		for (b=0; b<LOCKORDER_MAXCLASSES; b++) {
+			if (!lockorder_isset(lockorder_before, a, b) ||
+			    (visited[b / 32] & ((uint32_t)1 << (b % 32)))) {
+				continue;
+			}
+			visited[b / 32] |= (uint32_t)1 << (b % 32);
+			lockorder_parent[b] = a;
+			if (b == to) {
+				goto found;
+			}
+			/* Each class is pushed at most once. */
+			lockorder_stack[sp++] = b;
+		}
+	}
+	return false;
+
+ found:
+	/* Walk back from TO, then turn it around. */
+	n = 0;
+	for (b = to; b != from; b = lockorder_parent[b]) {
+		lockorder_path[n++] = b;
+	}
+	lockorder_path[n++] = from;
+	for (a=0; a<n/2; a++) {
+		b = lockorder_path[a];
+		lockorder_path[a] = lockorder_path[n - 1 - a];
+		lockorder_path[n - 1 - a] = b;
+	}
+	lockorder_pathlen = n;
+	return true;
+}
+
+/*
+ * Print the inversion left in lockorder_path and let checking resume.
+ */
+static
+void
+lockorder_report(struct lockorder_class *held, struct lockorder_class *lc)
+{
+	unsigned i;
+
+	kprintf("lockorder: %s took %s while holding %s\n",
+		curthread->t_name, lc->lc_name, held->lc_name);
+	kprintf("lockorder: but earlier: ");
+	for (i=0; i<lockorder_pathlen; i++) {
+		kprintf("%s%s", i > 0 ? " -> " : "",
+			lockorder_table[lockorder_path[i]].lc_name);
+	}
+	kprintf("\n");
+
+	membar_any_store();
+	lockorder_reporting = false;
+}
+
+/*
+ * Slow path: HELD -> LC hasn't been seen before.
+ */
+static
+void
+lockorder_addedge(struct lockorder_class *held, struct lockorder_class *lc)
+{
+	unsigned a = held->lc_index, b = lc->lc_index;
+	bool report = false;
+	int spl;
+
+	spl = lockorder_lock(&lockorder_graphlock);
+	if (lockorder_isset(lockorder_before, a, b) ||
+	    lockorder_isset(lockorder_reported, a, b)) {
+		/* Someone else got here first, or it's old news. */
+	}
+	else if (!lockorder_search(b, a)) {
+		lockorder_set(lockorder_before, a, b);
+	}
+	else if (!lockorder_reporting) {
+		lockorder_set(lockorder_reported, a, b);
+		lockorder_reporting = true;
+		report = true;
+	}
+	/* else it will be found again next time */
+	lockorder_unlock(&lockorder_graphlock, spl);
+
+	if (report) {
+		lockorder_report(held, lc);
+	}
+}
+
+/*
+ * Called before waiting for the lock.
+ */
+void
+lockorder_acquire(struct lockorder_held *lh, struct lockorder *lo)
+{
+	struct lockorder_class *lc, *held;
+	unsigned i;
+
+	if (lo->lo_class == NULL) {
+		/* Statically initialized spinlock; key on its address. */
+		lockorder_init_anon(lo, lo);
+	}
+	lc = lo->lo_class;
+
+	if (lc != &lockorder_untracked && !lockorder_reporting) {
+		for (i=0; i<lh->lh_num; i++) {
+			held = lh->lh_classes[i];
+			if (held == lc || held == &lockorder_untracked) {
+				continue;
+			}
+			if (lockorder_isset(lockorder_before,
+					    held->lc_index, lc->lc_index)) {
+				/* Seen before and fine. */
+				continue;
+			}
+			lockorder_addedge(held, lc);
+		}
+	}
+
+	if (lh->lh_num < LOCKORDER_MAXHELD) {
+		lh->lh_classes[lh->lh_num++] = lc;
+	}
+	else {
+		lh->lh_lost++;
+	}
+}
+
+/*
+ * Called with the lock still held. Locks needn't be released in the
+ * reverse of the order they were taken.
+ */
+void
+lockorder_release(struct lockorder_held *lh, struct lockorder *lo)
+{
+	unsigned i;
+
+	for (i=lh->lh_num; i-- > 0; ) {
+		if (lh->lh_classes[i] == lo->lo_class) {
+			lh->lh_num--;
+			for (; i<lh->lh_num; i++) {
+				lh->lh_classes[i] = lh->lh_classes[i+1];
+			}
+			return;
+		}
+	}
+	/*
+	 * Not found: either it didn't fit, or it was a spinlock taken
+	 * before curcpu was set up.
+	 */
+	if (lh->lh_lost > 0) {
+		lh->lh_lost--;
+	}
+}
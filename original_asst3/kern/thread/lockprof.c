@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Lock contention profiler. See lockprof.h.
+ *
+ * The statistics live in a fixed table so that nothing here ever
+ * needs to allocate memory or take a real lock; we are called from
+ * inside spinlock_acquire and spinlock_release and anything that
+ * used a struct spinlock would recurse. Instead each record has a
+ * bare spinlock word, taken with interrupts off.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <lockprof.h>
+
+/* Number of distinct names we can track; the rest go in "(other)". */
+#define LOCKPROF_MAXNAMES	64
+
+/* Longest name kept; longer names are truncated (and may collide). */
+#define LOCKPROF_NAMELEN	24
+
+struct lockprof_stats {
+	spinlock_data_t ls_lock;	/* Protects the counters */
+	char ls_name[LOCKPROF_NAMELEN];
+	uint64_t ls_acquires;		/* Total acquisitions */
+	uint64_t ls_contended;		/* Acquisitions that had to wait */
+	uint64_t ls_waitns;		/* Total time spent waiting */
+	uint64_t ls_maxholdns;		/* Longest time held */
+};
+
+static struct lockprof_stats lockprof_table[LOCKPROF_MAXNAMES];
+static unsigned lockprof_count;
+static spinlock_data_t lockprof_tablelock = SPINLOCK_DATA_INITIALIZER;
+static struct lockprof_stats lockprof_other = {
+	SPINLOCK_DATA_INITIALIZER, "(other)", 0, 0, 0, 0
+};
+
+/* Set once the clock is available. */
+static volatile bool lockprof_running;
+
+/*
+ * Take and drop one of our bare spinlock words. Return the old spl
+ * so it can be restored.
+ */
+static
+int
+lockprof_lock(volatile spinlock_data_t *sd)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(sd) != 0 ||
+	       spinlock_data_testandset(sd) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+	return spl;
+}
+
+static
+void
+lockprof_unlock(volatile spinlock_data_t *sd, int spl)
+{
+	membar_any_store();
+	spinlock_data_set(sd, 0);
+	splx(spl);
+}
+
+/*
+ * Time elapsed since START, in nanoseconds.
+ */
+static
+uint64_t
+lockprof_since(const struct timespec *start, struct timespec *now)
+{
+	struct timespec diff;
+
+	gettime(now);
+	timespec_sub(now, start, &diff);
+	return (uint64_t)diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+}
+
+/*
+ * Find (or add) the record for NAME.
+ */
+static
+struct lockprof_stats *
+lockprof_lookup(const char *name)
+{
+	struct lockprof_stats *ls;
+	char key[LOCKPROF_NAMELEN];
+	unsigned i;
+	int spl;
+
+	/* Truncate first, so truncated names match each other. */
+	snprintf(key, sizeof(key), "%s", name);
+
+	spl = lockprof_lock(&lockprof_tablelock);
+	for (i=0; i<lockprof_count; i++) {
+		ls = &lockprof_table[i];
+		if (!strcmp(ls->ls_name, key)) {
+			goto done;
+		}
+	}
+	if (lockprof_count < LOCKPROF_MAXNAMES) {
+		ls = &lockprof_table[lockprof_count++];
+		strcpy(ls->ls_name, key);
+	}
+	else {
+		ls = &lockprof_other;
+	}
+ done:
+	lockprof_unlock(&lockprof_tablelock, spl);
+	return ls;
+}
+
+/*
+ * Start counting. Must not be called until the realtime clock has
+ * attached.
+ */
+void
+lockprof_bootstrap(void)
+{
+	lockprof_running = true;
+}
+
+void
+lockprof_init(struct lockprof *lp, const char *name)
+{
+	lp->lp_stats = lockprof_lookup(name);
+	lp->lp_holdstart.tv_sec = 0;
+	lp->lp_holdstart.tv_nsec = 0;
+}
+
+/*
+ * For locks without names (spinlocks). KEY is the address of the
+ * code that initialized the lock.
+ */
+void
+lockprof_init_anon(struct lockprof *lp, const void *key)
+{
+	char name[LOCKPROF_NAMELEN];
+
+	snprintf(name, sizeof(name), "spinlock %p", key);
+	lockprof_init(lp, name);
+}
+
+/*
+ * Called each time around the wait loop; notes when we started.
+ */
+void
+lockprof_wait(struct lockprof_waiter *w)
+{
+	if (!lockprof_running || w->lw_waiting) {
+		return;
+	}
+	gettime(&w->lw_start);
+	w->lw_waiting = true;
+}
+
+/*
+ * Called with the lock held.
+ */
+void
+lockprof_acquire(struct lockprof *lp, struct lockprof_waiter *w)
+{
+	struct lockprof_stats *ls;
+	struct timespec now;
+	uint64_t waitns;
+	int spl;
+
+	if (!lockprof_running) {
+		return;
+	}
+	if (lp->lp_stats == NULL) {
+		/* Statically initialized spinlock; key on its address. */
+		lockprof_init_anon(lp, lp);
+	}
+	ls = lp->lp_stats;
+
+	if (w->lw_waiting) {
+		waitns = lockprof_since(&w->lw_start, &now);
+	}
+	else {
+		waitns = 0;
+		gettime(&now);
+	}
+	lp->lp_holdstart = now;
+
+	spl = lockprof_lock(&ls->ls_lock);
+	ls->ls_acquires++;
+	if (w->lw_waiting) {
+		ls->ls_contended++;
+		ls->ls_waitns += waitns;
+	}
+	lockprof_unlock(&ls->ls_lock, spl);
+}
+
+/*
+ * Called with the lock still held.
+ */
+void
+lockprof_release(struct lockprof *lp)
+{
+	struct lockprof_stats *ls;
+	struct timespec now;
+	uint64_t holdns;
+	int spl;
+
+	ls = lp->lp_stats;
+	if (!lockprof_running || ls == NULL || lp->lp_holdstart.tv_sec == 0) {
+		/* Acquired before we started counting. */
+		return;
+	}
+	holdns = lockprof_since(&lp->lp_holdstart, &now);
+
+	spl = lockprof_lock(&ls->ls_lock);
+	if (holdns > ls->ls_maxholdns) {
+		ls->ls_maxholdns = holdns;
+	}
+	lockprof_unlock(&ls->ls_lock, spl);
+}
+
+/*
+ * Copy out one record and zero it.
+ */
+static
+void
+lockprof_take(struct lockprof_stats *ls, struct lockprof_stats *ret)
+{
+	int spl;
+
+	spl = lockprof_lock(&ls->ls_lock);
+	*ret = *ls;
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_waitns = 0;
+	ls->ls_maxholdns = 0;
+	lockprof_unlock(&ls->ls_lock, spl);
+}
+
+/*
+ * Print the N most contended names and reset everything. We print
+ * from a copy, since kprintf takes locks and we mustn't be holding
+ * any of ours while it counts them.
+ */
+void
+lockprof_dump(unsigned n)
+{
+	struct lockprof_stats *snap, tmp;
+	unsigned num, i, j;
+	int spl;
+
+	snap = kmalloc((LOCKPROF_MAXNAMES + 1) * sizeof(*snap));
+	if (snap == NULL) {
+		kprintf("lockprof: Out of memory\n");
+		return;
+	}
+
+	spl = lockprof_lock(&lockprof_tablelock);
+	num = lockprof_count;
+	lockprof_unlock(&lockprof_tablelock, spl);
+
+	for (i=0; i<num; i++) {
+		lockprof_take(&lockprof_table[i], &snap[i]);
+	}
+	lockprof_take(&lockprof_other, &snap[num++]);
+
+	/* Insertion sort by contended acquisitions, then by wait time. */
+	for (i=1; i<num; i++) {
+		tmp = snap[i];
+		for (j=i; j>0; j--) {
+			if (snap[j-1].ls_contended > tmp.ls_contended ||
+			    (snap[j-1].ls_contended == tmp.ls_contended &&
+			     snap[j-1].ls_waitns >= tmp.ls_waitns)) {
+				break;
+			}
+			snap[j] = snap[j-1];
+		}
+		snap[j] = tmp;
+	}
+
+	kprintf("%-24s %10s %10s %12s %12s\n", "lock", "acquires",
+		"contended", "wait (us)", "maxhold (us)");
+	for (i=0; i<num && i<n; i++) {
+		if (snap[i].ls_acquires == 0) {
+			break;
+		}
+		kprintf("%-24s %10llu %10llu %12llu %12llu\n",
+			snap[i].ls_name,
+			(unsigned long long)snap[i].ls_acquires,
+			(unsigned long long)snap[i].ls_contended,
+			(unsigned long long)(snap[i].ls_waitns / 1000),
+			(unsigned long long)(snap[i].ls_maxholdns / 1000));
+	}
+
+	kfree(snap);
+}
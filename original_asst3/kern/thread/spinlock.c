@@ -43,6 +43,28 @@
  * Spinlocks.
  */
 
+/*
+ * Backoff while waiting, in iterations of an empty loop. A
+ * test-and-set lock doubles its wait after each failed attempt, from
+ * BACKOFF_MIN up to BACKOFF_MAX. A ticket lock knows how many CPUs
+ * are ahead of it, and waits BACKOFF_TICKET per CPU (again at most
+ * BACKOFF_MAX) between looks, so it is neither late for its turn
+ * nor re-reading the lock word all the time.
+ */
+#define SPINLOCK_BACKOFF_MIN	1
+#define SPINLOCK_BACKOFF_MAX	1024
+#define SPINLOCK_BACKOFF_TICKET	16
+
+static
+void
+spinlock_delay(unsigned n)
+{
+	volatile unsigned i;
+
+	for (i=0; i<n; i++) {
+		/* nothing */
+	}
+}
 
 /*
  * Initialize spinlock.
@@ -51,8 +73,27 @@ void
 spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	splk->splk_ticket = false;
+	splk->splk_holder = NULL;
+	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
+	LOCKPROF_INITANON(&splk->splk_prof, __builtin_return_address(0));
+	LOCKORDER_INITANON(&splk->splk_order, __builtin_return_address(0));
+}
+
+/*
+ * Initialize a ticket spinlock.
+ */
+void
+spinlock_init_ticket(struct spinlock *splk)
+{
+	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	splk->splk_ticket = true;
 	splk->splk_holder = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
+	LOCKPROF_INITANON(&splk->splk_prof, __builtin_return_address(0));
+	LOCKORDER_INITANON(&splk->splk_order, __builtin_return_address(0));
 }
 
 /*
@@ -62,7 +103,13 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	if (splk->splk_ticket) {
+		KASSERT(spinlock_data_get(&splk->splk_lock) ==
+			spinlock_data_get(&splk->splk_next));
+	}
+	else {
+		KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	}
 }
 
 /*
@@ -76,6 +123,9 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket, serving;
+	unsigned backoff;
+	LOCKPROF_WAITER(waiter);
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -88,33 +138,58 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu->c_spinlocks++;
 
 		HANGMAN_WAIT(&curcpu->c_hangman, &splk->splk_hangman);
+		LOCKORDER_ACQUIRE(&curcpu->c_lockorder, &splk->splk_order);
 	}
 	else {
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
+	if (splk->splk_ticket) {
+		/* Take a ticket and wait to be served. */
+		ticket = spinlock_data_fetchadd(&splk->splk_next, 1);
+		while (1) {
+			serving = spinlock_data_get(&splk->splk_lock);
+			if (serving == ticket) {
+				break;
+			}
+			LOCKPROF_WAIT(&waiter);
+			/* unsigned, so this is right when the counters wrap */
+			backoff = (ticket - serving) * SPINLOCK_BACKOFF_TICKET;
+			if (backoff > SPINLOCK_BACKOFF_MAX) {
+				backoff = SPINLOCK_BACKOFF_MAX;
+			}
+			spinlock_delay(backoff);
 		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
+	}
+	else {
+		backoff = SPINLOCK_BACKOFF_MIN;
+		while (1) {
+			/*
+			 * Do test-test-and-set, that is, read first
+			 * before doing test-and-set, to reduce bus
+			 * contention.
+			 *
+			 * Test-and-set is a machine-level atomic
+			 * operation that writes 1 into the lock word
+			 * and returns the previous value. If that
+			 * value was 0, the lock was previously unheld
+			 * and we now own it. If it was 1, we don't.
+			 */
+			if (spinlock_data_get(&splk->splk_lock) == 0 &&
+			    spinlock_data_testandset(&splk->splk_lock) == 0) {
+				break;
+			}
+			LOCKPROF_WAIT(&waiter);
+			spinlock_delay(backoff);
+			if (backoff < SPINLOCK_BACKOFF_MAX) {
+				backoff *= 2;
+			}
 		}
-		break;
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+	LOCKPROF_ACQUIRE(&splk->splk_prof, &waiter);
 
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
@@ -133,11 +208,20 @@ spinlock_release(struct spinlock *splk)
 		KASSERT(curcpu->c_spinlocks > 0);
 		curcpu->c_spinlocks--;
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
+		LOCKORDER_RELEASE(&curcpu->c_lockorder, &splk->splk_order);
 	}
 
+	LOCKPROF_RELEASE(&splk->splk_prof);
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	if (splk->splk_ticket) {
+		/* Only the holder writes this, so no atomic op needed */
+		spinlock_data_set(&splk->splk_lock,
+				  spinlock_data_get(&splk->splk_lock) + 1);
+	}
+	else {
+		spinlock_data_set(&splk->splk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -34,12 +34,39 @@
 
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
 
+/*
+ * Number of times an adaptive lock polls lk_holder before giving up
+ * and going to sleep. This is a budget for the whole lock_acquire
+ * call, not for each time the holder changes; otherwise a stream of
+ * running holders could keep us spinning indefinitely.
+ */
+#define LOCK_SPIN_MAX	1000
+
+/*
+ * Priority inheritance.
+ *
+ * The bookkeeping is only done for contended locks. When a thread
+ * first sleeps on a lock, the lock goes on its holder's t_heldlocks
+ * list; every sleeper goes on the lock's lk_waiters list (linked
+ * through t_lockwaitnext) and stays there until it gets the lock.
+ * A thread's effective priority is then the highest of its own and
+ * those of the waiters on all the locks it holds.
+ *
+ * All of this, plus t_pri and the lk_holder of any lock that has
+ * waiters, is protected by pi_lock. Since lk_waiters only changes
+ * with lk_lock held as well, lock_acquire and lock_release can
+ * check it under lk_lock and skip pi_lock entirely when nobody is
+ * waiting. Lock order is lk_lock, then pi_lock.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -69,6 +96,7 @@ sem_create(const char *name, unsigned initial_count)
 
 	spinlock_init(&sem->sem_lock);
 	sem->sem_count = initial_count;
+	LOCKPROF_INIT(&sem->sem_prof, sem->sem_name);
 
 	return sem;
 }
@@ -88,6 +116,8 @@ sem_destroy(struct semaphore *sem)
 void
 P(struct semaphore *sem)
 {
+	LOCKPROF_WAITER(waiter);
+
 	KASSERT(sem != NULL);
 
 	/*
@@ -113,10 +143,13 @@ P(struct semaphore *sem)
 		 * Exercise: how would you implement strict FIFO
 		 * ordering?
 		 */
+		LOCKPROF_WAIT(&waiter);
 		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
 	}
 	KASSERT(sem->sem_count > 0);
 	sem->sem_count--;
+	/* No holder, so no hold time; just count the wait. */
+	LOCKPROF_ACQUIRE(&sem->sem_prof, &waiter);
 	spinlock_release(&sem->sem_lock);
 }
 
@@ -164,6 +197,25 @@ lock_create(const char *name)
 	}
 	spinlock_init(&lock->lk_lock);
 	lock->lk_holder = NULL;
+	lock->lk_adaptive = false;
+	lock->lk_waiters = NULL;
+	lock->lk_heldnext = NULL;
+	LOCKPROF_INIT(&lock->lk_prof, lock->lk_name);
+	LOCKORDER_INIT(&lock->lk_order, lock->lk_name);
+
+	return lock;
+}
+
+struct lock *
+lock_create_adaptive(const char *name)
+{
+	struct lock *lock;
+
+	lock = lock_create(name);
+	if (lock == NULL) {
+		return NULL;
+	}
+	lock->lk_adaptive = true;
 
 	return lock;
 }
@@ -174,6 +226,7 @@ lock_destroy(struct lock *lock)
 	KASSERT(lock != NULL);
 
 	KASSERT(lock->lk_holder == NULL);
+	KASSERT(lock->lk_waiters == NULL);
 	spinlock_cleanup(&lock->lk_lock);
 	wchan_destroy(lock->lk_wchan);
 
@@ -181,9 +234,208 @@ lock_destroy(struct lock *lock)
 	kfree(lock);
 }
 
+/*
+ * Recompute T's effective priority from its base priority and the
+ * waiters on the locks it holds.
+ */
+static
+void
+pi_recompute(struct thread *t)
+{
+	struct lock *lk;
+	struct thread *w;
+	int pri;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	pri = t->t_basepri;
+	for (lk = t->t_heldlocks; lk != NULL; lk = lk->lk_heldnext) {
+		for (w = lk->lk_waiters; w != NULL; w = w->t_lockwaitnext) {
+			if (w->t_pri > pri) {
+				pri = w->t_pri;
+			}
+		}
+	}
+	t->t_pri = pri;
+}
+
+/*
+ * Lend priority PRI to T, and to whoever holds the lock T is asleep
+ * on, and so on down the chain. Stops as soon as it reaches a thread
+ * that is already at least that important, which also keeps it from
+ * going around in circles if there's a deadlock.
+ */
+static
+void
+pi_boost(struct thread *t, int pri)
+{
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	while (t != NULL && t->t_pri < pri) {
+		t->t_pri = pri;
+		if (t->t_blockedon == NULL) {
+			break;
+		}
+		t = t->t_blockedon->lk_holder;
+	}
+}
+
+/*
+ * Called before sleeping on LOCK, which is held by someone else.
+ */
+static
+void
+pi_block(struct lock *lock)
+{
+	struct thread *holder;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&pi_lock);
+	holder = lock->lk_holder;
+	KASSERT(holder != NULL);
+	if (curthread->t_blockedon == NULL) {
+		if (lock->lk_waiters == NULL) {
+			/* First waiter; the holder needs to know. */
+			lock->lk_heldnext = holder->t_heldlocks;
+			holder->t_heldlocks = lock;
+		}
+		curthread->t_lockwaitnext = lock->lk_waiters;
+		lock->lk_waiters = curthread;
+		curthread->t_blockedon = lock;
+	}
+	KASSERT(curthread->t_blockedon == lock);
+	pi_boost(holder, curthread->t_pri);
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * Called on getting LOCK when it has waiters (possibly only us).
+ */
+static
+void
+pi_acquired(struct lock *lock)
+{
+	struct thread **wp;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&pi_lock);
+	if (curthread->t_blockedon == lock) {
+		for (wp = &lock->lk_waiters; *wp != curthread;
+		     wp = &(*wp)->t_lockwaitnext) {
+			KASSERT(*wp != NULL);
+		}
+		*wp = curthread->t_lockwaitnext;
+		curthread->t_lockwaitnext = NULL;
+		curthread->t_blockedon = NULL;
+	}
+	lock->lk_holder = curthread;
+	if (lock->lk_waiters != NULL) {
+		lock->lk_heldnext = curthread->t_heldlocks;
+		curthread->t_heldlocks = lock;
+	}
+	pi_recompute(curthread);
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * Called on releasing LOCK when it has waiters. Gives back whatever
+ * priority they lent us. If the waiters don't all have the same
+ * priority, returns the most important one that is still asleep, so
+ * it alone can be woken to take the lock next; otherwise returns
+ * NULL and the usual first-come order applies.
+ */
+static
+struct thread *
+pi_released(struct lock *lock)
+{
+	struct lock **lkp;
+	struct thread *w, *best;
+	bool mixed;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&pi_lock);
+	for (lkp = &curthread->t_heldlocks; *lkp != lock;
+	     lkp = &(*lkp)->lk_heldnext) {
+		KASSERT(*lkp != NULL);
+	}
+	*lkp = lock->lk_heldnext;
+	lock->lk_heldnext = NULL;
+	lock->lk_holder = NULL;
+	pi_recompute(curthread);
+
+	/*
+	 * Every waiter is either on lk_wchan or has been woken and
+	 * just hasn't got back here yet. thread_switch marks a
+	 * sleeper S_SLEEP before it lets go of lk_lock, so while we
+	 * hold lk_lock the ones on lk_wchan are exactly the S_SLEEP
+	 * ones, and they stay there. Waiters are pushed on the
+	 * front, so on a tie the one furthest back has waited
+	 * longest.
+	 */
+	mixed = false;
+	best = NULL;
+	for (w = lock->lk_waiters; w != NULL; w = w->t_lockwaitnext) {
+		if (w->t_pri != lock->lk_waiters->t_pri) {
+			mixed = true;
+		}
+		if (w->t_state == S_SLEEP &&
+		    (best == NULL || w->t_pri >= best->t_pri)) {
+			best = w;
+		}
+	}
+	spinlock_release(&pi_lock);
+
+	return mixed ? best : NULL;
+}
+
+void
+thread_setpriority(int pri)
+{
+	int oldpri;
+
+	KASSERT(pri >= PRI_MIN && pri <= PRI_MAX);
+
+	spinlock_acquire(&pi_lock);
+	oldpri = curthread->t_pri;
+	curthread->t_basepri = pri;
+	pi_recompute(curthread);
+	spinlock_release(&pi_lock);
+
+	if (curthread->t_pri < oldpri) {
+		/* Let anyone more important run now. */
+		thread_yield();
+	}
+}
+
+/*
+ * Check if the holder of an adaptive lock is running on some other
+ * CPU, in which case it is worth spinning for a while. The lock's
+ * spinlock must be held, which keeps the holder from releasing the
+ * lock and thus from exiting and being destroyed under us.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+	struct thread *holder;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	holder = lock->lk_holder;
+	return holder != NULL && holder->t_state == S_RUN &&
+		holder->t_cpu != curcpu->c_self;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	struct thread *holder;
+	unsigned spins;
+	LOCKPROF_WAITER(waiter);
+
 	DEBUGASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
 
@@ -191,13 +443,39 @@ lock_acquire(struct lock *lock)
 
 	/* Call this (atomically) before waiting for a lock */
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	LOCKORDER_ACQUIRE(&curthread->t_lockorder, &lock->lk_order);
 
 	KASSERT(lock->lk_holder != curthread);
+	spins = lock->lk_adaptive ? LOCK_SPIN_MAX : 0;
 	while (lock->lk_holder != NULL) {
+		LOCKPROF_WAIT(&waiter);
+		if (spins > 0 && lock_holder_running(lock)) {
+			/*
+			 * Spin without the spinlock (so the holder can
+			 * release) until the holder changes or we run
+			 * out of patience. Only compare the holder
+			 * pointer here; it may not be dereferenced
+			 * without lk_lock.
+			 */
+			holder = lock->lk_holder;
+			spinlock_release(&lock->lk_lock);
+			while (spins > 0 && lock->lk_holder == holder) {
+				spins--;
+			}
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
 		/* As in the semaphore. */
+		pi_block(lock);
 		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
 	}
-	lock->lk_holder = curthread;
+	if (lock->lk_waiters != NULL) {
+		pi_acquired(lock);
+	}
+	else {
+		lock->lk_holder = curthread;
+	}
+	LOCKPROF_ACQUIRE(&lock->lk_prof, &waiter);
 
 	/* Call this (atomically) once the lock is acquired */
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
@@ -208,16 +486,28 @@ lock_acquire(struct lock *lock)
 void
 lock_release(struct lock *lock)
 {
+	struct thread *next;
+
 	DEBUGASSERT(lock != NULL);
 
 	spinlock_acquire(&lock->lk_lock);
 
 	KASSERT(lock->lk_holder == curthread);
-	lock->lk_holder = NULL;
-	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
+	LOCKPROF_RELEASE(&lock->lk_prof);
+	if (lock->lk_waiters == NULL) {
+		lock->lk_holder = NULL;
+		wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
+	}
+	else if ((next = pi_released(lock)) != NULL) {
+		wchan_wakethread(lock->lk_wchan, &lock->lk_lock, next);
+	}
+	else {
+		wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
+	}
 
 	/* Call this (atomically) when the lock is released */
 	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+	LOCKORDER_RELEASE(&curthread->t_lockorder, &lock->lk_order);
 
 	spinlock_release(&lock->lk_lock);
 }
@@ -307,11 +597,169 @@ cv_signal(struct cv *cv, struct lock *lock)
 	spinlock_release(&cv->cv_wchanlock);
 }
 
+/*
+ * Everyone woken by a broadcast goes straight to lock_acquire, and
+ * only one of them can get the lock; waking them all just means most
+ * wake up to go back to sleep on the lock. So instead move them onto
+ * the lock's wait channel, where lock_release hands them the lock
+ * one at a time. If the lock is free (the caller doesn't hold it)
+ * wake one, who will take it and pass it on when done.
+ *
+ * The order cv_wchanlock, then lk_lock, is the same as in cv_wait.
+ */
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	(void)lock;
 	spinlock_acquire(&cv->cv_wchanlock);
-	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
+	spinlock_acquire(&lock->lk_lock);
+	wchan_requeue(cv->cv_wchan, &cv->cv_wchanlock,
+		      lock->lk_wchan, &lock->lk_lock,
+		      lock->lk_holder != NULL ? 0 : 1);
+	spinlock_release(&lock->lk_lock);
 	spinlock_release(&cv->cv_wchanlock);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlk_name = kstrdup(name);
+	if (rw->rwlk_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	HANGMAN_LOCKABLEINIT(&rw->rwlk_hangman, rw->rwlk_name);
+	LOCKORDER_INIT(&rw->rwlk_order, rw->rwlk_name);
+
+	rw->rwlk_rwchan = wchan_create(rw->rwlk_name);
+	if (rw->rwlk_rwchan == NULL) {
+		kfree(rw->rwlk_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rwlk_wwchan = wchan_create(rw->rwlk_name);
+	if (rw->rwlk_wwchan == NULL) {
+		wchan_destroy(rw->rwlk_rwchan);
+		kfree(rw->rwlk_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rwlk_lock);
+	rw->rwlk_readers = 0;
+	rw->rwlk_wwaiting = 0;
+	rw->rwlk_writer = NULL;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	KASSERT(rw->rwlk_readers == 0);
+	KASSERT(rw->rwlk_writer == NULL);
+	KASSERT(rw->rwlk_wwaiting == 0);
+	spinlock_cleanup(&rw->rwlk_lock);
+	wchan_destroy(rw->rwlk_wwchan);
+	wchan_destroy(rw->rwlk_rwchan);
+
+	kfree(rw->rwlk_name);
+	kfree(rw);
+}
+
+void
+rw_rlock(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rwlk_lock);
+
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rwlk_hangman);
+	LOCKORDER_ACQUIRE(&curthread->t_lockorder, &rw->rwlk_order);
+
+	KASSERT(rw->rwlk_writer != curthread);
+	/* Stay out of the way of writers, including waiting ones. */
+	while (rw->rwlk_writer != NULL || rw->rwlk_wwaiting > 0) {
+		wchan_sleep(rw->rwlk_rwchan, &rw->rwlk_lock);
+	}
+	rw->rwlk_readers++;
+
+	/* Readers share the lock, so hangman can't record a holder. */
+	HANGMAN_ACQUIRE_SHARED(&curthread->t_hangman, &rw->rwlk_hangman);
+
+	spinlock_release(&rw->rwlk_lock);
+}
+
+void
+rw_wlock(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rwlk_lock);
+
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rwlk_hangman);
+	LOCKORDER_ACQUIRE(&curthread->t_lockorder, &rw->rwlk_order);
+
+	KASSERT(rw->rwlk_writer != curthread);
+	rw->rwlk_wwaiting++;
+	while (rw->rwlk_writer != NULL || rw->rwlk_readers > 0) {
+		wchan_sleep(rw->rwlk_wwchan, &rw->rwlk_lock);
+	}
+	rw->rwlk_wwaiting--;
+	rw->rwlk_writer = curthread;
+
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &rw->rwlk_hangman);
+
+	spinlock_release(&rw->rwlk_lock);
+}
+
+void
+rw_unlock(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rwlk_lock);
+
+	LOCKORDER_RELEASE(&curthread->t_lockorder, &rw->rwlk_order);
+	if (rw->rwlk_writer != NULL) {
+		KASSERT(rw->rwlk_writer == curthread);
+		KASSERT(rw->rwlk_readers == 0);
+		rw->rwlk_writer = NULL;
+		HANGMAN_RELEASE(&curthread->t_hangman, &rw->rwlk_hangman);
+
+		/*
+		 * Hand off to the next writer if there is one;
+		 * otherwise let all the readers in.
+		 */
+		if (rw->rwlk_wwaiting > 0) {
+			wchan_wakeone(rw->rwlk_wwchan, &rw->rwlk_lock);
+		}
+		else {
+			wchan_wakeall(rw->rwlk_rwchan, &rw->rwlk_lock);
+		}
+	}
+	else {
+		KASSERT(rw->rwlk_readers > 0);
+		rw->rwlk_readers--;
+		if (rw->rwlk_readers == 0 && rw->rwlk_wwaiting > 0) {
+			wchan_wakeone(rw->rwlk_wwchan, &rw->rwlk_lock);
+		}
+	}
+
+	spinlock_release(&rw->rwlk_lock);
+}
@@ -40,8 +40,10 @@
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
+#include <membar.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <clock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -53,8 +55,19 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include <pid.h>
+#include <workqueue.h>
+#include <rcu.h>
 
 
+/*
+ * Number of exited threads, with their stacks, that each CPU keeps
+ * for thread_fork to reuse instead of freeing them.
+ */
+#define THREAD_CACHE_MAX	16
+
+/* Turned off by thread_cache_enable(false), for benchmarking. */
+static volatile bool thread_cache_on = true;
+
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
@@ -72,6 +85,18 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Used by thread_setaffinity to get moved to another CPU. */
+static struct spinlock migrate_lock = SPINLOCK_INITIALIZER;
+static struct wchan *migrate_wchan;
+
+/*
+ * Run-queue waits cost two gettime calls per switch to time, so that
+ * is only done once someone has asked for the statistics, and only
+ * after the clock is up.
+ */
+static bool schedstat_clockok;
+static volatile bool schedstat_on;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -111,6 +136,45 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Initialize (or reinitialize, for a thread coming out of the thread
+ * cache) everything in a thread structure except the name and stack.
+ */
+static
+void
+thread_reset(struct thread *thread)
+{
+	thread->t_wchan_name = "NEW";
+	thread->t_state = S_READY;
+
+	/* Thread subsystem fields */
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_wakenext = NULL;
+	thread->t_wchan_excl = false;
+	thread->t_context = NULL;
+	thread->t_cpu = NULL;
+	thread->t_proc = NULL;
+	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
+	LOCKORDER_HELDINIT(&thread->t_lockorder);
+	thread->t_basepri = PRI_DEFAULT;
+	thread->t_pri = PRI_DEFAULT;
+	thread->t_blockedon = NULL;
+	thread->t_heldlocks = NULL;
+	thread->t_lockwaitnext = NULL;
+	thread->t_affinity = AFFINITY_ALL;
+	thread->t_ustack = 0;
+	thread->t_readytime.tv_sec = 0;
+	thread->t_readytime.tv_nsec = 0;
+
+	/* Interrupt state fields */
+	thread->t_in_interrupt = false;
+	thread->t_curspl = IPL_HIGH;
+	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+
+	/* If you add to struct thread, be sure to initialize here */
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -133,24 +197,8 @@ thread_create(const char *name)
 		kfree(thread);
 		return NULL;
 	}
-	thread->t_wchan_name = "NEW";
-	thread->t_state = S_READY;
-
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
 	thread->t_stack = NULL;
-	thread->t_context = NULL;
-	thread->t_cpu = NULL;
-	thread->t_proc = NULL;
-	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
-
-	/* Interrupt state fields */
-	thread->t_in_interrupt = false;
-	thread->t_curspl = IPL_HIGH;
-	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
-
-	/* If you add to struct thread, be sure to initialize here */
+	thread_reset(thread);
 
 	return thread;
 }
@@ -180,12 +228,24 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	/* before INIT_CURCPU, when spinlocks start using it */
+	LOCKORDER_HELDINIT(&c->c_lockorder);
+	c->c_workqueue = NULL;
+	c->c_rcudepth = 0;
+
+	c->c_rcuactive = false;
+	c->c_rcuswitches = 0;
+
+	spinlock_data_set(&c->c_wakeq, 0);
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	/* Every cpu pokes at every run queue, so keep it fair. */
+	spinlock_init_ticket(&c->c_runqueue_lock);
+	bzero(&c->c_schedstats, sizeof(c->c_schedstats));
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -277,6 +337,8 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
+	KASSERT(thread->t_blockedon == NULL);
+	KASSERT(thread->t_heldlocks == NULL);
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
@@ -290,9 +352,109 @@ thread_destroy(struct thread *thread)
 	kfree(thread);
 }
 
+/*
+ * Put a zombie in this CPU's thread cache, if there's room, so
+ * thread_fork can reuse the structure and its stack. Returns false
+ * if the caller should destroy it instead. The boot threads have no
+ * stack of their own and never get cached.
+ *
+ * The cache is only touched by its own CPU with interrupts off, so
+ * it needs no lock.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	KASSERT(curthread->t_curspl > 0);
+
+	if (!thread_cache_on || thread->t_stack == NULL ||
+	    curcpu->c_threadcache.tl_count >= THREAD_CACHE_MAX) {
+		return false;
+	}
+
+	/* Same checks as thread_destroy. */
+	KASSERT(thread->t_proc == NULL);
+	KASSERT(thread->t_blockedon == NULL);
+	KASSERT(thread->t_heldlocks == NULL);
+	thread_machdep_cleanup(&thread->t_machdep);
+
+	/* Nobody else will check the guard band on this stack; do it now. */
+	thread_checkstack(thread);
+
+	/* Reuse the most recently exited first; its stack is warmest. */
+	threadlist_addhead(&curcpu->c_threadcache, thread);
+	return true;
+}
+
+/*
+ * Get a thread from this CPU's thread cache and set it up to be
+ * called NAME. Returns NULL if the cache is empty.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	char *newname;
+	int spl;
+
+	if (!thread_cache_on) {
+		return NULL;
+	}
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	if (thread == NULL) {
+		return NULL;
+	}
+	KASSERT(thread->t_state == S_ZOMBIE);
+
+	/* Keep the old name buffer if the new name fits in it. */
+	if (strlen(name) <= strlen(thread->t_name)) {
+		strcpy(thread->t_name, name);
+	}
+	else {
+		newname = kstrdup(name);
+		if (newname == NULL) {
+			/*
+			 * thread_cache_put already cleaned up the
+			 * machdep part, so thread_destroy would do it
+			 * twice. Put it back instead, possibly in
+			 * another CPU's cache; that doesn't matter.
+			 */
+			spl = splhigh();
+			threadlist_addhead(&curcpu->c_threadcache, thread);
+			splx(spl);
+			return NULL;
+		}
+		kfree(thread->t_name);
+		thread->t_name = newname;
+	}
+	thread_reset(thread);
+
+	/* The stack was just checked in thread_cache_put; re-arm it. */
+	thread_checkstack_init(thread);
+
+	return thread;
+}
+
+/*
+ * Turn the thread cache on or off. While it is off, exited threads
+ * are freed and new ones allocated as if there were no cache; what
+ * is already cached just stays there. For benchmarks.
+ */
+void
+thread_cache_enable(bool on)
+{
+	thread_cache_on = on;
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to have thread_destroy called on them.) As many as will fit
+ * go into the thread cache instead.
  *
  * The list of zombies is per-cpu.
  */
@@ -305,7 +467,9 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (!thread_cache_put(z)) {
+			thread_destroy(z);
+		}
 	}
 }
 
@@ -394,6 +558,14 @@ thread_bootstrap(void)
 	KASSERT(curthread->t_proc != NULL);
 	KASSERT(curthread->t_proc == kproc);
 
+	/* The boot cpu is running, so it counts for RCU. */
+	curcpu->c_rcuactive = true;
+
+	migrate_wchan = wchan_create("migrate");
+	if (migrate_wchan == NULL) {
+		panic("thread_bootstrap: wchan_create failed\n");
+	}
+
 	/* Done */
 }
 
@@ -414,11 +586,17 @@ cpu_hatch(unsigned software_number)
 	KASSERT(curthread != NULL);
 	KASSERT(curcpu->c_number == software_number);
 
+	/* From now on rcu_synchronize must wait for us. */
+	curcpu->c_rcuactive = true;
+	membar_any_any();
+
 	spl0();
 	cpu_identify(buf, sizeof(buf));
 
 	kprintf("cpu%u: %s\n", software_number, buf);
 
+	workqueue_start();
+
 	V(cpu_startup_sem);
 	thread_exit();
 }
@@ -435,6 +613,8 @@ thread_start_cpus(void)
 	cpu_identify(buf, sizeof(buf));
 	kprintf("cpu0: %s\n", buf);
 
+	workqueue_start();
+
 	cpu_startup_sem = sem_create("cpu_hatch", 0);
 	mainbus_start_cpus();
 
@@ -445,10 +625,127 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Check if thread T's affinity allows it to run on cpu C.
+ */
+static
+bool
+thread_cpu_allowed(struct thread *t, struct cpu *c)
+{
+	return (t->t_affinity & AFFINITY_CPU(c->c_number)) != 0;
+}
+
+/*
+ * Choose a cpu for T: of the ones it's allowed on, the one with the
+ * shortest run queue. The counts are read without locking, so this
+ * is only a hint, but that's all it needs to be.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
+
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!thread_cpu_allowed(t, c)) {
+			continue;
+		}
+		if (best == NULL ||
+		    c->c_runqueue.tl_count < best->c_runqueue.tl_count) {
+			best = c;
+		}
+	}
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Hand TARGET to TARGETCPU, another cpu, to run. Instead of taking
+ * that cpu's run queue lock, which every cpu waking threads there
+ * would fight over, push the thread on the cpu's wakeup queue. The
+ * cpu moves it to the run queue the next time it goes through
+ * thread_switch; at the latest that's its next clock tick. If it's
+ * idle, it needs an IPI, but only the wakeup that finds the queue
+ * empty sends one: the rest of a burst ride along on it.
+ */
+static
+void
+thread_wakeq_push(struct cpu *targetcpu, struct thread *target)
+{
+	spinlock_data_t old;
+
+	target->t_state = S_READY;
+	if (schedstat_on) {
+		gettime(&target->t_readytime);
+	}
+
+	do {
+		old = spinlock_data_get(&targetcpu->c_wakeq);
+		target->t_wakenext = (struct thread *)(uintptr_t)old;
+		membar_store_store();
+	} while (spinlock_data_compareswap(&targetcpu->c_wakeq, old,
+					   (uintptr_t)target) != old);
+
+	/*
+	 * Pairs with the barrier in thread_switch between setting
+	 * c_isidle and the last look at the queue before idling:
+	 * either it sees our thread or we see it idle.
+	 */
+	membar_any_any();
+	if (old == 0 && targetcpu->c_isidle) {
+		ipi_send(targetcpu, IPI_UNIDLE);
+	}
+}
+
+/*
+ * Move everything on C's wakeup queue to its run queue, in the order
+ * the wakeups happened.
+ */
+static
+void
+thread_wakeq_drain(struct cpu *c)
+{
+	spinlock_data_t head;
+	struct thread *t, *next, *list;
+
+	KASSERT(c == curcpu->c_self);
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	do {
+		head = spinlock_data_get(&c->c_wakeq);
+		if (head == 0) {
+			return;
+		}
+	} while (spinlock_data_compareswap(&c->c_wakeq, head, 0) != head);
+	membar_load_load();
+
+	/* It's a stack; turn it around. */
+	list = NULL;
+	for (t = (struct thread *)(uintptr_t)head; t != NULL; t = next) {
+		next = t->t_wakenext;
+		t->t_wakenext = list;
+		list = t;
+	}
+
+	for (t = list; t != NULL; t = next) {
+		next = t->t_wakenext;
+		t->t_wakenext = NULL;
+		KASSERT(t->t_cpu == c);
+		KASSERT(t->t_state == S_READY);
+		threadlist_addtail(&c->c_runqueue, t);
+		c->c_schedstats.ss_remotewakes++;
+	}
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * targetcpu might be curcpu; it might not be, too. If not, the thread
+ * goes through targetcpu's wakeup queue.
  */
 static
 void
@@ -456,9 +753,30 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
 
-	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
 
+	if (!already_have_lock && !thread_cpu_allowed(target, targetcpu)) {
+		/*
+		 * The thread changed its affinity and went to sleep to
+		 * be moved (see thread_setaffinity). Pick a new cpu.
+		 * But first wait for the old cpu's run queue lock: if
+		 * the thread is still in thread_switch over there it
+		 * holds that lock until it has switched out, and it
+		 * mustn't start up elsewhere before then.
+		 */
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		spinlock_release(&targetcpu->c_runqueue_lock);
+		targetcpu = thread_pickcpu(target);
+		target->t_cpu = targetcpu;
+	}
+
+	if (!already_have_lock && targetcpu != curcpu->c_self) {
+		thread_wakeq_push(targetcpu, target);
+		return;
+	}
+
+	/* Lock the run queue of the target thread's cpu. */
+
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
@@ -469,15 +787,10 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
-
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
+	if (schedstat_on) {
+		gettime(&target->t_readytime);
 	}
+	threadlist_addtail(&targetcpu->c_runqueue, target);
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -503,18 +816,22 @@ thread_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	/* Recycle an exited thread and its stack if we can. */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -522,6 +839,9 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_basepri = curthread->t_basepri;
+	newthread->t_pri = curthread->t_basepri;
+	newthread->t_affinity = curthread->t_affinity;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -550,11 +870,106 @@ thread_fork(const char *name,
 	return 0;
 }
 
+/*
+ * Take the thread to run next off a CPU's run queue: the first one
+ * with the highest effective priority, so that threads of the same
+ * priority still go round-robin. Returns NULL if the queue is empty.
+ *
+ * The run queue is short enough in practice that a linear scan is
+ * cheaper than keeping it sorted, particularly since priority
+ * inheritance can change t_pri of a queued thread at any time.
+ */
+static
+struct thread *
+thread_pickrunnable(struct cpu *c)
+{
+	struct thread *t, *best;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	best = NULL;
+	THREADLIST_FORALL(t, c->c_runqueue) {
+		if (best == NULL || t->t_pri > best->t_pri) {
+			best = t;
+		}
+	}
+	if (best != NULL) {
+		threadlist_remove(&c->c_runqueue, best);
+	}
+	return best;
+}
+
+/*
+ * Update scheduler statistics when NEXT has been picked to run on C
+ * after CUR. PREEMPTED is true if CUR is giving up the cpu because
+ * of a timer interrupt.
+ */
+static
+void
+thread_schedstat_pick(struct cpu *c, struct thread *cur, struct thread *next,
+		      bool preempted)
+{
+	struct schedstats *ss = &c->c_schedstats;
+	struct timespec now;
+	uint64_t ns, us;
+	unsigned bucket;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (next != cur) {
+		ss->ss_switches++;
+		if (preempted) {
+			ss->ss_involuntary++;
+		}
+		else {
+			ss->ss_voluntary++;
+		}
+		ss->ss_rqlensum += c->c_runqueue.tl_count;
+		if (c->c_runqueue.tl_count > ss->ss_rqlenmax) {
+			ss->ss_rqlenmax = c->c_runqueue.tl_count;
+		}
+	}
+
+	/*
+	 * Not stamped if it went on the run queue while timing was
+	 * off. If timing was turned off since, drop the stamp, or it
+	 * would be counted as one long wait if turned on again.
+	 */
+	if (next->t_readytime.tv_sec == 0) {
+		return;
+	}
+	if (!schedstat_on) {
+		next->t_readytime.tv_sec = 0;
+		next->t_readytime.tv_nsec = 0;
+		return;
+	}
+
+	gettime(&now);
+	timespec_sub(&now, &next->t_readytime, &now);
+	next->t_readytime.tv_sec = 0;
+	next->t_readytime.tv_nsec = 0;
+	ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+	ss->ss_waits++;
+	ss->ss_waitns += ns;
+	if (ns > ss->ss_maxwaitns) {
+		ss->ss_maxwaitns = ns;
+	}
+
+	us = ns / 1000;
+	bucket = 0;
+	while (us > 0 && bucket < SCHEDSTAT_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	ss->ss_waithist[bucket]++;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
  * The current thread is queued appropriately and its state is changed
- * to NEWSTATE; another thread to run is selected and switched to.
+ * to NEWSTATE (thread_make_runnable does that for S_READY); another thread to run is selected and switched to.
  *
  * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
  * WC, protected by the spinlock LK. Otherwise WC and Lk should be
@@ -565,6 +980,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *cur, *next;
+	bool preempted;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -573,7 +989,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Explicitly disable interrupts on this processor */
 	spl = splhigh();
 
+	/* Can't switch inside an RCU read section; count the trip. */
+	KASSERT(curcpu->c_rcudepth == 0);
+	curcpu->c_rcuswitches++;
+
 	cur = curthread;
+	preempted = newstate == S_READY && cur->t_in_interrupt;
 
 	/*
 	 * If we're idle, return without doing anything. This happens
@@ -587,8 +1008,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
-	/* Lock the run queue. */
+	/* Lock the run queue, and pick up wakeups from other cpus. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	thread_wakeq_drain(curcpu->c_self);
 
 	/* Micro-optimization: if nothing to do, just return */
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
@@ -613,16 +1035,23 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		 * associated spinlock locked from the point the
 		 * caller of wchan_sleep locked it until the thread is
 		 * on the list.
+		 *
+		 * Set the state before unlocking, too. A waker on
+		 * another cpu doesn't take our run queue lock (see
+		 * thread_wakeq_push) and marks the thread S_READY as
+		 * soon as it can get at the list, and pi_released
+		 * looks at the states of the threads on the list.
 		 */
 		threadlist_addtail(&wc->wc_threads, cur);
+		cur->t_state = S_SLEEP;
 		spinlock_release(lk);
 		break;
 	    case S_ZOMBIE:
 		cur->t_wchan_name = "ZOMBIE";
 		threadlist_addtail(&curcpu->c_zombies, cur);
+		cur->t_state = S_ZOMBIE;
 		break;
 	}
-	cur->t_state = newstate;
 
 	/*
 	 * Get the next thread. While there isn't one, call cpu_idle().
@@ -643,8 +1072,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	membar_any_any();
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		thread_wakeq_drain(curcpu->c_self);
+		next = thread_pickrunnable(curcpu->c_self);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
 			cpu_idle();
@@ -653,6 +1084,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	thread_schedstat_pick(curcpu->c_self, cur, next, preempted);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -893,7 +1326,16 @@ thread_consider_migration(void)
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
 		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
+			/* Take the first victim allowed to run there. */
+			THREADLIST_FORALL(t, victims) {
+				if (thread_cpu_allowed(t, c)) {
+					break;
+				}
+			}
+			if (t == NULL) {
+				break;
+			}
+			threadlist_remove(&victims, t);
 			/*
 			 * Ordinarily, curthread will not appear on
 			 * the run queue. However, it can under the
@@ -956,6 +1398,119 @@ thread_consider_migration(void)
 	threadlist_cleanup(&victims);
 }
 
+/*
+ * Return the total number of context switches done by all CPUs.
+ *
+ * The per-cpu counters are read without locking, so this is only
+ * approximate while other CPUs are running; that's good enough for
+ * statistics.
+ */
+unsigned
+thread_count_switches(void)
+{
+	unsigned i, total;
+
+	total = 0;
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		total += cpuarray_get(&allcpus, i)->c_schedstats.ss_switches;
+	}
+	return total;
+}
+
+unsigned
+thread_count_cpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Allow timing run-queue waits. gettime() doesn't work until the
+ * clock has attached, so this is called from boot() after the
+ * device probe.
+ */
+void
+thread_schedstat_bootstrap(void)
+{
+	schedstat_clockok = true;
+}
+
+/*
+ * Start or stop timing run-queue waits. Fetching the statistics
+ * starts it, so this is only needed to stop.
+ */
+void
+thread_schedstat_timewaits(bool on)
+{
+	schedstat_on = on && schedstat_clockok;
+}
+
+/*
+ * Fetch scheduler statistics for one CPU, or the totals over all of
+ * them.
+ */
+int
+thread_schedstat_get(int cpunum, struct schedstats *ret)
+{
+	struct cpu *c;
+	unsigned i, j, num;
+
+	num = cpuarray_num(&allcpus);
+	if (cpunum != SCHEDSTAT_ALLCPUS &&
+	    (cpunum < 0 || (unsigned)cpunum >= num)) {
+		return EINVAL;
+	}
+
+	/* Someone's looking; start timing waits if we weren't. */
+	if (!schedstat_on) {
+		thread_schedstat_timewaits(true);
+	}
+
+	bzero(ret, sizeof(*ret));
+	for (i=0; i<num; i++) {
+		if (cpunum != SCHEDSTAT_ALLCPUS && (unsigned)cpunum != i) {
+			continue;
+		}
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		ret->ss_switches += c->c_schedstats.ss_switches;
+		ret->ss_voluntary += c->c_schedstats.ss_voluntary;
+		ret->ss_involuntary += c->c_schedstats.ss_involuntary;
+		ret->ss_waits += c->c_schedstats.ss_waits;
+		ret->ss_waitns += c->c_schedstats.ss_waitns;
+		if (c->c_schedstats.ss_maxwaitns > ret->ss_maxwaitns) {
+			ret->ss_maxwaitns = c->c_schedstats.ss_maxwaitns;
+		}
+		ret->ss_rqlensum += c->c_schedstats.ss_rqlensum;
+		ret->ss_remotewakes += c->c_schedstats.ss_remotewakes;
+		ret->ss_ipis += c->c_schedstats.ss_ipis;
+		if (c->c_schedstats.ss_rqlenmax > ret->ss_rqlenmax) {
+			ret->ss_rqlenmax = c->c_schedstats.ss_rqlenmax;
+		}
+		for (j=0; j<SCHEDSTAT_BUCKETS; j++) {
+			ret->ss_waithist[j] += c->c_schedstats.ss_waithist[j];
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+	return 0;
+}
+
+/*
+ * Zero the scheduler statistics on all CPUs.
+ */
+void
+thread_schedstat_reset(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		bzero(&c->c_schedstats, sizeof(c->c_schedstats));
+		spinlock_release(&c->c_runqueue_lock);
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -1015,6 +1570,7 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	/* must not hold other spinlocks */
 	KASSERT(curcpu->c_spinlocks == 1);
 
+	curthread->t_wchan_excl = false;
 	thread_switch(S_SLEEP, wc, lk);
 	spinlock_acquire(lk);
 }
@@ -1024,50 +1580,92 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
  */
 void
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
+{
+	wchan_wakeN(wc, lk, 1);
+}
+
+/*
+ * Wake up the first N threads sleeping on a wait channel, exclusive
+ * or not, and return how many there were.
+ */
+unsigned
+wchan_wakeN(struct wchan *wc, struct spinlock *lk, unsigned n)
 {
 	struct thread *target;
+	unsigned woken;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
-	/* Grab a thread from the channel */
-	target = threadlist_remhead(&wc->wc_threads);
+	for (woken = 0; woken < n; woken++) {
+		/* Grab a thread from the channel */
+		target = threadlist_remhead(&wc->wc_threads);
+		if (target == NULL) {
+			/* Nobody (else) was sleeping. */
+			break;
+		}
 
-	if (target == NULL) {
-		/* Nobody was sleeping. */
-		return;
+		/*
+		 * Note that thread_make_runnable acquires a runqueue
+		 * lock while we're holding LK. This is ok; all
+		 * spinlocks associated with wchans must come before
+		 * the runqueue locks, as we also bridge from the wchan
+		 * lock to the runqueue lock in thread_switch.
+		 */
+		thread_make_runnable(target, false);
 	}
+	return woken;
+}
 
-	/*
-	 * Note that thread_make_runnable acquires a runqueue lock
-	 * while we're holding LK. This is ok; all spinlocks
-	 * associated with wchans must come before the runqueue locks,
-	 * as we also bridge from the wchan lock to the runqueue lock
-	 * in thread_switch.
-	 */
+/*
+ * Wake up one particular thread, which must be sleeping on the wait
+ * channel.
+ */
+void
+wchan_wakethread(struct wchan *wc, struct spinlock *lk, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(t->t_state == S_SLEEP);
 
-	thread_make_runnable(target, false);
+	threadlist_remove(&wc->wc_threads, t);
+	thread_make_runnable(t, false);
 }
 
 /*
- * Wake up all threads sleeping on a wait channel.
+ * Wake up all threads sleeping on a wait channel, except that only
+ * the first exclusive sleeper is woken; the others stay where they
+ * are, in order.
  */
 void
 wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *target;
-	struct threadlist list;
+	struct threadlist list, keep;
+	bool gotexcl;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
 	threadlist_init(&list);
+	threadlist_init(&keep);
 
 	/*
 	 * Grab all the threads from the channel, moving them to a
-	 * private list.
+	 * private list, and set aside the exclusive sleepers after
+	 * the first.
 	 */
+	gotexcl = false;
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		if (target->t_wchan_excl && gotexcl) {
+			threadlist_addtail(&keep, target);
+			continue;
+		}
+		if (target->t_wchan_excl) {
+			gotexcl = true;
+		}
 		threadlist_addtail(&list, target);
 	}
+	while ((target = threadlist_remhead(&keep)) != NULL) {
+		threadlist_addtail(&wc->wc_threads, target);
+	}
 
 	/*
 	 * We could conceivably sort by cpu first to cause fewer lock
@@ -1078,9 +1676,37 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 		thread_make_runnable(target, false);
 	}
 
+	threadlist_cleanup(&keep);
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Wake up the first NWAKE threads sleeping on FROM and move the rest,
+ * as exclusive sleepers, onto the end of TO. Both spinlocks must be
+ * held, FROMLK first.
+ *
+ * The moved threads still return from wchan_sleep as if woken from
+ * FROM, relocking FROMLK; they just get woken later, by whoever
+ * wakes TO.
+ */
+void
+wchan_requeue(struct wchan *from, struct spinlock *fromlk,
+	      struct wchan *to, struct spinlock *tolk, unsigned nwake)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+	KASSERT(from != to);
+
+	wchan_wakeN(from, fromlk, nwake);
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		target->t_wchan_excl = true;
+		threadlist_addtail(&to->wc_threads, target);
+	}
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1098,6 +1724,71 @@ wchan_isempty(struct wchan *wc, struct spinlock *lk)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * RCU (see rcu.h)
+ */
+
+/*
+ * Enter a read section. These nest.
+ */
+void
+rcu_read_lock(void)
+{
+	KASSERT(!curthread->t_in_interrupt);
+
+	splraise(IPL_NONE, IPL_HIGH);
+	curcpu->c_rcudepth++;
+}
+
+/*
+ * Leave a read section.
+ */
+void
+rcu_read_unlock(void)
+{
+	KASSERT(curcpu->c_rcudepth > 0);
+
+	curcpu->c_rcudepth--;
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+/*
+ * Wait for a grace period: until every read section that was open
+ * when we were called has been closed.
+ *
+ * Read sections don't switch, so it's enough to see every other
+ * running cpu go through thread_switch once, or be idle. That takes
+ * at most a clock tick, as hardclock always yields. We check the
+ * cpus one at a time, since by the time we're done waiting for one
+ * the rest have usually gone by too. Our own cpu isn't in a read
+ * section, because we are running on it.
+ */
+void
+rcu_synchronize(void)
+{
+	struct cpu *c;
+	unsigned i, seen;
+
+	KASSERT(curcpu->c_rcudepth == 0);
+	KASSERT(!curthread->t_in_interrupt);
+
+	/* Make sure the new version is out before we start looking. */
+	membar_any_any();
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || !c->c_rcuactive) {
+			continue;
+		}
+		seen = c->c_rcuswitches;
+		while (c->c_rcuswitches == seen && !c->c_isidle) {
+			thread_yield();
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Machine-independent IPI handling
  */
@@ -1199,8 +1890,12 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_UNIDLE)) {
 		/*
 		 * The cpu has already unidled itself to take the
-		 * interrupt; don't need to do anything else.
+		 * interrupt; don't need to do anything else but count
+		 * it. Only this cpu writes ss_ipis, and it does so
+		 * here at splhigh, so it doesn't need the run queue
+		 * lock; readers may just be one behind.
 		 */
+		curcpu->c_schedstats.ss_ipis++;
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
@@ -1217,3 +1912,66 @@ interprocessor_interrupt(void)
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
 }
+
+/*
+ * CPU affinity.
+ *
+ * A thread can't put itself on another cpu's run queue while it's
+ * still running here, so to move, thread_setaffinity has this cpu's
+ * worker thread (see workqueue.c; it is pinned here) wake it up from
+ * a sleep, and thread_make_runnable picks an allowed cpu.
+ */
+
+struct migration {
+	struct work m_work;
+	volatile bool m_done;
+};
+
+static
+void
+thread_migrate_wake(void *arg)
+{
+	struct migration *m = arg;
+
+	spinlock_acquire(&migrate_lock);
+	m->m_done = true;
+	wchan_wakeall(migrate_wchan, &migrate_lock);
+	spinlock_release(&migrate_lock);
+}
+
+int
+thread_setaffinity(uint32_t mask)
+{
+	struct migration m;
+	unsigned numcpus;
+	uint32_t valid;
+
+	numcpus = cpuarray_num(&allcpus);
+	valid = numcpus >= 32 ? AFFINITY_ALL : AFFINITY_CPU(numcpus) - 1;
+	if ((mask & valid) == 0) {
+		return EINVAL;
+	}
+
+	curthread->t_affinity = mask;
+	if (thread_cpu_allowed(curthread, curcpu)) {
+		return 0;
+	}
+
+	m.m_done = false;
+	work_init(&m.m_work, thread_migrate_wake, &m);
+	spinlock_acquire(&migrate_lock);
+	workqueue_enqueue(&m.m_work);
+	while (!m.m_done) {
+		wchan_sleep(migrate_wchan, &migrate_lock);
+	}
+	spinlock_release(&migrate_lock);
+
+	KASSERT(thread_cpu_allowed(curthread, curcpu));
+	return 0;
+}
+
+uint32_t
+thread_getaffinity(void)
+{
+	return curthread->t_affinity;
+}
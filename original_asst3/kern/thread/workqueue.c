@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Workqueues. See workqueue.h.
+ *
+ * Each CPU's queue has a FIFO of pending items, an unordered list of
+ * delayed items that hardclock counts down, and one worker thread,
+ * which is pinned to its CPU.
+ *
+ * A work item is bound to a queue (the current CPU's) the first time
+ * it is queued and stays with that queue afterwards. Its state is
+ * then always protected by that queue's lock, so no item ever has to
+ * be moved between two queues while holding both locks. Subsystems
+ * normally have one item per object or per CPU, so this costs little
+ * in practice.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+
+struct workqueue {
+	struct spinlock wq_lock;
+	struct wchan *wq_wchan;		/* Worker sleeps here */
+	struct wchan *wq_donechan;	/* Flush/cancel sleep here */
+	struct work *wq_head;		/* Pending items, in order */
+	struct work *wq_tail;
+	struct work *wq_delayed;	/* Delayed items */
+	struct work *wq_running;	/* Item being run, if any */
+	struct thread *wq_worker;	/* The worker thread */
+	unsigned wq_seq;		/* Last sequence number handed out */
+	unsigned wq_runseq;		/* Sequence number of wq_running */
+	struct workqueue *wq_next;	/* Next on wq_all */
+};
+
+/*
+ * All the queues, for workqueue_flush. Queues are only ever added,
+ * at the head, so once the head has been read the rest of the list
+ * can be walked without the lock. The lock also serializes binding
+ * an item to its queue.
+ */
+static struct spinlock wq_listlock = SPINLOCK_INITIALIZER;
+static struct workqueue *wq_all;
+
+////////////////////////////////////////////////////////////
+// internals
+
+/*
+ * Put W on the end of WQ's pending list and kick the worker.
+ */
+static
+void
+workqueue_append(struct workqueue *wq, struct work *w)
+{
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+
+	w->w_next = NULL;
+	w->w_state = WORK_PENDING;
+	if (wq->wq_tail == NULL) {
+		wq->wq_head = w;
+	}
+	else {
+		wq->wq_tail->w_next = w;
+	}
+	wq->wq_tail = w;
+	w->w_seq = ++wq->wq_seq;
+	wchan_wakeone(wq->wq_wchan, &wq->wq_lock);
+}
+
+/*
+ * Unlink W from the singly-linked list at *LISTP. Returns the
+ * previous element (or NULL if it was first).
+ */
+static
+struct work *
+workqueue_unlink(struct work **listp, struct work *w)
+{
+	struct work *prev;
+
+	prev = NULL;
+	while (*listp != w) {
+		KASSERT(*listp != NULL);
+		prev = *listp;
+		listp = &(*listp)->w_next;
+	}
+	*listp = w->w_next;
+	w->w_next = NULL;
+	return prev;
+}
+
+/*
+ * Check if anything made pending on WQ at or before sequence number
+ * TARGET is still pending or running. The pending list is in
+ * sequence order (cancelling only takes items out of it), so only
+ * its head has to be looked at. Compare by difference, in case the
+ * numbers wrap.
+ */
+static
+bool
+workqueue_busy(struct workqueue *wq, unsigned target)
+{
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+
+	if (wq->wq_running != NULL && (int)(target - wq->wq_runseq) >= 0) {
+		return true;
+	}
+	return wq->wq_head != NULL && (int)(target - wq->wq_head->w_seq) >= 0;
+}
+
+/*
+ * Find the queue W belongs to, binding it to the current CPU's queue
+ * if this is the first time it's been used.
+ */
+static
+struct workqueue *
+workqueue_of(struct work *w)
+{
+	struct workqueue *wq;
+
+	wq = w->w_wq;
+	if (wq == NULL) {
+		spinlock_acquire(&wq_listlock);
+		if (w->w_wq == NULL) {
+			KASSERT(curcpu->c_workqueue != NULL);
+			w->w_wq = curcpu->c_workqueue;
+		}
+		wq = w->w_wq;
+		spinlock_release(&wq_listlock);
+	}
+	return wq;
+}
+
+/*
+ * The worker thread.
+ */
+static
+void
+workqueue_thread(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct work *w;
+	void (*func)(void *);
+	void *arg;
+
+	(void)data2;
+
+	spinlock_acquire(&wq->wq_lock);
+	wq->wq_worker = curthread;
+	while (1) {
+		w = wq->wq_head;
+		if (w == NULL) {
+			wchan_sleep(wq->wq_wchan, &wq->wq_lock);
+			continue;
+		}
+		wq->wq_head = w->w_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tail = NULL;
+		}
+		w->w_next = NULL;
+
+		/*
+		 * Mark it idle before running it, and don't touch it
+		 * afterwards: the function may requeue or free it.
+		 */
+		w->w_state = WORK_IDLE;
+		func = w->w_func;
+		arg = w->w_arg;
+		wq->wq_running = w;
+		wq->wq_runseq = w->w_seq;
+		spinlock_release(&wq->wq_lock);
+
+		func(arg);
+
+		spinlock_acquire(&wq->wq_lock);
+		wq->wq_running = NULL;
+		wchan_wakeall(wq->wq_donechan, &wq->wq_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// setup
+
+/*
+ * Create the current CPU's queue and worker.
+ */
+void
+workqueue_start(void)
+{
+	struct workqueue *wq;
+	char name[16];
+	uint32_t oldmask;
+	int result;
+
+	KASSERT(curcpu->c_workqueue == NULL);
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		panic("workqueue_start: Out of memory\n");
+	}
+	spinlock_init(&wq->wq_lock);
+	wq->wq_wchan = wchan_create("workqueue");
+	wq->wq_donechan = wchan_create("workqueue_done");
+	if (wq->wq_wchan == NULL || wq->wq_donechan == NULL) {
+		panic("workqueue_start: wchan_create failed\n");
+	}
+	wq->wq_head = wq->wq_tail = NULL;
+	wq->wq_delayed = NULL;
+	wq->wq_running = NULL;
+	wq->wq_worker = NULL;
+	wq->wq_seq = wq->wq_runseq = 0;
+
+	/* Pin ourselves here while forking, so the worker inherits it. */
+	oldmask = thread_getaffinity();
+	result = thread_setaffinity(AFFINITY_CPU(curcpu->c_number));
+	KASSERT(result == 0);
+
+	snprintf(name, sizeof(name), "worker/%u", curcpu->c_number);
+	result = thread_fork(name, NULL, workqueue_thread, wq, 0);
+	if (result) {
+		panic("workqueue_start: thread_fork: %s\n", strerror(result));
+	}
+
+	result = thread_setaffinity(oldmask);
+	KASSERT(result == 0);
+
+	spinlock_acquire(&wq_listlock);
+	wq->wq_next = wq_all;
+	wq_all = wq;
+	spinlock_release(&wq_listlock);
+
+	curcpu->c_workqueue = wq;
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+void
+work_init(struct work *w, void (*func)(void *arg), void *arg)
+{
+	w->w_func = func;
+	w->w_arg = arg;
+	w->w_next = NULL;
+	w->w_wq = NULL;
+	w->w_ticks = 0;
+	w->w_seq = 0;
+	w->w_state = WORK_IDLE;
+}
+
+bool
+workqueue_enqueue_delayed(struct work *w, unsigned ticks)
+{
+	struct workqueue *wq;
+	bool ret;
+
+	wq = workqueue_of(w);
+
+	spinlock_acquire(&wq->wq_lock);
+	if (w->w_state != WORK_IDLE) {
+		ret = false;
+	}
+	else if (ticks == 0) {
+		workqueue_append(wq, w);
+		ret = true;
+	}
+	else {
+		w->w_ticks = ticks;
+		w->w_state = WORK_DELAYED;
+		w->w_next = wq->wq_delayed;
+		wq->wq_delayed = w;
+		ret = true;
+	}
+	spinlock_release(&wq->wq_lock);
+
+	return ret;
+}
+
+bool
+workqueue_enqueue(struct work *w)
+{
+	return workqueue_enqueue_delayed(w, 0);
+}
+
+bool
+workqueue_cancel(struct work *w)
+{
+	struct workqueue *wq;
+	struct work *prev;
+	bool ret;
+
+	wq = w->w_wq;
+	if (wq == NULL) {
+		/* Never queued. */
+		return false;
+	}
+	KASSERT(curthread != wq->wq_worker);
+
+	spinlock_acquire(&wq->wq_lock);
+	switch (w->w_state) {
+	    case WORK_PENDING:
+		prev = workqueue_unlink(&wq->wq_head, w);
+		if (wq->wq_tail == w) {
+			wq->wq_tail = prev;
+		}
+		/* A flush may have been waiting for it. */
+		wchan_wakeall(wq->wq_donechan, &wq->wq_lock);
+		ret = true;
+		break;
+	    case WORK_DELAYED:
+		workqueue_unlink(&wq->wq_delayed, w);
+		ret = true;
+		break;
+	    default:
+		ret = false;
+		break;
+	}
+	w->w_state = WORK_IDLE;
+
+	while (wq->wq_running == w) {
+		wchan_sleep(wq->wq_donechan, &wq->wq_lock);
+	}
+	spinlock_release(&wq->wq_lock);
+
+	return ret;
+}
+
+void
+workqueue_flush(void)
+{
+	struct workqueue *wq;
+	unsigned target;
+
+	spinlock_acquire(&wq_listlock);
+	wq = wq_all;
+	spinlock_release(&wq_listlock);
+
+	for (; wq != NULL; wq = wq->wq_next) {
+		KASSERT(curthread != wq->wq_worker);
+
+		spinlock_acquire(&wq->wq_lock);
+		target = wq->wq_seq;
+		while (workqueue_busy(wq, target)) {
+			wchan_sleep(wq->wq_donechan, &wq->wq_lock);
+		}
+		spinlock_release(&wq->wq_lock);
+	}
+}
+
+/*
+ * Called from hardclock: count down this CPU's delayed items and
+ * make the ones that are due pending.
+ */
+void
+workqueue_tick(void)
+{
+	struct workqueue *wq;
+	struct work *w, *next, **wp;
+
+	wq = curcpu->c_workqueue;
+	if (wq == NULL || wq->wq_delayed == NULL) {
+		/* Not started yet, or nothing to do; skip the lock. */
+		return;
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	wp = &wq->wq_delayed;
+	for (w = *wp; w != NULL; w = next) {
+		next = w->w_next;
+		KASSERT(w->w_state == WORK_DELAYED);
+		if (--w->w_ticks > 0) {
+			wp = &w->w_next;
+			continue;
+		}
+		*wp = next;
+		workqueue_append(wq, w);
+	}
+	spinlock_release(&wq->wq_lock);
+}
@@ -41,6 +41,7 @@
 #include <uio.h>
 #include <synch.h>
 #include <vnode.h>
+#include <poll.h>
 #include <device.h>
 
 /*
@@ -225,6 +226,22 @@ dev_isseekable(struct vnode *v)
 	return true;
 }
 
+/*
+ * Called for poll(). Hand off to DEVOP_POLL if the device has one;
+ * otherwise it never blocks.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct poller *pl)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_ops->devop_poll == NULL) {
+		return poll_alwaysready(v, events, pl);
+	}
+	return DEVOP_POLL(d, events, pl);
+}
+
 /*
  * For fsync() - meaningless, do nothing.
  */
@@ -331,10 +348,12 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
 	.vop_write = dev_write,
+	.vop_append = vopfail_uio_inval,	/* eachopen rejects O_APPEND */
 	.vop_ioctl = dev_ioctl,
 	.vop_stat = dev_stat,
 	.vop_gettype = dev_gettype,
 	.vop_isseekable = dev_isseekable,
+	.vop_poll = dev_poll,
 	.vop_fsync = null_fsync,
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
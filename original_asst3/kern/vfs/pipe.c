@@ -0,0 +1,512 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Pipes.
+ *
+ * A pipe is a PIPE_SIZE ring buffer and two vnodes, one per end,
+ * that both point at it. Each end is reference-counted like any
+ * other vnode (open files, fork, and dup2 all just share it), so
+ * when an end's last reference goes away VOP_RECLAIM tells us that
+ * end is closed for good. The pipe itself goes away when both ends
+ * have been reclaimed.
+ *
+ * Data moves with uiomove straight between the ring and the user
+ * buffer of whoever is reading or writing; there's no other copy.
+ * (A writer can't copy straight into a sleeping reader's buffer,
+ * because that buffer is in the reader's address space, not ours.)
+ * To keep the reader busy while a big write is still coming in, the
+ * writer puts in as much as fits and wakes the readers right away
+ * rather than when its whole write is done.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vm.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+#define PIPE_SIZE	PAGE_SIZE
+
+struct pipe {
+	struct vnode pp_readvn;		/* read end */
+	struct vnode pp_writevn;	/* write end */
+
+	struct lock *pp_lock;		/* protects everything below */
+	struct cv *pp_readcv;		/* readers wait here for data */
+	struct cv *pp_writecv;		/* writers wait here for room */
+	struct pollqueue pp_pollq;	/* poll() waits here for either */
+	char *pp_buf;			/* PIPE_SIZE bytes of ring */
+	unsigned pp_start;		/* offset of first byte in pp_buf */
+	unsigned pp_count;		/* number of bytes in pp_buf */
+	bool pp_readopen;		/* read end not reclaimed yet */
+	bool pp_writeopen;		/* write end not reclaimed yet */
+};
+
+static const struct vnode_ops pipe_readops;
+static const struct vnode_ops pipe_writeops;
+
+////////////////////////////////////////////////////////////
+// Constructor and destructor
+
+/*
+ * Free a pipe whose ends are both gone.
+ */
+static
+void
+pipe_destroy(struct pipe *pp)
+{
+	kfree(pp->pp_buf);
+	pollqueue_cleanup(&pp->pp_pollq);
+	cv_destroy(pp->pp_writecv);
+	cv_destroy(pp->pp_readcv);
+	lock_destroy(pp->pp_lock);
+	kfree(pp);
+}
+
+/*
+ * Make a new pipe.
+ */
+int
+pipe_create(struct vnode **readvn_ret, struct vnode **writevn_ret)
+{
+	struct pipe *pp;
+	int result;
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pp->pp_buf = kmalloc(PIPE_SIZE);
+	if (pp->pp_buf == NULL) {
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_lock = lock_create("pipe");
+	if (pp->pp_lock == NULL) {
+		kfree(pp->pp_buf);
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_readcv = cv_create("pipe read");
+	if (pp->pp_readcv == NULL) {
+		lock_destroy(pp->pp_lock);
+		kfree(pp->pp_buf);
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_writecv = cv_create("pipe write");
+	if (pp->pp_writecv == NULL) {
+		cv_destroy(pp->pp_readcv);
+		lock_destroy(pp->pp_lock);
+		kfree(pp->pp_buf);
+		kfree(pp);
+		return ENOMEM;
+	}
+
+	pollqueue_init(&pp->pp_pollq);
+	pp->pp_start = 0;
+	pp->pp_count = 0;
+	pp->pp_readopen = true;
+	pp->pp_writeopen = true;
+
+	result = vnode_init(&pp->pp_readvn, &pipe_readops, NULL, pp);
+	KASSERT(result == 0);
+	result = vnode_init(&pp->pp_writevn, &pipe_writeops, NULL, pp);
+	KASSERT(result == 0);
+
+	*readvn_ret = &pp->pp_readvn;
+	*writevn_ret = &pp->pp_writevn;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// I/O
+
+/*
+ * Move LEN bytes between UIO and the ring, starting at ring offset
+ * POS and wrapping around the end if need be. Returns how many
+ * bytes were moved in *MOVED, which is less than LEN only on error.
+ */
+static
+int
+pipe_uiomove(struct pipe *pp, unsigned pos, size_t len, struct uio *uio,
+	     size_t *moved)
+{
+	size_t oldresid, first;
+	int result;
+
+	KASSERT(pos < PIPE_SIZE);
+	KASSERT(len <= PIPE_SIZE);
+
+	oldresid = uio->uio_resid;
+	first = PIPE_SIZE - pos;
+	if (first > len) {
+		first = len;
+	}
+	result = uiomove(pp->pp_buf + pos, first, uio);
+	if (result == 0 && len > first) {
+		result = uiomove(pp->pp_buf, len - first, uio);
+	}
+	*moved = oldresid - uio->uio_resid;
+	return result;
+}
+
+/*
+ * Called for read() on the read end. Waits for there to be some
+ * data (or for the write end to go away) and takes as much as there
+ * is, up to the size of the read.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t len, moved;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	lock_acquire(pp->pp_lock);
+	while (pp->pp_count == 0 && pp->pp_writeopen) {
+		cv_wait(pp->pp_readcv, pp->pp_lock);
+	}
+
+	len = pp->pp_count;
+	if (len > uio->uio_resid) {
+		len = uio->uio_resid;
+	}
+	result = pipe_uiomove(pp, pp->pp_start, len, uio, &moved);
+	pp->pp_start = (pp->pp_start + moved) % PIPE_SIZE;
+	pp->pp_count -= moved;
+	if (moved > 0) {
+		cv_broadcast(pp->pp_writecv, pp->pp_lock);
+		pollqueue_wake(&pp->pp_pollq);
+	}
+	lock_release(pp->pp_lock);
+
+	return result;
+}
+
+/*
+ * Called for write() on the write end. Puts in as much as fits,
+ * wakes up any readers, and waits for room for the rest. A write of
+ * PIPE_BUF bytes or less waits until it fits all at once, so it
+ * can't be split up by other writers.
+ *
+ * If the read end goes away part way through, return what was
+ * written so far as a short write; EPIPE only if there was none.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t origresid, space, len, moved;
+	unsigned pos;
+	bool wasempty;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	origresid = uio->uio_resid;
+	result = 0;
+
+	lock_acquire(pp->pp_lock);
+	while (uio->uio_resid > 0) {
+		if (!pp->pp_readopen) {
+			result = EPIPE;
+			break;
+		}
+		space = PIPE_SIZE - pp->pp_count;
+		if (space == 0 ||
+		    (origresid <= PIPE_BUF && space < origresid)) {
+			cv_wait(pp->pp_writecv, pp->pp_lock);
+			continue;
+		}
+
+		len = uio->uio_resid;
+		if (len > space) {
+			len = space;
+		}
+		pos = (pp->pp_start + pp->pp_count) % PIPE_SIZE;
+		wasempty = pp->pp_count == 0;
+		result = pipe_uiomove(pp, pos, len, uio, &moved);
+		pp->pp_count += moved;
+		if (wasempty && moved > 0) {
+			/* readers only ever wait on an empty pipe */
+			cv_broadcast(pp->pp_readcv, pp->pp_lock);
+			pollqueue_wake(&pp->pp_pollq);
+		}
+		if (result) {
+			break;
+		}
+	}
+	lock_release(pp->pp_lock);
+
+	if (result == EPIPE && uio->uio_resid < origresid) {
+		result = 0;
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Other operations
+
+/*
+ * Called when an end's last reference goes away. Wake up anyone
+ * waiting at the other end so they see it, and free the pipe once
+ * both ends are gone.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *pp = v->vn_data;
+	bool gone;
+
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_readvn) {
+		pp->pp_readopen = false;
+		cv_broadcast(pp->pp_writecv, pp->pp_lock);
+	}
+	else {
+		KASSERT(v == &pp->pp_writevn);
+		pp->pp_writeopen = false;
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+	}
+	pollqueue_wake(&pp->pp_pollq);
+	vnode_cleanup(v);
+	gone = !pp->pp_readopen && !pp->pp_writeopen;
+	lock_release(pp->pp_lock);
+
+	if (gone) {
+		pipe_destroy(pp);
+	}
+	return 0;
+}
+
+/*
+ * Called for poll(). The read end is readable when there's data, and
+ * hung up once the write end is gone. The write end is writable when
+ * a PIPE_BUF-sized write would go in without waiting, and an error
+ * once the read end is gone. One pollqueue covers both ends; it's
+ * woken whenever data goes in or out or either end goes away.
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct poller *pl)
+{
+	struct pipe *pp = v->vn_data;
+	int revents;
+
+	revents = 0;
+	lock_acquire(pp->pp_lock);
+	pollqueue_wait(&pp->pp_pollq, pl);
+	if (v == &pp->pp_readvn) {
+		if (pp->pp_count > 0) {
+			revents |= POLLIN;
+		}
+		if (!pp->pp_writeopen) {
+			revents |= POLLHUP;
+		}
+	}
+	else {
+		if (PIPE_SIZE - pp->pp_count >= PIPE_BUF) {
+			revents |= POLLOUT;
+		}
+		if (!pp->pp_readopen) {
+			revents |= POLLERR;
+		}
+	}
+	lock_release(pp->pp_lock);
+
+	return revents & (events | POLLERR | POLLHUP);
+}
+
+/*
+ * Pipes are never opened by name, so this can't be reached.
+ */
+static
+int
+pipe_eachopen(struct vnode *v, int openflags)
+{
+	(void)v;
+	(void)openflags;
+	return EINVAL;
+}
+
+/*
+ * No ioctls.
+ */
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+/*
+ * For fstat(). The size is the number of bytes waiting to be read.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *pp = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	lock_acquire(pp->pp_lock);
+	statbuf->st_size = pp->pp_count;
+	lock_release(pp->pp_lock);
+
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+/*
+ * fsync and ftruncate make no sense on a pipe.
+ */
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+////////////////////////////////////////////////////////////
+// Ops tables
+
+/*
+ * The read and write ends differ only in which of read and write
+ * work. The open file's access mode stops the wrong one first, with
+ * EBADF, so the failing ones here shouldn't actually get called.
+ */
+static const struct vnode_ops pipe_readops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = vopfail_uio_inval,
+	.vop_append = vopfail_uio_inval,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_poll = pipe_poll,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_notdir,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+static const struct vnode_ops pipe_writeops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = vopfail_uio_inval,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = pipe_write,
+	.vop_append = pipe_write,	/* a pipe is all end */
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_poll = pipe_poll,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_notdir,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
@@ -38,7 +38,9 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <array.h>
+#include <spinlock.h>
 #include <synch.h>
+#include <rcu.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
@@ -72,6 +74,20 @@
  * returns ENXIO. Referencing kd_name on a device that is not
  * mountable and has no filesystem, or kd_rawname on a mountable
  * device, returns the device itself.
+ *
+ * The table of devices is read without locking, using RCU (see
+ * rcu.h): vfs_getroot is on the path of every lookup that names a
+ * device, and the table almost never changes. Devices are never
+ * removed, so a struct knowndev lives forever and only the array is
+ * copied when a device is added. Everything that changes the table,
+ * or the filesystem on a device, holds vfs_biglock.
+ *
+ * kd_fs is the one field that changes. Readers may look at it (and
+ * at the filesystem's volume name) without any lock; unmount clears
+ * it and waits for a grace period before destroying the filesystem.
+ * To go on using the filesystem after the read section, as when
+ * getting its root, a reader bumps kd_fsbusy under kd_lock, and
+ * unmount fails with EBUSY while that is nonzero.
  */
 
 struct knowndev {
@@ -79,7 +95,9 @@ struct knowndev {
 	char *kd_rawname;
 	struct device *kd_device;
 	struct vnode *kd_vnode;
-	struct fs *kd_fs;
+	struct fs *volatile kd_fs;
+	struct spinlock kd_lock;	/* protects kd_fsbusy */
+	unsigned kd_fsbusy;		/* readers using kd_fs */
 };
 
 /* A placeholder for kd_fs for devices used as swap */
@@ -88,7 +106,7 @@ struct knowndev {
 DECLARRAY(knowndev, static __UNUSED inline);
 DEFARRAY(knowndev, static __UNUSED inline);
 
-static struct knowndevarray *knowndevs;
+static struct knowndevarray *volatile knowndevs;
 
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
@@ -197,14 +215,19 @@ vfs_sync(void)
 int
 vfs_getroot(const char *devname, struct vnode **ret)
 {
+	struct knowndevarray *kds;
 	struct knowndev *kd;
+	struct fs *fs;
 	unsigned i, num;
+	int result;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	rcu_read_lock();
 
-	num = knowndevarray_num(knowndevs);
+	kds = knowndevs;
+	num = knowndevarray_num(kds);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+		kd = knowndevarray_get(kds, i);
+		fs = kd->kd_fs;
 
 		/*
 		 * If this device has a mounted filesystem, and
@@ -215,18 +238,40 @@ vfs_getroot(const char *devname, struct vnode **ret)
 		 * and DEVNAME names the device, return ENXIO.
 		 */
 
-		if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
+		if (fs != NULL && fs != SWAP_FS) {
 			const char *volname;
-			volname = FSOP_GETVOLNAME(kd->kd_fs);
+			volname = FSOP_GETVOLNAME(fs);
 
 			if (!strcmp(kd->kd_name, devname) ||
 			    (volname!=NULL && !strcmp(volname, devname))) {
-				return FSOP_GETROOT(kd->kd_fs, ret);
+				/*
+				 * Getting the root may sleep, so hold
+				 * the fs in place and leave the read
+				 * section first. If it's being
+				 * unmounted, act as if it already was.
+				 */
+				spinlock_acquire(&kd->kd_lock);
+				if (kd->kd_fs != fs) {
+					spinlock_release(&kd->kd_lock);
+					rcu_read_unlock();
+					return ENXIO;
+				}
+				kd->kd_fsbusy++;
+				spinlock_release(&kd->kd_lock);
+				rcu_read_unlock();
+
+				result = FSOP_GETROOT(fs, ret);
+
+				spinlock_acquire(&kd->kd_lock);
+				kd->kd_fsbusy--;
+				spinlock_release(&kd->kd_lock);
+				return result;
 			}
 		}
 		else {
 			if (kd->kd_rawname!=NULL &&
 			    !strcmp(kd->kd_name, devname)) {
+				rcu_read_unlock();
 				return ENXIO;
 			}
 		}
@@ -237,10 +282,11 @@ vfs_getroot(const char *devname, struct vnode **ret)
 		 * we return the device itself.
 		 */
 		if (!strcmp(kd->kd_name, devname)) {
-			KASSERT(kd->kd_fs==NULL);
+			KASSERT(fs==NULL);
 			KASSERT(kd->kd_rawname==NULL);
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
+			rcu_read_unlock();
 			*ret = kd->kd_vnode;
 			return 0;
 		}
@@ -252,6 +298,7 @@ vfs_getroot(const char *devname, struct vnode **ret)
 		if (kd->kd_rawname!=NULL && !strcmp(kd->kd_rawname, devname)) {
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
+			rcu_read_unlock();
 			*ret = kd->kd_vnode;
 			return 0;
 		}
@@ -267,38 +314,51 @@ vfs_getroot(const char *devname, struct vnode **ret)
 	 * If we got here, the device specified by devname doesn't exist.
 	 */
 
+	rcu_read_unlock();
 	return ENODEV;
 }
 
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
+ *
+ * Unlike lookups by name, this needs vfs_biglock: unmount takes the
+ * filesystem off its device (see detachfs) before it knows whether
+ * unmounting will succeed, and a filesystem that is still in use
+ * must not look unmounted to the caller.
  */
 const char *
 vfs_getdevname(struct fs *fs)
 {
+	struct knowndevarray *kds;
 	struct knowndev *kd;
+	const char *name;
 	unsigned i, num;
 
 	KASSERT(fs != NULL);
-
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
+	rcu_read_lock();
+
+	name = NULL;
+	kds = knowndevs;
+	num = knowndevarray_num(kds);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+		kd = knowndevarray_get(kds, i);
 
 		if (kd->kd_fs == fs) {
 			/*
 			 * This is not a race condition: as long as the
 			 * guy calling us holds a reference to the fs,
-			 * the fs cannot go away, and the device can't
-			 * go away until the fs goes away.
+			 * the fs cannot go away, and the device never
+			 * goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
 
-	return NULL;
+	rcu_read_unlock();
+	return name;
 }
 
 /*
@@ -393,9 +453,10 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 {
 	char *name=NULL, *rawname=NULL;
 	struct knowndev *kd=NULL;
+	struct knowndevarray *newkds=NULL, *oldkds;
 	struct vnode *vnode=NULL;
 	const char *volname=NULL;
-	unsigned index;
+	unsigned index, i;
 	int result;
 
 	/* Silence warning with gcc 4.8 -Og (but not -O2) */
@@ -433,6 +494,8 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	kd->kd_device = dev;
 	kd->kd_vnode = vnode;
 	kd->kd_fs = fs;
+	spinlock_init(&kd->kd_lock);
+	kd->kd_fsbusy = 0;
 
 	if (fs!=NULL) {
 		volname = FSOP_GETVOLNAME(fs);
@@ -443,16 +506,33 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		goto fail;
 	}
 
-	result = knowndevarray_add(knowndevs, kd, &index);
+	/* Readers may be looking at the table; make a new one. */
+	oldkds = knowndevs;
+	index = knowndevarray_num(oldkds);
+	newkds = knowndevarray_create();
+	if (newkds==NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+	result = knowndevarray_setsize(newkds, index+1);
 	if (result) {
 		goto fail;
 	}
+	for (i=0; i<index; i++) {
+		knowndevarray_set(newkds, i, knowndevarray_get(oldkds, i));
+	}
+	knowndevarray_set(newkds, index, kd);
 
 	if (dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
 		dev->d_devnumber = index+1;
 	}
 
+	rcu_assign(knowndevs, newkds);
+	rcu_synchronize();
+	knowndevarray_setsize(oldkds, 0);
+	knowndevarray_destroy(oldkds);
+
 	vfs_biglock_release();
 	return 0;
 
@@ -467,8 +547,13 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		dev_uncreate_vnode(vnode);
 	}
 	if (kd) {
+		spinlock_cleanup(&kd->kd_lock);
 		kfree(kd);
 	}
+	if (newkds) {
+		knowndevarray_setsize(newkds, 0);
+		knowndevarray_destroy(newkds);
+	}
 
 	vfs_biglock_release();
 	return result;
@@ -528,6 +613,49 @@ findmount(const char *devname, struct knowndev **result)
 	return found ? 0 : ENODEV;
 }
 
+/*
+ * Set the filesystem on device KD. (Or SWAP_FS, or NULL.)
+ */
+static
+void
+setfs(struct knowndev *kd, struct fs *fs)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	spinlock_acquire(&kd->kd_lock);
+	kd->kd_fs = fs;
+	spinlock_release(&kd->kd_lock);
+}
+
+/*
+ * Take the filesystem off device KD, so lookups no longer find it,
+ * and wait until none already under way can still be looking at it.
+ * Fails with EBUSY if a lookup is getting its root right now.
+ *
+ * If unmounting then fails the caller puts the filesystem back with
+ * setfs. In between, lookups by name act as if it isn't mounted;
+ * vfs_getdevname can't see the gap, as the caller holds vfs_biglock
+ * throughout.
+ */
+static
+int
+detachfs(struct knowndev *kd, struct fs **ret)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	spinlock_acquire(&kd->kd_lock);
+	if (kd->kd_fsbusy > 0) {
+		spinlock_release(&kd->kd_lock);
+		return EBUSY;
+	}
+	*ret = kd->kd_fs;
+	kd->kd_fs = NULL;
+	spinlock_release(&kd->kd_lock);
+
+	rcu_synchronize();
+	return 0;
+}
+
 /*
  * Mount a filesystem. Once we've found the device, call MOUNTFUNC to
  * set up the filesystem and hand back a struct fs.
@@ -567,7 +695,7 @@ vfs_mount(const char *devname, void *data,
 	KASSERT(fs != NULL);
 	KASSERT(fs != SWAP_FS); 
 
-	kd->kd_fs = fs;
+	setfs(kd, fs);
 
 	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
@@ -617,7 +745,7 @@ vfs_swapon(const char *devname, struct vnode **ret)
 
 	kprintf("vfs: Swap attached to %s\n", kd->kd_name);
 
-	kd->kd_fs = SWAP_FS;
+	setfs(kd, SWAP_FS);
 	VOP_INCREF(kd->kd_vnode);
 	*ret = kd->kd_vnode;
 
@@ -638,6 +766,7 @@ int
 vfs_unmount(const char *devname)
 {
 	struct knowndev *kd;
+	struct fs *fs;
 	int result;
 
 	vfs_biglock_acquire();
@@ -654,22 +783,26 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	result = detachfs(kd, &fs);
+	if (result) {
+		goto fail;
+	}
+
 	/* sync the fs */
-	result = FSOP_SYNC(kd->kd_fs);
+	result = FSOP_SYNC(fs);
 	if (result) {
+		setfs(kd, fs);
 		goto fail;
 	}
 
-	result = FSOP_UNMOUNT(kd->kd_fs);
+	result = FSOP_UNMOUNT(fs);
 	if (result) {
+		setfs(kd, fs);
 		goto fail;
 	}
 
 	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
 
-	/* now drop the filesystem */
-	kd->kd_fs = NULL;
-
 	KASSERT(result==0);
 
  fail:
@@ -705,7 +838,7 @@ vfs_swapoff(const char *devname)
 	kprintf("vfs: Swap detached from %s:\n", kd->kd_name);
 
 	/* drop it */
-	kd->kd_fs = NULL;
+	setfs(kd, NULL);
 
 	KASSERT(result==0);
 
@@ -721,6 +854,7 @@ int
 vfs_unmountall(void)
 {
 	struct knowndev *dev;
+	struct fs *fs;
 	unsigned i, num;
 	int result;
 
@@ -739,18 +873,25 @@ vfs_unmountall(void)
 		}
 		if (dev->kd_fs == SWAP_FS) {
 			/* just drop it */
-			dev->kd_fs = NULL;
+			setfs(dev, NULL);
 			continue;
 		}
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
-		result = FSOP_SYNC(dev->kd_fs);
+		result = detachfs(dev, &fs);
+		if (result == EBUSY) {
+			kprintf("vfs: Cannot unmount %s: (busy)\n",
+				dev->kd_name);
+			continue;
+		}
+
+		result = FSOP_SYNC(fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
 				"again\n", dev->kd_name, strerror(result));
 
-			result = FSOP_SYNC(dev->kd_fs);
+			result = FSOP_SYNC(fs);
 			if (result) {
 				kprintf("vfs: Warning: sync failed second time"
 					" for %s: %s, giving up...\n",
@@ -759,25 +900,25 @@ vfs_unmountall(void)
 				 * Do not attempt to complete the
 				 * unmount as it will likely explode.
 				 */
+				setfs(dev, fs);
 				continue;
 			}
 		}
 
-		result = FSOP_UNMOUNT(dev->kd_fs);
+		result = FSOP_UNMOUNT(fs);
 		if (result == EBUSY) {
 			kprintf("vfs: Cannot unmount %s: (busy)\n",
 				dev->kd_name);
+			setfs(dev, fs);
 			continue;
 		}
 		if (result) {
 			kprintf("vfs: Warning: unmount failed for %s:"
 				" %s, already synced, dropping...\n",
 				dev->kd_name, strerror(result));
+			setfs(dev, fs);
 			continue;
 		}
-
-		/* now drop the filesystem */
-		dev->kd_fs = NULL;
 	}
 
 	vfs_biglock_release();
@@ -36,14 +36,18 @@
 #include <limits.h>
 #include <lib.h>
 #include <synch.h>
+#include <rcu.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
 
-static struct vnode *bootfs_vnode = NULL;
+/* Read under RCU; changed with vfs_biglock held. */
+static struct vnode *volatile bootfs_vnode = NULL;
 
 /*
- * Helper function for actually changing bootfs_vnode.
+ * Helper function for actually changing bootfs_vnode. Lookups may be
+ * about to take a reference to the old one, so let them finish
+ * before dropping ours.
  */
 static
 void
@@ -51,10 +55,13 @@ change_bootfs(struct vnode *newvn)
 {
 	struct vnode *oldvn;
 
+	KASSERT(vfs_biglock_do_i_hold());
+
 	oldvn = bootfs_vnode;
-	bootfs_vnode = newvn;
+	rcu_assign(bootfs_vnode, newvn);
 
 	if (oldvn != NULL) {
+		rcu_synchronize();
 		VOP_DECREF(oldvn);
 	}
 }
@@ -133,8 +140,6 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	struct vnode *vn;
 	int result;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/*
 	 * Entirely empty filenames aren't legal.
 	 */
@@ -195,11 +200,16 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	KASSERT(colon==0 || slash==0);
 
 	if (path[0]=='/') {
-		if (bootfs_vnode==NULL) {
+		rcu_read_lock();
+		vn = bootfs_vnode;
+		if (vn != NULL) {
+			VOP_INCREF(vn);
+		}
+		rcu_read_unlock();
+		if (vn == NULL) {
 			return ENOENT;
 		}
-		VOP_INCREF(bootfs_vnode);
-		*startvn = bootfs_vnode;
+		*startvn = vn;
 	}
 	else {
 		KASSERT(path[0]==':');
@@ -237,6 +247,9 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
+ *
+ * These don't need vfs_biglock: getdevice reads the device table and
+ * bootfs_vnode under RCU, and the filesystems lock for themselves.
  */
 
 int
@@ -246,11 +259,8 @@ vfs_lookparent(char *path, struct vnode **retval,
 	struct vnode *startvn;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -268,7 +278,6 @@ vfs_lookparent(char *path, struct vnode **retval,
 
 	VOP_DECREF(startvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -278,23 +287,18 @@ vfs_lookup(char *path, struct vnode **retval)
 	struct vnode *startvn;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
 	result = VOP_LOOKUP(startvn, path, retval);
 
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
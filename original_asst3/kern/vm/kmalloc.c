@@ -164,9 +164,12 @@ struct pageref {
  * logic per-cpu is worthwhile for scalability; however, for the time
  * being at least we won't, because it adds a lot of complexity and in
  * OS/161 performance and scalability aren't super-critical.
+ *
+ * Since every cpu takes this lock all the time, it is a ticket lock,
+ * so that no cpu gets starved.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock kmalloc_spinlock = SPINLOCK_TICKET_INITIALIZER;
 
 ////////////////////////////////////////
 
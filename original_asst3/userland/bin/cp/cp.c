@@ -28,6 +28,7 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 
 /*
@@ -35,29 +36,21 @@
  * Usage: cp oldfile newfile
  */
 
+/* How much to ask the kernel to copy per call. */
+#define COPY_CHUNK	(64*1024)
 
-/* Copy one file to another. */
+
+/*
+ * Copy the rest of one open file to another by reading it in and
+ * writing it back out.
+ */
 static
 void
-copy(const char *from, const char *to)
+copy_rw(int fromfd, const char *from, int tofd, const char *to)
 {
-	int fromfd;
-	int tofd;
 	char buf[1024];
 	int len, wr, wrtot;
 
-	/*
-	 * Open the files, and give up if they won't open
-	 */
-	fromfd = open(from, O_RDONLY);
-	if (fromfd<0) {
-		err(1, "%s", from);
-	}
-	tofd = open(to, O_WRONLY|O_CREAT|O_TRUNC);
-	if (tofd<0) {
-		err(1, "%s", to);
-	}
-
 	/*
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
@@ -84,6 +77,45 @@ copy(const char *from, const char *to)
 	if (len<0) {
 		err(1, "%s", from);
 	}
+}
+
+/* Copy one file to another. */
+static
+void
+copy(const char *from, const char *to)
+{
+	int fromfd;
+	int tofd;
+	ssize_t len;
+
+	/*
+	 * Open the files, and give up if they won't open
+	 */
+	fromfd = open(from, O_RDONLY);
+	if (fromfd<0) {
+		err(1, "%s", from);
+	}
+	tofd = open(to, O_WRONLY|O_CREAT|O_TRUNC);
+	if (tofd<0) {
+		err(1, "%s", to);
+	}
+
+	/*
+	 * Have the kernel move the data across, so it doesn't have to
+	 * come all the way out here and go back in again. As with read,
+	 * zero means we're done. If the kernel doesn't have
+	 * copy_file_range, fall back to doing it by hand.
+	 */
+	while ((len = copy_file_range(fromfd, NULL, tofd, NULL,
+				      COPY_CHUNK)) > 0) {
+		/* nothing */
+	}
+	if (len<0) {
+		if (errno != ENOSYS) {
+			err(1, "%s to %s", from, to);
+		}
+		copy_rw(fromfd, from, tofd, to);
+	}
 
 	if (close(fromfd) < 0) {
 		err(1, "%s: close", from);
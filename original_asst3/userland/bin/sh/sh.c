@@ -58,6 +58,9 @@
 /* avoid making this unreasonably large; causes problems under dumbvm */
 #define CMDLINE_MAX 4096
 
+/* most commands that can be strung together with '|' */
+#define MAXSTAGES 16
+
 /* struct to (portably) hold exit info */
 struct exitinfo {
 	unsigned val:8,
@@ -355,23 +358,75 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * startcmd
+ * forks and execs the command in args.  if infd or outfd isn't -1, the
+ * child gets it as its standard input or output.  closefd, if not -1, is
+ * another pipe end the parent is holding that the child mustn't keep
+ * open.  returns the child's pid, or -1 if the fork failed.
+ */
+static
+pid_t
+startcmd(char **args, int infd, int outfd, int closefd)
+{
+	pid_t pid;
+
+	pid = fork();
+	switch (pid) {
+		case -1:
+			/* error */
+			warn("fork");
+			return -1;
+		case 0:
+			/* child */
+			if (infd >= 0) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (outfd >= 0) {
+				dup2(outfd, STDOUT_FILENO);
+				close(outfd);
+			}
+			if (closefd >= 0) {
+				close(closefd);
+			}
+			execvp(args[0], args);
+			warn("%s", args[0]);
+			/*
+			 * Use _exit() instead of exit() in the child
+			 * process to avoid calling atexit() functions,
+			 * which would cause hostcompat (if present) to
+			 * reset the tty state and mess up our input
+			 * handling.
+			 */
+			_exit(1);
+		default:
+			break;
+	}
+	return pid;
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
- * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * otherwise, it's a standard command, or a pipeline of them separated by
+ * '|'.  check for the '&', try to background the job if possible,
+ * otherwise just run it and wait on it.
  */
 static
 void
 docommand(char *buf, struct exitinfo *ei)
 {
 	char *args[NARG_MAX + 1];
-	int nargs, i;
+	char **stages[MAXSTAGES];
+	pid_t pids[MAXSTAGES];
+	int nargs, nstages, i;
 	char *s;
 	pid_t pid;
 	int status;
 	int bg=0;
+	int pipefds[2], prevfd;
 	time_t startsecs, endsecs;
 	unsigned long startnsecs, endnsecs;
 
@@ -417,32 +472,76 @@ docommand(char *buf, struct exitinfo *ei)
 		bg = 1;
 	}
 
+	/* split into pipeline stages at each "|" */
+	nstages = 0;
+	stages[nstages++] = args;
+	for (i=0; i<nargs; i++) {
+		if (strcmp(args[i], "|") != 0) {
+			continue;
+		}
+		if (nstages >= MAXSTAGES) {
+			printf("%s: Too many commands in pipeline\n", args[0]);
+			exitinfo_exit(ei, 1);
+			return;
+		}
+		args[i] = NULL;
+		stages[nstages++] = &args[i+1];
+	}
+	for (i=0; i<nstages; i++) {
+		if (stages[i][0] == NULL) {
+			printf("Missing command in pipeline\n");
+			exitinfo_exit(ei, 1);
+			return;
+		}
+	}
+	if (bg && nstages > 1) {
+		printf("%s: Cannot background a pipeline\n", args[0]);
+		exitinfo_exit(ei, 1);
+		return;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
+	/*
+	 * Start each stage with its input from the previous stage's
+	 * pipe and its output to a new one (except at the ends). We
+	 * close our copies of the pipe ends as we go, so each pipe is
+	 * only held open by the two commands it connects.
+	 */
+	prevfd = -1;
+	for (i=0; i<nstages; i++) {
+		pipefds[0] = pipefds[1] = -1;
+		if (i < nstages - 1 && pipe(pipefds) < 0) {
+			warn("pipe");
 			break;
+		}
+		pids[i] = startcmd(stages[i], prevfd, pipefds[1], pipefds[0]);
+		if (prevfd >= 0) {
+			close(prevfd);
+		}
+		if (pipefds[1] >= 0) {
+			close(pipefds[1]);
+		}
+		prevfd = pipefds[0];
+		if (pids[i] < 0) {
+			break;
+		}
 	}
+	if (i < nstages) {
+		/* something failed; collect whatever got started */
+		if (prevfd >= 0) {
+			close(prevfd);
+		}
+		nstages = i;
+		for (i=0; i<nstages; i++) {
+			waitpid(pids[i], &status, 0);
+		}
+		exitinfo_exit(ei, 255);
+		return;
+	}
+	pid = pids[nstages - 1];
 
 	/* parent */
 	if (bg) {
@@ -453,6 +552,12 @@ docommand(char *buf, struct exitinfo *ei)
 		return;
 	}
 
+	/* the pipeline's status is that of the last command in it */
+	for (i=0; i<nstages - 1; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+		}
+	}
 	if (waitpid(pid, &status, 0) < 0) {
 		warn("waitpid");
 		exitinfo_exit(ei, 255);
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _SYS_AIO_H_
+#define _SYS_AIO_H_
+
+/*
+ * Get the ring structures and AIO_* from the kernel.
+ */
+#include <kern/aio.h>
+
+/* The submission and completion entries that follow the header. */
+#define AIO_SQES(ring) ((struct aio_sqe *)((ring) + 1))
+#define AIO_CQES(ring) ((struct aio_cqe *)(AIO_SQES(ring) + (ring)->ar_entries))
+
+/*
+ * Register RING, which must be AIO_RING_SIZE(ENTRIES) bytes, as this
+ * process's async I/O ring. The kernel fills in the header. A process
+ * has at most one ring; it goes away on exec and exit.
+ */
+int aio_setup(struct aio_ring *ring, unsigned entries);
+
+/*
+ * Take up to TOSUBMIT new submissions from the ring and start them,
+ * post any completions that are ready, then wait until at least
+ * MINCOMPLETE completions are waiting in the ring (or nothing more
+ * is outstanding). Returns the number of submissions taken.
+ */
+int aio_enter(unsigned tosubmit, unsigned mincomplete);
+
+
+#endif /* _SYS_AIO_H_ */
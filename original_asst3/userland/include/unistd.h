@@ -57,6 +57,8 @@
  *     fstat:    sys/stat.h
  *     lstat:    sys/stat.h
  *     mkdir:    sys/stat.h
+ *     readv:    sys/uio.h
+ *     writev:   sys/uio.h
  *
  * If this were standard Unix, more prototypes would go in other
  * header files as well, as follows:
@@ -145,9 +147,24 @@ ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t copy_file_range(int infd, off_t *inpos, int outfd, off_t *outpos,
+			size_t len);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+/*
+ * PID must be 0 or getpid(); either way only the calling thread is
+ * pinned (or asked about), not the other threads in the process.
+ */
+int sched_setaffinity(pid_t pid, unsigned mask);
+int sched_getaffinity(pid_t pid, unsigned *mask);
+/* schedstat - see sys/schedstat.h */
+int futex_wait(volatile int *uaddr, int val);
+int futex_wake(volatile int *uaddr, int count);
+int __threadfork(void (*entry)(void *), void *arg);
+__DEAD void __threadexit(void);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -158,6 +175,7 @@ ssize_t __getcwd(char *buf, size_t buflen);
 int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int threadfork(void (*func)(void));		/* calls __threadfork */
 
 /* UNSW versions of mmap() and munmap()
  * This are simplified compared to the standard version on UNIX
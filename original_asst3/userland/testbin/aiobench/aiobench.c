@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * aiobench - random block reads from one single-threaded process,
+ * one at a time with pread and with several at once through the
+ * async I/O ring.
+ *
+ * With pread the process waits for each read before asking for the
+ * next, so the disk only ever has one of its requests. Through the
+ * ring it keeps DEPTH reads outstanding, topping the ring back up as
+ * completions come in.
+ *
+ * Every block of the file holds its own block number, and each read
+ * is checked. There is no buffer cache, so every read goes to the
+ * disk.
+ *
+ * Before the timed runs it checks the limits: a read of AIO_MAXLEN
+ * bytes, many blocks at once, must work; a longer one must fail with
+ * EINVAL, and one on a pipe with ESPIPE.
+ *
+ * Usage: aiobench [reads]
+ */
+
+#include <sys/types.h>
+#include <sys/aio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_READS 512
+#define BLOCKSIZE 512
+#define NBLOCKS 128
+#define RINGSIZE 64
+#define FILENAME "aiobench.dat"
+
+static const unsigned depths[] = { 1, 4, 16, 64 };
+#define NDEPTHS (sizeof(depths) / sizeof(depths[0]))
+
+static uint32_t block[BLOCKSIZE / sizeof(uint32_t)];
+
+/* One buffer per ring slot; sqe_data says which. */
+static uint32_t bufs[RINGSIZE][BLOCKSIZE / sizeof(uint32_t)];
+static unsigned bufwant[RINGSIZE];
+
+/* For the limit checks; a little longer than the longest transfer. */
+static uint32_t bigbuf[(AIO_MAXLEN + BLOCKSIZE) / sizeof(uint32_t)];
+
+static uint64_t ringspace[AIO_RING_SIZE(RINGSIZE) / sizeof(uint64_t) + 1];
+static struct aio_ring *ring = (struct aio_ring *)ringspace;
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+report(const char *what, unsigned depth, unsigned ops, unsigned bad)
+{
+	uint64_t ns;
+
+	ns = elapsed_ns();
+
+	printf("%-5s depth %2u: %5u reads in %lld.%09lu s: "
+	       "%6llu reads/sec, %u bad\n",
+	       what, depth, ops, (long long)(ns / 1000000000),
+	       (unsigned long)(ns % 1000000000),
+	       (unsigned long long)((uint64_t)ops * 1000000000 / ns),
+	       bad);
+}
+
+////////////////////////////////////////////////////////////
+// file
+
+static
+int
+makefile(void)
+{
+	unsigned i, j;
+	int fd;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (i=0; i<NBLOCKS; i++) {
+		for (j=0; j<BLOCKSIZE / sizeof(uint32_t); j++) {
+			block[j] = i;
+		}
+		if (write(fd, block, BLOCKSIZE) != BLOCKSIZE) {
+			err(1, "%s: write", FILENAME);
+		}
+	}
+	return fd;
+}
+
+static
+int
+badblock(const uint32_t *buf, unsigned want)
+{
+	return buf[0] != want ||
+		buf[BLOCKSIZE / sizeof(uint32_t) - 1] != want;
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+static
+void
+run_pread(int fd, unsigned reads)
+{
+	unsigned i, want, bad = 0;
+	ssize_t r;
+
+	srandom(1);
+	starttimer();
+	for (i=0; i<reads; i++) {
+		want = random() % NBLOCKS;
+		r = pread(fd, block, BLOCKSIZE, (off_t)want * BLOCKSIZE);
+		if (r < 0) {
+			err(1, "%s: pread", FILENAME);
+		}
+		if (r != BLOCKSIZE || badblock(block, want)) {
+			bad++;
+		}
+	}
+	report("pread", 1, reads, bad);
+}
+
+/*
+ * Queue a read of a random block into buffer SLOT.
+ */
+static
+void
+queue_read(int fd, unsigned slot)
+{
+	struct aio_sqe *sqe;
+
+	bufwant[slot] = random() % NBLOCKS;
+	sqe = &AIO_SQES(ring)[ring->ar_sqtail & (ring->ar_entries - 1)];
+	sqe->sqe_op = AIO_READ;
+	sqe->sqe_fd = fd;
+	sqe->sqe_offset = (off_t)bufwant[slot] * BLOCKSIZE;
+	sqe->sqe_buf = bufs[slot];
+	sqe->sqe_len = BLOCKSIZE;
+	sqe->sqe_data = slot;
+	ring->ar_sqtail++;
+}
+
+/*
+ * Do one read through the ring and wait for it. Returns cqe_result.
+ */
+static
+int
+aio_readone(int fd, void *buf, unsigned len, off_t offset)
+{
+	struct aio_sqe *sqe;
+	struct aio_cqe *cqe;
+	int r;
+
+	sqe = &AIO_SQES(ring)[ring->ar_sqtail & (ring->ar_entries - 1)];
+	sqe->sqe_op = AIO_READ;
+	sqe->sqe_fd = fd;
+	sqe->sqe_offset = offset;
+	sqe->sqe_buf = buf;
+	sqe->sqe_len = len;
+	sqe->sqe_data = 0;
+	ring->ar_sqtail++;
+
+	r = aio_enter(1, 1);
+	if (r < 0) {
+		err(1, "aio_enter");
+	}
+	if (r != 1 || ring->ar_cqhead == ring->ar_cqtail) {
+		errx(1, "aio_enter: read not submitted and completed");
+	}
+	cqe = &AIO_CQES(ring)[ring->ar_cqhead & (ring->ar_entries - 1)];
+	r = cqe->cqe_result;
+	ring->ar_cqhead++;
+	return r;
+}
+
+static
+void
+check_limits(int fd)
+{
+	unsigned i;
+	int p[2];
+	int r;
+
+	r = aio_readone(fd, bigbuf, AIO_MAXLEN, 0);
+	if (r != AIO_MAXLEN) {
+		errx(1, "aio: %u-byte read returned %d", AIO_MAXLEN, r);
+	}
+	for (i=0; i<AIO_MAXLEN / BLOCKSIZE; i++) {
+		if (badblock(bigbuf + i * (BLOCKSIZE / sizeof(uint32_t)), i)) {
+			errx(1, "aio: %u-byte read: block %u is wrong",
+			     AIO_MAXLEN, i);
+		}
+	}
+
+	r = aio_readone(fd, bigbuf, AIO_MAXLEN + 1, 0);
+	if (r != -EINVAL) {
+		errx(1, "aio: %u-byte read returned %d, not -EINVAL",
+		     AIO_MAXLEN + 1, r);
+	}
+
+	if (pipe(p) < 0) {
+		err(1, "pipe");
+	}
+	r = aio_readone(p[0], bigbuf, 1, 0);
+	if (r != -ESPIPE) {
+		errx(1, "aio: read on a pipe returned %d, not -ESPIPE", r);
+	}
+	close(p[0]);
+	close(p[1]);
+
+	printf("aio limits: %u-byte read ok, longer and pipe refused\n",
+	       AIO_MAXLEN);
+}
+
+static
+void
+run_aio(int fd, unsigned reads, unsigned depth)
+{
+	struct aio_cqe *cqe;
+	unsigned queued, done, bad, slot, pending;
+	int r;
+
+	srandom(1);
+	starttimer();
+	queued = done = bad = 0;
+	pending = 0;
+
+	/* Fill the pipeline. */
+	while (queued < reads && queued < depth) {
+		queue_read(fd, queued);
+		queued++;
+		pending++;
+	}
+
+	while (done < reads) {
+		r = aio_enter(pending, 1);
+		if (r < 0) {
+			err(1, "aio_enter");
+		}
+		pending -= r;
+
+		/* Reap, and reuse each finished buffer for a new read. */
+		while (ring->ar_cqhead != ring->ar_cqtail) {
+			cqe = &AIO_CQES(ring)[ring->ar_cqhead &
+					      (ring->ar_entries - 1)];
+			slot = cqe->cqe_data;
+			if (cqe->cqe_result != BLOCKSIZE ||
+			    badblock(bufs[slot], bufwant[slot])) {
+				bad++;
+			}
+			ring->ar_cqhead++;
+			done++;
+
+			if (queued < reads) {
+				queue_read(fd, slot);
+				queued++;
+				pending++;
+			}
+		}
+	}
+	report("aio", depth, reads, bad);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned reads = DEFAULT_READS, i;
+	int fd;
+
+	if (argc > 2) {
+		errx(1, "Usage: %s [reads]", argv[0]);
+	}
+	if (argc > 1) {
+		reads = atoi(argv[1]);
+	}
+
+	fd = makefile();
+	if (aio_setup(ring, RINGSIZE) < 0) {
+		err(1, "aio_setup");
+	}
+	check_limits(fd);
+
+	run_pread(fd, reads);
+	for (i=0; i<NDEPTHS; i++) {
+		run_aio(fd, reads, depths[i]);
+	}
+
+	close(fd);
+	remove(FILENAME);
+	return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * appendbench - several processes appending records to one log file.
+ *
+ * Each writer opens the log for itself, so the writers share the
+ * file but not an open file or a seek position, and then writes
+ * fixed-size records stamped with its number and a sequence number.
+ * This is done two ways: with O_APPEND, and the way a program has to
+ * do it without O_APPEND, lseek to SEEK_END and then write. Another
+ * writer can get in between the lseek and the write, and then one of
+ * the two records is overwritten.
+ *
+ * Afterwards the log is read back and checked: every record has to
+ * be intact, and every writer's records have to all be there, in
+ * order. The lseek+write runs are expected to lose some; O_APPEND
+ * runs must not lose any.
+ *
+ * Usage: appendbench [maxprocs [writes]]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_MAXPROCS 8
+#define DEFAULT_WRITES 500
+#define MAXPROCS 32
+#define RECWORDS 16
+#define RECSIZE (RECWORDS * sizeof(uint32_t))
+#define RECMAGIC 0xa99e0d00
+#define FILENAME "appendbench.log"
+
+static uint32_t rec[RECWORDS];
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+report(const char *what, unsigned nprocs, unsigned ops, unsigned lost)
+{
+	uint64_t ns;
+
+	ns = elapsed_ns();
+
+	printf("%-12s %2u procs: %6u appends in %lld.%09lu s: "
+	       "%7llu appends/sec, %u lost\n",
+	       what, nprocs, ops, (long long)(ns / 1000000000),
+	       (unsigned long)(ns % 1000000000),
+	       (unsigned long long)((uint64_t)ops * 1000000000 / ns),
+	       lost);
+}
+
+////////////////////////////////////////////////////////////
+// records
+
+static
+void
+fillrec(unsigned writer, unsigned seq)
+{
+	unsigned i;
+
+	rec[0] = RECMAGIC | writer;
+	rec[1] = seq;
+	for (i=2; i<RECWORDS - 1; i++) {
+		rec[i] = writer * 65536 + seq + i;
+	}
+	rec[RECWORDS - 1] = ~(rec[0] ^ seq);
+}
+
+static
+int
+checkrec(unsigned *writer_ret, unsigned *seq_ret)
+{
+	unsigned writer, seq, i;
+
+	if ((rec[0] & 0xffffff00) != RECMAGIC) {
+		return -1;
+	}
+	writer = rec[0] & 0xff;
+	seq = rec[1];
+	if (writer >= MAXPROCS || rec[RECWORDS - 1] != ~(rec[0] ^ seq)) {
+		return -1;
+	}
+	for (i=2; i<RECWORDS - 1; i++) {
+		if (rec[i] != writer * 65536 + seq + i) {
+			return -1;
+		}
+	}
+	*writer_ret = writer;
+	*seq_ret = seq;
+	return 0;
+}
+
+/*
+ * Read the log back. Returns how many of the NPROCS*WRITES records
+ * that were written are missing from it; exits if anything is there
+ * that shouldn't be.
+ */
+static
+unsigned
+verify(unsigned nprocs, unsigned writes)
+{
+	unsigned nextseq[MAXPROCS];
+	unsigned i, writer, seq, found;
+	ssize_t r;
+	int fd;
+
+	for (i=0; i<nprocs; i++) {
+		nextseq[i] = 0;
+	}
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	found = 0;
+	while ((r = read(fd, rec, RECSIZE)) != 0) {
+		if (r < 0) {
+			err(1, "%s: read", FILENAME);
+		}
+		if (r != RECSIZE) {
+			errx(1, "%s: partial record at end", FILENAME);
+		}
+		if (checkrec(&writer, &seq) < 0 || writer >= nprocs) {
+			errx(1, "%s: garbled record %u", FILENAME, found);
+		}
+		/* a writer's records can go missing, but not reorder */
+		if (seq < nextseq[writer] || seq >= writes) {
+			errx(1, "%s: writer %u: record %u out of order",
+			     FILENAME, writer, seq);
+		}
+		nextseq[writer] = seq + 1;
+		found++;
+	}
+	close(fd);
+
+	return nprocs * writes - found;
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+/*
+ * One process's share: open the log and append WRITES records.
+ */
+static
+void
+appender(unsigned me, unsigned writes, int useappend)
+{
+	unsigned i;
+	int fd;
+
+	fd = open(FILENAME, useappend ? O_WRONLY|O_APPEND : O_WRONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (i=0; i<writes; i++) {
+		fillrec(me, i);
+		if (!useappend && lseek(fd, 0, SEEK_END) < 0) {
+			err(1, "%s: lseek", FILENAME);
+		}
+		if (write(fd, rec, RECSIZE) != RECSIZE) {
+			err(1, "%s: write", FILENAME);
+		}
+	}
+	close(fd);
+}
+
+/*
+ * Fork NPROCS writers on a fresh log, wait for them, and check what
+ * they left.
+ */
+static
+void
+run(unsigned nprocs, unsigned writes, int useappend)
+{
+	pid_t pids[MAXPROCS];
+	unsigned i, lost;
+	int fd, status;
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	close(fd);
+
+	starttimer();
+	for (i=0; i<nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			appender(i, writes, useappend);
+			_exit(0);
+		}
+	}
+	for (i=0; i<nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "writer %u failed", i);
+		}
+	}
+	lost = verify(nprocs, writes);
+	report(useappend ? "O_APPEND" : "lseek+write", nprocs,
+	       nprocs * writes, lost);
+	if (useappend && lost > 0) {
+		errx(1, "O_APPEND lost %u records", lost);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned maxprocs = DEFAULT_MAXPROCS, writes = DEFAULT_WRITES, n;
+
+	if (argc > 3) {
+		errx(1, "Usage: %s [maxprocs [writes]]", argv[0]);
+	}
+	if (argc > 1) {
+		maxprocs = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		writes = atoi(argv[2]);
+	}
+	if (maxprocs < 1 || maxprocs > MAXPROCS) {
+		errx(1, "maxprocs must be between 1 and %d", MAXPROCS);
+	}
+	if (writes < 1) {
+		errx(1, "writes must be at least 1");
+	}
+
+	for (n=1; n<=maxprocs; n*=2) {
+		run(n, writes, 0);
+		run(n, writes, 1);
+	}
+	remove(FILENAME);
+	return 0;
+}
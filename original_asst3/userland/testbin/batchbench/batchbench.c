@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * batchbench - cost per operation of system calls made one at a time
+ * and in batches with syscall_batch.
+ *
+ * The first test is getpid, about the cheapest call there is, so
+ * nearly all its cost is the trap itself. The second is the
+ * open/fstat/read/close sequence a program like ls or cat goes
+ * through for each file, where the batch uses SBE_ARG0FROM to pass
+ * the file handle from the open along to the other three.
+ *
+ * Usage: batchbench [loops]
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/batch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_LOOPS 2000
+#define BATCHSIZE 32
+#define FILENAME "batchbench.dat"
+
+static struct syscall_batch_entry entries[BATCHSIZE];
+static char buf[128];
+static struct stat st;
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+report(const char *what, unsigned ops)
+{
+	uint64_t ns;
+
+	ns = elapsed_ns();
+
+	printf("%-28s %6u ops in %lld.%09lu s: %7llu ns/op\n",
+	       what, ops, (long long)(ns / 1000000000),
+	       (unsigned long)(ns % 1000000000),
+	       (unsigned long long)(ns / ops));
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+static
+void
+setentry(unsigned i, int callno, unsigned flags, uint32_t a0, uint32_t a1,
+	 uint32_t a2)
+{
+	entries[i].sbe_callno = callno;
+	entries[i].sbe_flags = flags;
+	entries[i].sbe_args[0] = a0;
+	entries[i].sbe_args[1] = a1;
+	entries[i].sbe_args[2] = a2;
+	entries[i].sbe_args[3] = 0;
+}
+
+static
+void
+run_getpid(unsigned loops)
+{
+	unsigned i, j;
+	pid_t me;
+
+	me = getpid();
+
+	starttimer();
+	for (i=0; i<loops; i++) {
+		if (getpid() != me) {
+			errx(1, "getpid changed");
+		}
+	}
+	report("getpid", loops);
+
+	for (j=0; j<BATCHSIZE; j++) {
+		setentry(j, SYS_getpid, 0, 0, 0, 0);
+	}
+	starttimer();
+	for (i=0; i<loops; i+=BATCHSIZE) {
+		if (syscall_batch(entries, BATCHSIZE) != BATCHSIZE) {
+			err(1, "syscall_batch");
+		}
+		if (entries[BATCHSIZE-1].sbe_result != me) {
+			errx(1, "batched getpid returned %d",
+			     entries[BATCHSIZE-1].sbe_result);
+		}
+	}
+	report("getpid, batched by 32", i);
+}
+
+static
+void
+run_file(unsigned loops)
+{
+	unsigned i, j;
+	int fd;
+
+	starttimer();
+	for (i=0; i<loops; i++) {
+		fd = open(FILENAME, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s", FILENAME);
+		}
+		if (fstat(fd, &st) < 0) {
+			err(1, "%s: fstat", FILENAME);
+		}
+		if (read(fd, buf, sizeof(buf)) < 0) {
+			err(1, "%s: read", FILENAME);
+		}
+		if (close(fd) < 0) {
+			err(1, "%s: close", FILENAME);
+		}
+	}
+	report("open+fstat+read+close", loops * 4);
+
+	setentry(0, SYS_open, SBE_STOPONERR, (uintptr_t)FILENAME, O_RDONLY, 0);
+	setentry(1, SYS_fstat, SBE_ARG0FROM(0), 0, (uintptr_t)&st, 0);
+	setentry(2, SYS_read, SBE_ARG0FROM(0), 0, (uintptr_t)buf,
+		 sizeof(buf));
+	setentry(3, SYS_close, SBE_ARG0FROM(0), 0, 0, 0);
+
+	starttimer();
+	for (i=0; i<loops; i++) {
+		if (syscall_batch(entries, 4) < 0) {
+			err(1, "syscall_batch");
+		}
+		for (j=0; j<4; j++) {
+			if (entries[j].sbe_errno != 0) {
+				errno = entries[j].sbe_errno;
+				err(1, "batched call %u", j);
+			}
+		}
+	}
+	report("open+fstat+read+close, batched", loops * 4);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned loops = DEFAULT_LOOPS;
+	int fd;
+
+	if (argc > 2) {
+		errx(1, "Usage: %s [loops]", argv[0]);
+	}
+	if (argc > 1) {
+		loops = atoi(argv[1]);
+	}
+	if (loops < 1) {
+		errx(1, "loops must be at least 1");
+	}
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	if (write(fd, "batchbench\n", 11) != 11) {
+		err(1, "%s: write", FILENAME);
+	}
+	close(fd);
+
+	run_getpid(loops);
+	run_file(loops);
+
+	remove(FILENAME);
+	return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * copybench - copy a large file with read and write and with
+ * copy_file_range, and report the throughput of each.
+ *
+ * read/write moves every byte out to this buffer and back into the
+ * kernel again; copy_file_range moves it between the two files
+ * inside the kernel. We try read/write with cp's old 1k buffer and
+ * with a larger one, to separate the cost of the extra copies from
+ * the cost of the extra system calls. After each run the copy is
+ * checked against the original.
+ *
+ * The default size is close to the largest file SFS can hold.
+ *
+ * Usage: copybench [kbytes [reps]]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_KBYTES 64
+#define DEFAULT_REPS 8
+#define MAXKBYTES 1024
+#define FROMFILE "copybench.src"
+#define TOFILE "copybench.dst"
+
+static char buf[16384];
+static char checkbuf[16384];
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+report(const char *what, unsigned kbytes, unsigned reps, unsigned calls)
+{
+	uint64_t ns;
+
+	ns = elapsed_ns();
+
+	printf("%-16s %3u x %4uk in %lld.%09lu s: %7llu k/sec, "
+	       "%6u syscalls\n",
+	       what, reps, kbytes, (long long)(ns / 1000000000),
+	       (unsigned long)(ns % 1000000000),
+	       (unsigned long long)((uint64_t)reps * kbytes * 1000000000
+				    / ns),
+	       calls);
+}
+
+////////////////////////////////////////////////////////////
+// files
+
+static
+void
+makefile(unsigned kbytes)
+{
+	unsigned i, j;
+	int fd;
+
+	fd = open(FROMFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FROMFILE);
+	}
+	for (i=0; i<kbytes; i++) {
+		for (j=0; j<1024; j++) {
+			buf[j] = (char)(i * 7 + j);
+		}
+		if (write(fd, buf, 1024) != 1024) {
+			err(1, "%s: write", FROMFILE);
+		}
+	}
+	close(fd);
+}
+
+static
+void
+checkfile(void)
+{
+	int fd1, fd2;
+	ssize_t r1, r2;
+	off_t pos = 0;
+
+	fd1 = open(FROMFILE, O_RDONLY);
+	if (fd1 < 0) {
+		err(1, "%s", FROMFILE);
+	}
+	fd2 = open(TOFILE, O_RDONLY);
+	if (fd2 < 0) {
+		err(1, "%s", TOFILE);
+	}
+	do {
+		r1 = read(fd1, buf, sizeof(buf));
+		if (r1 < 0) {
+			err(1, "%s: read", FROMFILE);
+		}
+		r2 = read(fd2, checkbuf, sizeof(checkbuf));
+		if (r2 < 0) {
+			err(1, "%s: read", TOFILE);
+		}
+		if (r1 != r2 || memcmp(buf, checkbuf, r1) != 0) {
+			errx(1, "%s: wrong contents near offset %lld",
+			     TOFILE, (long long)pos);
+		}
+		pos += r1;
+	} while (r1 > 0);
+	close(fd1);
+	close(fd2);
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+/*
+ * Copy FROMFILE to TOFILE once, with read and write if BUFSIZE is
+ * nonzero and otherwise with copy_file_range. Returns the number of
+ * system calls used for the data.
+ */
+static
+unsigned
+copyonce(size_t bufsize)
+{
+	int fromfd, tofd;
+	ssize_t len, wr;
+	unsigned calls = 0;
+
+	fromfd = open(FROMFILE, O_RDONLY);
+	if (fromfd < 0) {
+		err(1, "%s", FROMFILE);
+	}
+	tofd = open(TOFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (tofd < 0) {
+		err(1, "%s", TOFILE);
+	}
+
+	if (bufsize == 0) {
+		do {
+			len = copy_file_range(fromfd, NULL, tofd, NULL,
+					      MAXKBYTES * 1024);
+			if (len < 0) {
+				err(1, "copy_file_range");
+			}
+			calls++;
+		} while (len > 0);
+	}
+	else {
+		while ((len = read(fromfd, buf, bufsize)) > 0) {
+			calls++;
+			wr = write(tofd, buf, len);
+			if (wr < 0) {
+				err(1, "%s: write", TOFILE);
+			}
+			if (wr != len) {
+				errx(1, "%s: short write", TOFILE);
+			}
+			calls++;
+		}
+		if (len < 0) {
+			err(1, "%s: read", FROMFILE);
+		}
+		calls++;
+	}
+
+	close(fromfd);
+	close(tofd);
+	return calls;
+}
+
+static
+void
+run(const char *what, size_t bufsize, unsigned kbytes, unsigned reps)
+{
+	unsigned i, calls = 0;
+
+	starttimer();
+	for (i=0; i<reps; i++) {
+		calls += copyonce(bufsize);
+	}
+	report(what, kbytes, reps, calls);
+	checkfile();
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned kbytes = DEFAULT_KBYTES, reps = DEFAULT_REPS;
+
+	if (argc > 3) {
+		errx(1, "Usage: %s [kbytes [reps]]", argv[0]);
+	}
+	if (argc > 1) {
+		kbytes = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		reps = atoi(argv[2]);
+	}
+	if (kbytes < 1 || kbytes > MAXKBYTES) {
+		errx(1, "kbytes must be between 1 and %d", MAXKBYTES);
+	}
+
+	makefile(kbytes);
+	run("read/write 1k", 1024, kbytes, reps);
+	run("read/write 16k", sizeof(buf), kbytes, reps);
+	run("copy_file_range", 0, kbytes, reps);
+	remove(FROMFILE);
+	remove(TOFILE);
+	return 0;
+}
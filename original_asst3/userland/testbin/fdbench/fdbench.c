@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * fdbench - open/close churn with different numbers of descriptors
+ * already open.
+ *
+ * Each run first opens a number of descriptors and keeps them open,
+ * so they fill the low slots of the file table, and then opens and
+ * closes one more file over and over. Each of those opens has to
+ * find the lowest free slot, which is past all the ones being held;
+ * if the kernel finds it by scanning the table, the rate drops as
+ * more descriptors are held.
+ *
+ * Usage: fdbench [loops]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_LOOPS 2000
+#define FILENAME "fdbench.dat"
+
+/*
+ * The last run holds as many as will fit: all but stdin, stdout,
+ * stderr, and the one being opened and closed.
+ */
+#define MAXLIVE (OPEN_MAX - 4)
+
+static const unsigned livecounts[] = { 1, 32, MAXLIVE };
+#define NLIVECOUNTS (sizeof(livecounts) / sizeof(livecounts[0]))
+
+static int heldfds[MAXLIVE];
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+report(unsigned live, unsigned loops)
+{
+	uint64_t ns;
+
+	ns = elapsed_ns();
+
+	printf("%4u live fds: %6u open+close in %lld.%09lu s: "
+	       "%7llu ns each\n",
+	       live, loops, (long long)(ns / 1000000000),
+	       (unsigned long)(ns % 1000000000),
+	       (unsigned long long)(ns / loops));
+}
+
+////////////////////////////////////////////////////////////
+// test
+
+static
+void
+run(unsigned live, unsigned loops)
+{
+	unsigned i;
+	int fd, lastfd;
+
+	lastfd = -1;
+	for (i=0; i<live; i++) {
+		heldfds[i] = open(FILENAME, O_RDONLY);
+		if (heldfds[i] < 0) {
+			err(1, "%s: open %u of %u", FILENAME, i + 1, live);
+		}
+		if (heldfds[i] > lastfd) {
+			lastfd = heldfds[i];
+		}
+	}
+
+	starttimer();
+	for (i=0; i<loops; i++) {
+		fd = open(FILENAME, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s: open", FILENAME);
+		}
+		if (fd <= lastfd) {
+			errx(1, "open returned fd %d, but %d is still open",
+			     fd, lastfd);
+		}
+		if (close(fd) < 0) {
+			err(1, "%s: close", FILENAME);
+		}
+	}
+	report(live, loops);
+
+	for (i=0; i<live; i++) {
+		if (close(heldfds[i]) < 0) {
+			err(1, "%s: close", FILENAME);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned loops = DEFAULT_LOOPS, i;
+	int fd;
+
+	if (argc > 2) {
+		errx(1, "Usage: %s [loops]", argv[0]);
+	}
+	if (argc > 1) {
+		loops = atoi(argv[1]);
+	}
+	if (loops < 1) {
+		errx(1, "loops must be at least 1");
+	}
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	close(fd);
+
+	for (i=0; i<NLIVECOUNTS; i++) {
+		run(livecounts[i], loops);
+	}
+	remove(FILENAME);
+	return 0;
+}
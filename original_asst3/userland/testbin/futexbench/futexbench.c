@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futexbench - compare semaphores built on futexes with the semfs
+ * ("sem:") semaphores.
+ *
+ * A semfs P or V is a read or write system call on a vnode, plus a
+ * lock and CV in the kernel, every time. A futex semaphore is a
+ * counter in user memory updated with LL/SC; it only enters the
+ * kernel to sleep when the count is zero, or to wake someone when
+ * there may be sleepers.
+ *
+ * The first tests are uncontended, which is the case futexes make
+ * free, along with the bare futex system calls. The last two pass a
+ * token back and forth, so every P sleeps: between two threads with
+ * futexes (which needs threadfork, since futex memory has to be
+ * shared) and between two processes with semfs.
+ *
+ * Usage: futexbench [loops]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_LOOPS 10000
+#define SEMNAME "sem:futexbench"
+#define PINGNAME "sem:futexbench.ping"
+#define PONGNAME "sem:futexbench.pong"
+
+////////////////////////////////////////////////////////////
+// futex semaphores
+
+struct fsem {
+	volatile int fs_count;		/* Available units */
+	volatile int fs_waiters;	/* Threads in (or near) futex_wait */
+};
+
+/*
+ * Compare and swap: if *P is OLD, make it NEW and return nonzero.
+ * See the kernel's spinlock_data_testandset for how LL/SC works.
+ */
+static
+int
+cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	y = new;
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"ll %0, 0(%2);"		/*   x = *p */
+		"bne %0, %3, 1f;"	/*   if (x != old) skip the store */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"1:;"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "+r" (y) : "r" (p), "r" (old) : "memory");
+	return x == old && y != 0;
+}
+
+static
+void
+atomic_add(volatile int *p, int delta)
+{
+	int old;
+
+	do {
+		old = *p;
+	} while (!cas(p, old, old + delta));
+}
+
+static
+void
+fsem_init(struct fsem *fs, int count)
+{
+	fs->fs_count = count;
+	fs->fs_waiters = 0;
+}
+
+static
+void
+fsem_P(struct fsem *fs)
+{
+	int count;
+
+	while (1) {
+		count = fs->fs_count;
+		if (count > 0) {
+			if (cas(&fs->fs_count, count, count - 1)) {
+				return;
+			}
+			continue;
+		}
+		/*
+		 * Announce ourselves before sleeping, so fsem_V knows to
+		 * make the system call. If a V gets in after we looked at
+		 * the count, futex_wait sees it's no longer 0 and returns
+		 * EAGAIN, and we go around again.
+		 */
+		atomic_add(&fs->fs_waiters, 1);
+		if (futex_wait(&fs->fs_count, 0) < 0 && errno != EAGAIN) {
+			err(1, "futex_wait");
+		}
+		atomic_add(&fs->fs_waiters, -1);
+	}
+}
+
+static
+void
+fsem_V(struct fsem *fs)
+{
+	atomic_add(&fs->fs_count, 1);
+	if (fs->fs_waiters > 0) {
+		if (futex_wake(&fs->fs_count, 1) < 0) {
+			err(1, "futex_wake");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+report(const char *what, unsigned ops)
+{
+	uint64_t ns;
+
+	ns = elapsed_ns();
+
+	printf("%-28s %8u ops in %lld.%09lu s: %10llu ops/sec\n",
+	       what, ops, (long long)(ns / 1000000000),
+	       (unsigned long)(ns % 1000000000),
+	       (unsigned long long)((uint64_t)ops * 1000000000 / ns));
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+static
+void
+bench_semfs(unsigned loops)
+{
+	char c = 0;
+	unsigned i;
+	int fd;
+
+	fd = open(SEMNAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SEMNAME);
+	}
+
+	starttimer();
+	for (i=0; i<loops; i++) {
+		if (write(fd, &c, 1) != 1) {
+			err(1, "%s: write", SEMNAME);
+		}
+		if (read(fd, &c, 1) != 1) {
+			err(1, "%s: read", SEMNAME);
+		}
+	}
+	report("semfs V+P", loops);
+
+	close(fd);
+	(void)remove(SEMNAME);
+}
+
+static
+void
+bench_fsem(unsigned loops)
+{
+	struct fsem fs;
+	unsigned i;
+
+	fsem_init(&fs, 0);
+	starttimer();
+	for (i=0; i<loops; i++) {
+		fsem_V(&fs);
+		fsem_P(&fs);
+	}
+	report("futex semaphore V+P", loops);
+	if (fs.fs_count != 0) {
+		errx(1, "futex semaphore count is %d, not 0", fs.fs_count);
+	}
+}
+
+static
+void
+bench_wake(unsigned loops)
+{
+	volatile int word = 0;
+	unsigned i;
+	int n;
+
+	starttimer();
+	for (i=0; i<loops; i++) {
+		n = futex_wake(&word, 1);
+		if (n < 0) {
+			err(1, "futex_wake");
+		}
+		if (n != 0) {
+			errx(1, "futex_wake woke %d threads, not 0", n);
+		}
+	}
+	report("futex_wake (no waiters)", loops);
+}
+
+static
+void
+bench_waitfail(unsigned loops)
+{
+	volatile int word = 1;
+	unsigned i;
+
+	starttimer();
+	for (i=0; i<loops; i++) {
+		if (futex_wait(&word, 0) == 0) {
+			errx(1, "futex_wait slept with a stale value");
+		}
+		if (errno != EAGAIN) {
+			err(1, "futex_wait");
+		}
+	}
+	report("futex_wait (value changed)", loops);
+}
+
+static struct fsem ping, pong, done;
+static unsigned pongloops;
+
+static
+void
+ponger(void)
+{
+	unsigned i;
+
+	for (i=0; i<pongloops; i++) {
+		fsem_P(&ping);
+		fsem_V(&pong);
+	}
+	fsem_V(&done);
+}
+
+static
+void
+bench_fsem_pingpong(unsigned loops)
+{
+	unsigned i;
+
+	fsem_init(&ping, 0);
+	fsem_init(&pong, 0);
+	fsem_init(&done, 0);
+	pongloops = loops;
+	if (threadfork(ponger) < 0) {
+		warn("threadfork");
+		return;
+	}
+
+	starttimer();
+	for (i=0; i<loops; i++) {
+		fsem_V(&ping);
+		fsem_P(&pong);
+	}
+	report("futex ping-pong (threads)", loops);
+	fsem_P(&done);
+}
+
+static
+int
+semopen(const char *name, int flags)
+{
+	int fd;
+
+	fd = open(name, O_RDWR|flags, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	return fd;
+}
+
+static
+void
+bench_semfs_pingpong(unsigned loops)
+{
+	char c = 0;
+	unsigned i;
+	int pingfd, pongfd, status;
+	pid_t pid;
+
+	pingfd = semopen(PINGNAME, O_CREAT|O_TRUNC);
+	pongfd = semopen(PONGNAME, O_CREAT|O_TRUNC);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (i=0; i<loops; i++) {
+			if (read(pingfd, &c, 1) != 1) {
+				err(1, "%s: read", PINGNAME);
+			}
+			if (write(pongfd, &c, 1) != 1) {
+				err(1, "%s: write", PONGNAME);
+			}
+		}
+		_exit(0);
+	}
+
+	starttimer();
+	for (i=0; i<loops; i++) {
+		if (write(pingfd, &c, 1) != 1) {
+			err(1, "%s: write", PINGNAME);
+		}
+		if (read(pongfd, &c, 1) != 1) {
+			err(1, "%s: read", PONGNAME);
+		}
+	}
+	report("semfs ping-pong (processes)", loops);
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	close(pingfd);
+	close(pongfd);
+	(void)remove(PINGNAME);
+	(void)remove(PONGNAME);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned loops = DEFAULT_LOOPS;
+
+	if (argc == 2) {
+		loops = atoi(argv[1]);
+	}
+	else if (argc != 1) {
+		errx(1, "Usage: %s [loops]", argv[0]);
+	}
+
+	bench_semfs(loops);
+	bench_fsem(loops);
+	bench_wake(loops);
+	bench_waitfail(loops);
+	bench_fsem_pingpong(loops);
+	bench_semfs_pingpong(loops);
+	return 0;
+}
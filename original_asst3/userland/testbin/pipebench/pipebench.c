@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/*
+ * pipebench - throughput from a producer process to a consumer
+ * process, through a pipe and through a temporary file.
+ *
+ * For each buffer size, the producer writes TOTAL bytes of a known
+ * pattern and the consumer reads and checks them. Through the pipe
+ * the two run at once; through the file (the only way to do this
+ * without pipes) the producer has to finish writing before the
+ * consumer can start, and everything goes through SFS.
+ *
+ * Usage: pipebench [kbytes]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_KBYTES 1024
+#define MAXBUF 16384
+#define FILENAME "pipebench.tmp"
+
+static const unsigned bufsizes[] = { 64, 512, 4096, 16384 };
+#define NBUFSIZES (sizeof(bufsizes) / sizeof(bufsizes[0]))
+
+static unsigned char buf[MAXBUF];
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+report(const char *what, unsigned bufsize, unsigned long total)
+{
+	uint64_t ns;
+
+	ns = elapsed_ns();
+
+	printf("%-5s %5u-byte buffers: %lu k in %lld.%09lu s: %7llu k/sec\n",
+	       what, bufsize, total / 1024, (long long)(ns / 1000000000),
+	       (unsigned long)(ns % 1000000000),
+	       (unsigned long long)((uint64_t)total * 1000000000 / 1024
+				    / ns));
+}
+
+////////////////////////////////////////////////////////////
+// producer and consumer
+
+/*
+ * Byte N of the stream is N mod 251, so a lost, repeated, or
+ * reordered chunk shows up (251 being prime, it doesn't line up with
+ * any buffer size).
+ */
+static
+void
+produce(int fd, unsigned bufsize, unsigned long total)
+{
+	unsigned long pos;
+	unsigned i, len;
+	ssize_t r;
+
+	for (pos = 0; pos < total; pos += len) {
+		len = bufsize;
+		if (len > total - pos) {
+			len = total - pos;
+		}
+		for (i=0; i<len; i++) {
+			buf[i] = (pos + i) % 251;
+		}
+		r = write(fd, buf, len);
+		if (r < 0) {
+			err(1, "producer: write");
+		}
+		if ((unsigned)r != len) {
+			errx(1, "producer: short write (%zd of %u)", r, len);
+		}
+	}
+}
+
+static
+void
+consume(int fd, unsigned bufsize, unsigned long total)
+{
+	unsigned long pos;
+	ssize_t r, i;
+
+	pos = 0;
+	while ((r = read(fd, buf, bufsize)) != 0) {
+		if (r < 0) {
+			err(1, "consumer: read");
+		}
+		for (i=0; i<r; i++) {
+			if (buf[i] != (pos + i) % 251) {
+				errx(1, "consumer: wrong data at byte %lu",
+				     pos + i);
+			}
+		}
+		pos += r;
+	}
+	if (pos != total) {
+		errx(1, "consumer: got %lu bytes, expected %lu", pos, total);
+	}
+}
+
+static
+void
+waitfor(pid_t pid, const char *what)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "%s failed", what);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+/*
+ * Producer in a child, consumer here, connected by a pipe.
+ */
+static
+void
+runpipe(unsigned bufsize, unsigned long total)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	starttimer();
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		produce(fds[1], bufsize, total);
+		close(fds[1]);
+		_exit(0);
+	}
+	close(fds[1]);
+	consume(fds[0], bufsize, total);
+	close(fds[0]);
+	waitfor(pid, "producer");
+	report("pipe", bufsize, total);
+}
+
+/*
+ * The same thing through a file: producer in a child writes it all,
+ * then the consumer here reads it back.
+ */
+static
+void
+runfile(unsigned bufsize, unsigned long total)
+{
+	pid_t pid;
+	int fd;
+
+	starttimer();
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", FILENAME);
+		}
+		produce(fd, bufsize, total);
+		close(fd);
+		_exit(0);
+	}
+	waitfor(pid, "producer");
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	consume(fd, bufsize, total);
+	close(fd);
+	remove(FILENAME);
+	report("file", bufsize, total);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long total;
+	unsigned kbytes = DEFAULT_KBYTES, i;
+
+	if (argc > 2) {
+		errx(1, "Usage: %s [kbytes]", argv[0]);
+	}
+	if (argc > 1) {
+		kbytes = atoi(argv[1]);
+	}
+	if (kbytes < 1) {
+		errx(1, "kbytes must be at least 1");
+	}
+	total = (unsigned long)kbytes * 1024;
+
+	for (i=0; i<NBUFSIZES; i++) {
+		runpipe(bufsizes[i], total);
+		runfile(bufsizes[i], total);
+	}
+	return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/*
+ * pollbench - a single-threaded event loop on poll().
+ *
+ * First some quick checks that poll() waits for the right things:
+ * a zero timeout on the console comes straight back; once the console
+ * polls readable, a read of a whole buffer returns what was typed
+ * without waiting for the rest of the line (type a key when asked, or
+ * let it time out to skip this); an empty poll with a timeout sleeps
+ * for about that long; and a semfs semaphore polls readable only once
+ * someone has done V on it.
+ *
+ * Then the benchmark: NPROCS producer processes each write messages
+ * into a pipe of their own, and this process reads them all in one
+ * loop, using poll() to find the pipes with something to read. Every
+ * message is checked, and the loop ends when every pipe has hung up.
+ * We report messages per second and how many messages each poll()
+ * call picked up on average.
+ *
+ * Usage: pollbench [maxprocs [messages]]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_MAXPROCS 16
+#define DEFAULT_MESSAGES 500
+#define MAXPROCS 32
+#define MSGSIZE 64
+#define SLEEPMS 100
+#define KEYMS 5000
+#define SEMNAME "sem:pollbench"
+
+////////////////////////////////////////////////////////////
+// checks
+
+static
+void
+checkconsole(void)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, 0);
+	if (r < 0) {
+		err(1, "poll on console");
+	}
+	printf("console: poll with no wait returned %d\n", r);
+}
+
+static
+void
+checkconsoleread(void)
+{
+	struct pollfd pfd;
+	char buf[MSGSIZE];
+	uint64_t ns;
+	int r;
+
+	printf("console: press a key (or wait %d s to skip)... ", KEYMS / 1000);
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, KEYMS);
+	if (r < 0) {
+		err(1, "poll on console");
+	}
+	if (r == 0) {
+		printf("skipped\n");
+		return;
+	}
+	if (pfd.revents != POLLIN) {
+		errx(1, "console: revents 0x%x", pfd.revents);
+	}
+
+	/* a whole buffer's worth, so only an early return can satisfy it */
+	starttimer();
+	r = read(STDIN_FILENO, buf, sizeof(buf));
+	ns = elapsed_ns();
+	if (r < 0) {
+		err(1, "console: read");
+	}
+	if (r == 0) {
+		errx(1, "console: read after POLLIN returned 0");
+	}
+	printf("\nconsole: read after POLLIN got %d bytes in %llu us\n", r,
+	       (unsigned long long)(ns / 1000));
+	if (ns > (uint64_t)SLEEPMS * 1000000) {
+		errx(1, "console: read after POLLIN waited for more input");
+	}
+}
+
+static
+void
+checktimeout(void)
+{
+	uint64_t ns;
+
+	starttimer();
+	if (poll(NULL, 0, SLEEPMS) != 0) {
+		errx(1, "empty poll didn't time out");
+	}
+	ns = elapsed_ns();
+	printf("timeout: %d ms poll took %llu ms\n", SLEEPMS,
+	       (unsigned long long)(ns / 1000000));
+	if (ns < (uint64_t)SLEEPMS * 1000000 / 2) {
+		errx(1, "poll came back too soon");
+	}
+}
+
+static
+void
+checksem(void)
+{
+	struct pollfd pfd;
+	pid_t pid;
+	int fd, status;
+	char ch = 0;
+
+	fd = open(SEMNAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SEMNAME);
+	}
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) != 0) {
+		errx(1, "%s: readable at count 0", SEMNAME);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		/* give the parent time to go to sleep in poll, then V */
+		poll(NULL, 0, SLEEPMS);
+		if (write(fd, &ch, 1) != 1) {
+			err(1, "%s: write", SEMNAME);
+		}
+		_exit(0);
+	}
+
+	if (poll(&pfd, 1, -1) != 1 || pfd.revents != POLLIN) {
+		errx(1, "%s: poll didn't see V", SEMNAME);
+	}
+	if (read(fd, &ch, 1) != 1) {
+		err(1, "%s: read", SEMNAME);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	close(fd);
+	remove(SEMNAME);
+	printf("semfs: poll woke up on V\n");
+}
+
+////////////////////////////////////////////////////////////
+// event loop
+
+/*
+ * Producer: MESSAGES messages of MSGSIZE bytes, each starting with
+ * the producer number and the message number.
+ */
+static
+void
+produce(int fd, unsigned me, unsigned messages)
+{
+	uint32_t msg[MSGSIZE / sizeof(uint32_t)];
+	unsigned i;
+
+	memset(msg, 0, sizeof(msg));
+	msg[0] = me;
+	for (i=0; i<messages; i++) {
+		msg[1] = i;
+		if (write(fd, msg, MSGSIZE) != MSGSIZE) {
+			err(1, "producer %u: write", me);
+		}
+	}
+}
+
+static
+void
+run(unsigned nprocs, unsigned messages)
+{
+	struct pollfd pfds[MAXPROCS];
+	uint32_t msg[MSGSIZE / sizeof(uint32_t)];
+	unsigned next[MAXPROCS];
+	pid_t pids[MAXPROCS];
+	unsigned i, nopen, polls, total;
+	int fds[2], r, status;
+	uint64_t ns;
+
+	for (i=0; i<nprocs; i++) {
+		if (pipe(fds) < 0) {
+			err(1, "pipe");
+		}
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			close(fds[0]);
+			produce(fds[1], i, messages);
+			_exit(0);
+		}
+		close(fds[1]);
+		pfds[i].fd = fds[0];
+		pfds[i].events = POLLIN;
+		next[i] = 0;
+	}
+
+	starttimer();
+	nopen = nprocs;
+	polls = total = 0;
+	while (nopen > 0) {
+		r = poll(pfds, nprocs, -1);
+		if (r < 0) {
+			err(1, "poll");
+		}
+		if (r == 0) {
+			errx(1, "poll with no timeout returned 0");
+		}
+		polls++;
+		for (i=0; i<nprocs; i++) {
+			if (pfds[i].revents & POLLIN) {
+				/* PIPE_BUF atomicity keeps messages whole */
+				r = read(pfds[i].fd, msg, MSGSIZE);
+				if (r != MSGSIZE) {
+					errx(1, "pipe %u: read returned %d",
+					     i, r);
+				}
+				if (msg[0] != i || msg[1] != next[i]) {
+					errx(1, "pipe %u: expected message "
+					     "%u, got %u from %u", i,
+					     next[i], msg[1], msg[0]);
+				}
+				next[i]++;
+				total++;
+			}
+			else if (pfds[i].revents & POLLHUP) {
+				if (next[i] != messages) {
+					errx(1, "pipe %u: hung up after %u",
+					     i, next[i]);
+				}
+				close(pfds[i].fd);
+				pfds[i].fd = -1;
+				nopen--;
+			}
+			else if (pfds[i].revents != 0) {
+				errx(1, "pipe %u: revents 0x%x", i,
+				     pfds[i].revents);
+			}
+		}
+	}
+	ns = elapsed_ns();
+
+	for (i=0; i<nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+
+	printf("%2u pipes: %6u messages in %llu us: %7llu msgs/sec, "
+	       "%u.%02u per poll\n",
+	       nprocs, total, (unsigned long long)(ns / 1000),
+	       (unsigned long long)((uint64_t)total * 1000000000 / ns),
+	       total / polls, (total % polls) * 100 / polls);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned maxprocs = DEFAULT_MAXPROCS, messages = DEFAULT_MESSAGES, n;
+
+	if (argc > 3) {
+		errx(1, "Usage: %s [maxprocs [messages]]", argv[0]);
+	}
+	if (argc > 1) {
+		maxprocs = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		messages = atoi(argv[2]);
+	}
+	if (maxprocs < 1 || maxprocs > MAXPROCS) {
+		errx(1, "maxprocs must be between 1 and %d", MAXPROCS);
+	}
+
+	checkconsole();
+	checkconsoleread();
+	checktimeout();
+	checksem();
+
+	for (n=1; n<=maxprocs; n*=4) {
+		run(n, messages);
+	}
+	return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * preadbench - random reads on one shared open file, from several
+ * processes at once, with lseek+read and with pread.
+ *
+ * The processes are forked after the file is opened, so they share
+ * one open file and one seek position. lseek followed by read has
+ * to go through the seek position (and its lock) twice per read,
+ * and another process can move it in between, so some reads land
+ * on the wrong block; we count those. pread says where to read
+ * every time and never touches the seek position.
+ *
+ * Every block of the file is filled with its own block number, so
+ * each read can be checked.
+ *
+ * Usage: preadbench [maxprocs [reads]]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_MAXPROCS 4
+#define DEFAULT_READS 1000
+#define BLOCKSIZE 512
+#define NBLOCKS 128
+#define FILENAME "preadbench.dat"
+
+static uint32_t block[BLOCKSIZE / sizeof(uint32_t)];
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+report(const char *what, unsigned nprocs, unsigned ops, unsigned bad)
+{
+	uint64_t ns;
+
+	ns = elapsed_ns();
+
+	printf("%-10s %2u procs: %6u reads in %lld.%09lu s: "
+	       "%7llu reads/sec, %u misread\n",
+	       what, nprocs, ops, (long long)(ns / 1000000000),
+	       (unsigned long)(ns % 1000000000),
+	       (unsigned long long)((uint64_t)ops * 1000000000 / ns),
+	       bad);
+}
+
+////////////////////////////////////////////////////////////
+// file
+
+static
+int
+makefile(void)
+{
+	unsigned i, j;
+	int fd;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (i=0; i<NBLOCKS; i++) {
+		for (j=0; j<BLOCKSIZE / sizeof(uint32_t); j++) {
+			block[j] = i;
+		}
+		if (write(fd, block, BLOCKSIZE) != BLOCKSIZE) {
+			err(1, "%s: write", FILENAME);
+		}
+	}
+	return fd;
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+/*
+ * One process's share: READS random blocks. Returns how many came
+ * back with the wrong contents.
+ */
+static
+unsigned
+reader(int fd, unsigned reads, int usepread)
+{
+	unsigned i, want, bad = 0;
+	off_t pos;
+	ssize_t r;
+
+	for (i=0; i<reads; i++) {
+		want = random() % NBLOCKS;
+		pos = (off_t)want * BLOCKSIZE;
+		if (usepread) {
+			r = pread(fd, block, BLOCKSIZE, pos);
+		}
+		else {
+			if (lseek(fd, pos, SEEK_SET) < 0) {
+				err(1, "%s: lseek", FILENAME);
+			}
+			r = read(fd, block, BLOCKSIZE);
+		}
+		if (r < 0) {
+			err(1, "%s: %s", FILENAME, usepread ? "pread" : "read");
+		}
+		if (r != BLOCKSIZE || block[0] != want ||
+		    block[BLOCKSIZE / sizeof(uint32_t) - 1] != want) {
+			bad++;
+		}
+	}
+	return bad;
+}
+
+/*
+ * Fork NPROCS readers on FD and wait for them. Each one exits with
+ * its count of bad reads (capped to fit in an exit status).
+ */
+static
+void
+run(int fd, unsigned nprocs, unsigned reads, int usepread)
+{
+	pid_t pids[32];
+	unsigned i, bad;
+	int status;
+
+	starttimer();
+	for (i=0; i<nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			srandom(i + 1);
+			bad = reader(fd, reads, usepread);
+			_exit(bad > 255 ? 255 : bad);
+		}
+	}
+	bad = 0;
+	for (i=0; i<nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status)) {
+			errx(1, "reader %u died", i);
+		}
+		bad += WEXITSTATUS(status);
+	}
+	report(usepread ? "pread" : "lseek+read", nprocs, nprocs * reads,
+	       bad);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned maxprocs = DEFAULT_MAXPROCS, reads = DEFAULT_READS, n;
+	int fd;
+
+	if (argc > 3) {
+		errx(1, "Usage: %s [maxprocs [reads]]", argv[0]);
+	}
+	if (argc > 1) {
+		maxprocs = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		reads = atoi(argv[2]);
+	}
+	if (maxprocs < 1 || maxprocs > 32) {
+		errx(1, "maxprocs must be between 1 and 32");
+	}
+
+	fd = makefile();
+	for (n=1; n<=maxprocs; n*=2) {
+		run(fd, n, reads, 0);
+		run(fd, n, reads, 1);
+	}
+	close(fd);
+	remove(FILENAME);
+	return 0;
+}
@@ -30,6 +30,8 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/schedstat.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -204,6 +206,68 @@ calcresult(unsigned groupid, time_t startsecs, unsigned long startnsecs,
 	snprintf(buf, bufmax, "%lld.%09lu", (long long)secs, nsecs);
 }
 
+/*
+ * Upper bound, in microseconds, of the wait-histogram bucket holding
+ * the PCT'th percentile of run-queue waits in SS.
+ */
+static
+unsigned
+schedpercentile(const struct schedstats *ss, unsigned pct)
+{
+	uint64_t want, seen;
+	unsigned i;
+
+	want = (ss->ss_waits * pct + 99) / 100;
+	seen = 0;
+	for (i=0; i<SCHEDSTAT_BUCKETS - 1; i++) {
+		seen += ss->ss_waithist[i];
+		if (seen >= want) {
+			break;
+		}
+	}
+	return 1U << i;
+}
+
+/*
+ * Print the scheduler statistics for the run, which are the
+ * difference between the snapshots BEFORE and AFTER, taken NSECS
+ * nanoseconds apart.
+ */
+static
+void
+printschedstats(const struct schedstats *before,
+		const struct schedstats *after, unsigned long long nsecs)
+{
+	struct schedstats ss;
+	unsigned i;
+
+	ss.ss_switches = after->ss_switches - before->ss_switches;
+	ss.ss_voluntary = after->ss_voluntary - before->ss_voluntary;
+	ss.ss_involuntary = after->ss_involuntary - before->ss_involuntary;
+	ss.ss_waits = after->ss_waits - before->ss_waits;
+	ss.ss_remotewakes = after->ss_remotewakes - before->ss_remotewakes;
+	ss.ss_ipis = after->ss_ipis - before->ss_ipis;
+	for (i=0; i<SCHEDSTAT_BUCKETS; i++) {
+		ss.ss_waithist[i] =
+			after->ss_waithist[i] - before->ss_waithist[i];
+	}
+
+	printf("--- Scheduling ---\n");
+	printf("Context switches: %llu (%llu voluntary, %llu preempted)\n",
+	       (unsigned long long)ss.ss_switches,
+	       (unsigned long long)ss.ss_voluntary,
+	       (unsigned long long)ss.ss_involuntary);
+	if (ss.ss_waits > 0) {
+		printf("Run queue wait: p50 < %u us, p99 < %u us\n",
+		       schedpercentile(&ss, 50), schedpercentile(&ss, 99));
+	}
+	printf("Remote wakeups: %llu, IPIs: %llu (%llu/sec)\n",
+	       (unsigned long long)ss.ss_remotewakes,
+	       (unsigned long long)ss.ss_ipis,
+	       nsecs == 0 ? 0ULL :
+	       (unsigned long long)(ss.ss_ipis * 1000000000ULL / nsecs));
+}
+
 /*
  * Used by the tasks to wait to start.
  */
@@ -224,8 +288,10 @@ runit(unsigned numthinkers, unsigned numgrinders,
       unsigned numponggroups, unsigned ponggroupsize)
 {
 	pid_t pids[numponggroups + 2];
-	time_t startsecs;
-	unsigned long startnsecs;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	struct schedstats ssbefore, ssafter;
+	bool haveschedstats;
 	char buf[32];
 	unsigned i;
 
@@ -243,10 +309,17 @@ runit(unsigned numthinkers, unsigned numgrinders,
 	}
 	usem_open(&startsem);
 	printf("Forking done; starting the workload.\n");
+	/* Older kernels won't have schedstat; just skip that output. */
+	haveschedstats = schedstat(SCHEDSTAT_ALLCPUS, &ssbefore) == 0;
 	__time(&startsecs, &startnsecs);
 	Vn(&startsem, numthinkers + numgrinders +
 	   numponggroups * ponggroupsize);
 	waitall(pids, numponggroups + 2);
+	__time(&endsecs, &endnsecs);
+	if (haveschedstats &&
+	    schedstat(SCHEDSTAT_ALLCPUS, &ssafter) < 0) {
+		haveschedstats = false;
+	}
 	usem_close(&startsem);
 	usem_cleanup(&startsem);
 
@@ -268,6 +341,12 @@ runit(unsigned numthinkers, unsigned numgrinders,
 		printf("Pong group %u: %s\n", i, buf);
 	}
 
+	if (haveschedstats) {
+		printschedstats(&ssbefore, &ssafter,
+				(endsecs - startsecs) * 1000000000ULL +
+				endnsecs - startnsecs);
+	}
+
 	closeresultsfile();
 	destroyresultsfile();
 }
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * writevbench - compare writing log records piece by piece against
+ * writing each one with a single writev.
+ *
+ * Each record is built from three fragments the way a logger would
+ * have them: a fixed header, a payload of varying length, and a
+ * trailer. The first run writes the fragments with one write call
+ * apiece; the second gathers them with writev. Both files are then
+ * read back and checked: each header with read, then the payload and
+ * trailer with one readv that scatters them into separate buffers.
+ *
+ * Usage: writevbench [records]
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/timer.h>
+
+#define DEFAULT_RECORDS 2000
+#define PAYLOADMAX 64
+#define FILENAME "writevbench.dat"
+
+struct header {
+	uint32_t h_seq;			/* Record number */
+	uint32_t h_len;			/* Payload length */
+};
+
+static const char trailer[4] = "END\n";
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+report(const char *what, unsigned ops, unsigned syscalls)
+{
+	uint64_t ns;
+
+	ns = elapsed_ns();
+
+	printf("%-12s %6u records, %6u syscalls in %lld.%09lu s: "
+	       "%8llu records/sec\n",
+	       what, ops, syscalls, (long long)(ns / 1000000000),
+	       (unsigned long)(ns % 1000000000),
+	       (unsigned long long)((uint64_t)ops * 1000000000 / ns));
+}
+
+////////////////////////////////////////////////////////////
+// records
+
+/*
+ * Payload lengths cycle so the records aren't all the same size.
+ */
+static
+uint32_t
+payloadlen(uint32_t seq)
+{
+	return 1 + (seq * 7) % PAYLOADMAX;
+}
+
+static
+void
+makerecord(uint32_t seq, struct header *h, char *payload)
+{
+	uint32_t i;
+
+	h->h_seq = seq;
+	h->h_len = payloadlen(seq);
+	for (i=0; i<h->h_len; i++) {
+		payload[i] = 'a' + (seq + i) % 26;
+	}
+}
+
+static
+int
+openfile(void)
+{
+	int fd;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	return fd;
+}
+
+static
+void
+writeall(int fd, const void *buf, size_t len)
+{
+	ssize_t r;
+
+	r = write(fd, buf, len);
+	if (r < 0) {
+		err(1, "%s: write", FILENAME);
+	}
+	if ((size_t)r != len) {
+		errx(1, "%s: short write", FILENAME);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+static
+unsigned
+bench_write(int fd, unsigned records)
+{
+	struct header h;
+	char payload[PAYLOADMAX];
+	unsigned i;
+
+	for (i=0; i<records; i++) {
+		makerecord(i, &h, payload);
+		writeall(fd, &h, sizeof(h));
+		writeall(fd, payload, h.h_len);
+		writeall(fd, trailer, sizeof(trailer));
+	}
+	return records * 3;
+}
+
+static
+unsigned
+bench_writev(int fd, unsigned records)
+{
+	struct header h;
+	char payload[PAYLOADMAX];
+	struct iovec iov[3];
+	size_t len;
+	ssize_t r;
+	unsigned i;
+
+	for (i=0; i<records; i++) {
+		makerecord(i, &h, payload);
+		iov[0].iov_base = &h;
+		iov[0].iov_len = sizeof(h);
+		iov[1].iov_base = payload;
+		iov[1].iov_len = h.h_len;
+		iov[2].iov_base = (void *)trailer;
+		iov[2].iov_len = sizeof(trailer);
+		len = sizeof(h) + h.h_len + sizeof(trailer);
+
+		r = writev(fd, iov, 3);
+		if (r < 0) {
+			err(1, "%s: writev", FILENAME);
+		}
+		if ((size_t)r != len) {
+			errx(1, "%s: short writev", FILENAME);
+		}
+	}
+	return records;
+}
+
+/*
+ * Read the records back. The header comes first, with read, since it
+ * says how long the payload is; then one readv gets the payload and
+ * the trailer.
+ */
+static
+void
+check(int fd, unsigned records, const char *what)
+{
+	struct header h, want;
+	char payload[PAYLOADMAX], expect[PAYLOADMAX], tail[sizeof(trailer)];
+	struct iovec iov[2];
+	unsigned i;
+	ssize_t r;
+
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		err(1, "%s: lseek", FILENAME);
+	}
+
+	for (i=0; i<records; i++) {
+		makerecord(i, &want, expect);
+		r = read(fd, &h, sizeof(h));
+		if (r != sizeof(h)) {
+			errx(1, "%s: %s: record %u: short read",
+			     FILENAME, what, i);
+		}
+		if (h.h_seq != i || h.h_len != want.h_len) {
+			errx(1, "%s: %s: record %u: bad header (seq %u len %u)",
+			     FILENAME, what, i, h.h_seq, h.h_len);
+		}
+
+		iov[0].iov_base = payload;
+		iov[0].iov_len = h.h_len;
+		iov[1].iov_base = tail;
+		iov[1].iov_len = sizeof(tail);
+		r = readv(fd, iov, 2);
+		if (r != (ssize_t)(h.h_len + sizeof(tail))) {
+			errx(1, "%s: %s: record %u: short readv",
+			     FILENAME, what, i);
+		}
+		if (memcmp(payload, expect, h.h_len) != 0 ||
+		    memcmp(tail, trailer, sizeof(tail)) != 0) {
+			errx(1, "%s: %s: record %u: bad contents",
+			     FILENAME, what, i);
+		}
+	}
+	if (read(fd, &h, 1) != 0) {
+		errx(1, "%s: %s: junk at end of file", FILENAME, what);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned records = DEFAULT_RECORDS;
+	unsigned wcalls, vcalls;
+	int fd;
+
+	if (argc == 2) {
+		if (atoi(argv[1]) < 1) {
+			errx(1, "records must be at least 1");
+		}
+		records = atoi(argv[1]);
+	}
+	else if (argc != 1) {
+		errx(1, "Usage: %s [records]", argv[0]);
+	}
+
+	fd = openfile();
+	starttimer();
+	wcalls = bench_write(fd, records);
+	report("write x3", records, wcalls);
+	check(fd, records, "write");
+	close(fd);
+
+	fd = openfile();
+	starttimer();
+	vcalls = bench_writev(fd, records);
+	report("writev", records, vcalls);
+	check(fd, records, "writev");
+	close(fd);
+
+	remove(FILENAME);
+	printf("writev saved %u of %u syscalls\n", wcalls - vcalls, wcalls);
+	return 0;
+}